@@ -0,0 +1,157 @@
+#include "AllocationCounter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<uint64_t> g_NumAllocations{};
+
+	void* CountedAllocate(size_t size) noexcept
+	{
+		g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size == 0 ? 1 : size);
+	}
+
+	//Over-aligned types (the alignas(32) BVH nodes and packets), freed with CountedFreeAligned
+	void* CountedAllocateAligned(size_t size, std::align_val_t alignment) noexcept
+	{
+		g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+		const size_t alignmentBytes{ static_cast<size_t>(alignment) };
+#if defined(_MSC_VER)
+		return _aligned_malloc(size == 0 ? 1 : size, alignmentBytes);
+#else
+		//The size has to be a multiple of the alignment
+		return std::aligned_alloc(alignmentBytes, (std::max(size, size_t{ 1 }) + alignmentBytes - 1) / alignmentBytes * alignmentBytes);
+#endif
+	}
+
+	void CountedFreeAligned(void* pMemory) noexcept
+	{
+#if defined(_MSC_VER)
+		_aligned_free(pMemory);
+#else
+		std::free(pMemory);
+#endif
+	}
+}
+
+uint64_t dae::AllocationCounter::GetNumAllocations()
+{
+	return g_NumAllocations.load(std::memory_order_relaxed);
+}
+
+//Replacements of the global allocation functions, the deletes have to pair with malloc (or the aligned allocation)
+void* operator new(size_t size)
+{
+	void* pMemory{ CountedAllocate(size) };
+	if (pMemory == nullptr)
+		throw std::bad_alloc{};
+	return pMemory;
+}
+
+void* operator new[](size_t size)
+{
+	void* pMemory{ CountedAllocate(size) };
+	if (pMemory == nullptr)
+		throw std::bad_alloc{};
+	return pMemory;
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* pMemory{ CountedAllocateAligned(size, alignment) };
+	if (pMemory == nullptr)
+		throw std::bad_alloc{};
+	return pMemory;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	void* pMemory{ CountedAllocateAligned(size, alignment) };
+	if (pMemory == nullptr)
+		throw std::bad_alloc{};
+	return pMemory;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, alignment);
+}
+
+void operator delete(void* pMemory) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete[](void* pMemory) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete(void* pMemory, size_t) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete[](void* pMemory, size_t) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete(void* pMemory, const std::nothrow_t&) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete[](void* pMemory, const std::nothrow_t&) noexcept
+{
+	std::free(pMemory);
+}
+
+void operator delete(void* pMemory, std::align_val_t) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
+
+void operator delete[](void* pMemory, std::align_val_t) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
+
+void operator delete(void* pMemory, size_t, std::align_val_t) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
+
+void operator delete[](void* pMemory, size_t, std::align_val_t) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
+
+void operator delete(void* pMemory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
+
+void operator delete[](void* pMemory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	CountedFreeAligned(pMemory);
+}
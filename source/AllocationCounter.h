@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+namespace dae
+{
+	//Counts the heap allocations (the global operator new and new[], over-aligned ones included) of all threads,
+	//so frames can be checked for allocating in their steady state
+	namespace AllocationCounter
+	{
+		uint64_t GetNumAllocations();
+	}
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cmath>
 #include "Math.h"
 #include <algorithm>
 
@@ -110,5 +111,113 @@ namespace dae
 
 		}
 
+		/**
+		 * \brief Tangent and bitangent completing n to an orthonormal basis (Duff et al. 2017, branchless)
+		 * \param n Normalized normal
+		 * \param t Tangent
+		 * \param b Bitangent
+		 */
+		static void OrthonormalBasis(const Vector3& n, Vector3& t, Vector3& b)
+		{
+			const float sign{ std::copysign(1.f, n.z) };
+			const float a{ -1.f / (sign + n.z) };
+			const float c{ n.x * n.y * a };
+			t = { 1.f + sign * n.x * n.x * a, sign * c, -sign * n.x };
+			b = { c, sign + n.y * n.y * a, -n.y };
+		}
+
+		/**
+		 * \brief Cosine weighted direction on the hemisphere around n
+		 * \param n Normal of the surface
+		 * \param u Two uniform numbers in [0, 1)
+		 * \return Normalized direction, density Pdf_CosineHemisphere
+		 */
+		static Vector3 Sample_CosineHemisphere(const Vector3& n, const Vector2& u)
+		{
+			const float r{ sqrtf(u.x) };
+			const float phi{ PI_2 * u.y };
+			const float z{ sqrtf(std::max(0.f, 1.f - u.x)) };
+
+			Vector3 t{}, b{};
+			OrthonormalBasis(n, t, b);
+			return t * (r * cosf(phi)) + b * (r * sinf(phi)) + n * z;
+		}
+
+		static float Pdf_CosineHemisphere(const Vector3& n, const Vector3& l)
+		{
+			return std::max(Vector3::Dot(n, l), 0.f) / PI;
+		}
+
+		/**
+		 * \brief Exact Smith masking term for GGX, used for the visible normal density (the shading keeps SchlickGGX)
+		 * \param n Normal of the surface
+		 * \param w Normalized direction away from the surface
+		 * \param roughness Roughness of the material (alpha = roughness^2, like NormalDistribution_GGX)
+		 */
+		static float MaskingFunction_SmithGGX(const Vector3& n, const Vector3& w, float roughness)
+		{
+			const float alphaSqr{ powf(roughness, 4) };
+			const float dotNW{ std::max(Vector3::Dot(n, w), 0.f) };
+			if (dotNW <= 0.f)
+				return 0.f;
+			return 2.f * dotNW / (dotNW + sqrtf(alphaSqr + (1.f - alphaSqr) * dotNW * dotNW));
+		}
+
+		/**
+		 * \brief GGX visible normal sampling (Heitz 2018), only microfacets facing the viewer are generated
+		 * \param n Normal of the surface
+		 * \param wo Normalized direction towards the viewer
+		 * \param roughness Roughness of the material (alpha = roughness^2)
+		 * \param u Two uniform numbers in [0, 1)
+		 * \return Sampled microfacet normal (half vector)
+		 */
+		static Vector3 Sample_GGXVisibleNormal(const Vector3& n, const Vector3& wo, float roughness, const Vector2& u)
+		{
+			const float alpha{ roughness * roughness };
+
+			//View direction in the local frame around n
+			Vector3 t{}, b{};
+			OrthonormalBasis(n, t, b);
+			const Vector3 woLocal{ Vector3::Dot(wo, t), Vector3::Dot(wo, b), Vector3::Dot(wo, n) };
+
+			//Stretch to the hemisphere configuration
+			const Vector3 vh{ Vector3{ alpha * woLocal.x, alpha * woLocal.y, woLocal.z }.Normalized() };
+
+			const float lengthSqr{ vh.x * vh.x + vh.y * vh.y };
+			const Vector3 t1{ lengthSqr > 0.f ? Vector3{ -vh.y, vh.x, 0.f } / sqrtf(lengthSqr) : Vector3::UnitX };
+			const Vector3 t2{ Vector3::Cross(vh, t1) };
+
+			//Disk sample, warped to the visible half of the projected hemisphere
+			const float r{ sqrtf(u.x) };
+			const float phi{ PI_2 * u.y };
+			const float p1{ r * cosf(phi) };
+			const float s{ 0.5f * (1.f + vh.z) };
+			const float p2{ (1.f - s) * sqrtf(std::max(0.f, 1.f - p1 * p1)) + s * r * sinf(phi) };
+
+			const Vector3 nh{ t1 * p1 + t2 * p2 + vh * sqrtf(std::max(0.f, 1.f - p1 * p1 - p2 * p2)) };
+
+			//Unstretch back to the ellipsoid and to world space
+			const Vector3 hLocal{ Vector3{ alpha * nh.x, alpha * nh.y, std::max(0.f, nh.z) }.Normalized() };
+			return t * hLocal.x + b * hLocal.y + n * hLocal.z;
+		}
+
+		/**
+		 * \brief Density of the reflected direction l generated by Sample_GGXVisibleNormal
+		 * \param n Normal of the surface
+		 * \param wo Normalized direction towards the viewer
+		 * \param l Normalized reflected direction
+		 * \param roughness Roughness of the material
+		 * \return Solid angle density of l
+		 */
+		static float Pdf_GGXVisibleNormal(const Vector3& n, const Vector3& wo, const Vector3& l, float roughness)
+		{
+			const float dotNV{ Vector3::Dot(n, wo) };
+			if (dotNV <= 0.f || Vector3::Dot(n, l) <= 0.f)
+				return 0.f;
+
+			const Vector3 h{ (wo + l).Normalized() };
+			return MaskingFunction_SmithGGX(n, wo, roughness) * NormalDistribution_GGX(n, h, roughness) / (4.f * dotNV);
+		}
+
 	}
 }
\ No newline at end of file
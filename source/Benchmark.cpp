@@ -0,0 +1,861 @@
+//Microbenchmarks for the intersection and shading kernels, built as a separate console target (Benchmark.vcxproj)
+//Every kernel runs over fixed, seeded input sets so numbers are comparable between builds, whole frames are only checked for heap allocations
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SDL_MAIN_HANDLED //Plain console main, the frame benchmark only needs a hidden window
+#include "SDL.h"
+
+#include "Math.h"
+#include "DataTypes.h"
+#include "Utils.h"
+#include "BRDFs.h"
+#include "TriangleBVH.h"
+#include "Texture.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
+#include "Material.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Timer.h"
+
+using namespace dae;
+
+namespace
+{
+	constexpr size_t NumInputs{ 1 << 14 }; //Small enough to stay in cache, the kernels are measured, not memory
+	constexpr double MinDuration{ 0.25 }; //Seconds per kernel and set
+	constexpr uint32_t Seed{ 0x5EED };
+
+	//Keeps the compiler from removing the benchmarked calls
+	volatile float g_Sink{};
+
+	enum class RaySet
+	{
+		HitHeavy, //Aimed at a random point on the primitive
+		MissHeavy, //Aimed well beside the primitive
+		Grazing //Nearly parallel to the surface, through its edges
+	};
+
+	const char* ToString(RaySet set)
+	{
+		switch (set)
+		{
+		case RaySet::HitHeavy: return "hit-heavy";
+		case RaySet::MissHeavy: return "miss-heavy";
+		case RaySet::Grazing: return "grazing";
+		}
+		return "";
+	}
+
+	class RandomInputs final
+	{
+	public:
+		explicit RandomInputs(uint32_t seed) : m_Engine{ seed } {}
+
+		float Next(float min = 0.f, float max = 1.f)
+		{
+			return std::uniform_real_distribution<float>{ min, max }(m_Engine);
+		}
+
+		Vector3 NextDirection()
+		{
+			//Uniform on the sphere
+			const float z{ Next(-1.f, 1.f) };
+			const float phi{ Next(0.f, 2.f * PI) };
+			const float r{ sqrtf(std::max(0.f, 1.f - z * z)) };
+			return { r * cosf(phi), r * sinf(phi), z };
+		}
+
+		Vector3 NextPoint(float extent)
+		{
+			return { Next(-extent, extent), Next(-extent, extent), Next(-extent, extent) };
+		}
+
+	private:
+		std::mt19937 m_Engine;
+	};
+
+	/**
+	 * \brief Rays towards a target point, pushed off the primitive for the miss set
+	 * \param target Point on the primitive
+	 * \param tangent Direction along the surface, used for the grazing set
+	 * \param normal Surface normal at the target
+	 */
+	Ray MakeRay(RandomInputs& random, RaySet set, const Vector3& target, const Vector3& tangent, const Vector3& normal, float missOffset)
+	{
+		Vector3 origin{};
+		Vector3 aim{ target };
+		switch (set)
+		{
+		case RaySet::HitHeavy:
+			origin = target + random.NextDirection() * 10.f;
+			if (Vector3::Dot(origin - target, normal) < 0.f)
+			{
+				origin = target + Vector3::Reflect(origin - target, normal);
+			}
+			break;
+		case RaySet::MissHeavy:
+			origin = target + normal * 10.f + random.NextDirection() * 2.f;
+			aim = target + tangent * missOffset;
+			break;
+		case RaySet::Grazing:
+			origin = target - tangent * 10.f + normal * random.Next(0.f, 0.05f);
+			break;
+		}
+
+		return { origin, (aim - origin).Normalized() };
+	}
+
+	struct Result
+	{
+		double nanosecondsPerTest{};
+		double hitRate{};
+	};
+
+	//Runs the kernel over all inputs until MinDuration has passed, the kernel returns whether it hit
+	//Templated rather than a std::function, the call overhead would be in the same range as the cheaper kernels
+	template<typename Kernel>
+	Result Measure(const Kernel& kernel)
+	{
+		//Warm up, also counts the hits
+		size_t numHits{};
+		for (size_t i = 0; i < NumInputs; ++i)
+		{
+			numHits += kernel(i) ? 1 : 0;
+		}
+
+		size_t numTests{};
+		const auto start{ std::chrono::steady_clock::now() };
+		double elapsed{};
+		do
+		{
+			for (size_t i = 0; i < NumInputs; ++i)
+			{
+				g_Sink = g_Sink + (kernel(i) ? 1.f : 0.f);
+			}
+			numTests += NumInputs;
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (elapsed < MinDuration);
+
+		return { elapsed * 1e9 / static_cast<double>(numTests), static_cast<double>(numHits) / static_cast<double>(NumInputs) };
+	}
+
+	//Bumpy grid in [-1, 1] on xz, 2 * gridSize * gridSize triangles
+	TriangleMesh CreateGridMesh(int gridSize)
+	{
+		std::vector<Vector3> positions{};
+		std::vector<int> indices{};
+		for (int z = 0; z <= gridSize; ++z)
+		{
+			for (int x = 0; x <= gridSize; ++x)
+			{
+				const float u{ static_cast<float>(x) / gridSize * 2.f - 1.f };
+				const float v{ static_cast<float>(z) / gridSize * 2.f - 1.f };
+				positions.push_back({ u, 0.1f * sinf(u * 7.f) * cosf(v * 5.f), v });
+			}
+		}
+		for (int z = 0; z < gridSize; ++z)
+		{
+			for (int x = 0; x < gridSize; ++x)
+			{
+				const int i{ z * (gridSize + 1) + x };
+				indices.insert(indices.end(), { i, i + gridSize + 1, i + 1, i + 1, i + gridSize + 1, i + gridSize + 2 });
+			}
+		}
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	//Long, thin triangles, a [-1, 1] square cut into numStrips strips along z, rotated off the axes
+	TriangleMesh CreateStripMesh(int numStrips)
+	{
+		std::vector<Vector3> positions{};
+		std::vector<int> indices{};
+		for (int z = 0; z <= numStrips; ++z)
+		{
+			const float v{ static_cast<float>(z) / numStrips * 2.f - 1.f };
+			positions.push_back({ -1.f, 0.f, v });
+			positions.push_back({ 1.f, 0.f, v });
+		}
+		for (int z = 0; z < numStrips; ++z)
+		{
+			const int i{ z * 2 };
+			indices.insert(indices.end(), { i, i + 2, i + 1, i + 1, i + 2, i + 3 });
+		}
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.rotationTransform = Matrix::CreateRotationY(0.6f) * Matrix::CreateRotationX(0.4f);
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	void Report(const std::string& kernel, const char* set, const Result& result)
+	{
+		printf("%-30s %-11s %10.2f ns %12.2f Mtests/s %8.1f %%\n", kernel.c_str(), set,
+			result.nanosecondsPerTest, 1e3 / result.nanosecondsPerTest, result.hitRate * 100.0);
+	}
+}
+
+#pragma region Intersection
+static void BenchmarkSphere(RaySet set)
+{
+	RandomInputs random{ Seed };
+	const Sphere sphere{ {}, 1.f, 0 };
+
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		const Vector3 normal{ random.NextDirection() };
+		const Vector3 target{ sphere.origin + normal * sphere.radius };
+		const Vector3 tangent{ Vector3::Cross(normal, std::abs(normal.y) < 0.9f ? Vector3::UnitY : Vector3::UnitX).Normalized() };
+		rays.push_back(MakeRay(random, set, target, tangent, normal, 3.f));
+	}
+
+	HitRecord hitRecord{};
+	Report("HitTest_Sphere", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return GeometryUtils::HitTest_Sphere(sphere, rays[i], hitRecord);
+		}));
+	Report("HitTest_Sphere (any hit)", ToString(set), Measure([&](size_t i)
+		{
+			return GeometryUtils::HitTest_Sphere(sphere, rays[i]);
+		}));
+}
+
+static void BenchmarkPlane(RaySet set)
+{
+	RandomInputs random{ Seed };
+	const Plane plane{ Vector3::UnitY, {}, 0 };
+
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		const Vector3 target{ random.Next(-5.f, 5.f), 0.f, random.Next(-5.f, 5.f) };
+		Ray ray{ MakeRay(random, set, target, Vector3::UnitX, plane.normal, 0.f) };
+		if (set == RaySet::MissHeavy)
+		{
+			//An infinite plane is only missed by rays pointing away from it
+			const Vector3& direction = ray.GetDirection();
+			ray.SetDirection({ direction.x, std::abs(direction.y), direction.z });
+		}
+		rays.push_back(ray);
+	}
+
+	HitRecord hitRecord{};
+	Report("HitTest_Plane", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return GeometryUtils::HitTest_Plane(plane, rays[i], hitRecord);
+		}));
+}
+
+static void BenchmarkTriangle(RaySet set)
+{
+	RandomInputs random{ Seed };
+	Triangle triangle{ { -1.f, 0.f, -1.f }, { 0.f, 0.f, 1.f }, { 1.f, 0.f, -1.f } };
+	triangle.cullMode = TriangleCullMode::NoCulling;
+
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		//Uniform point on the triangle
+		float u{ random.Next() };
+		float v{ random.Next() };
+		if (u + v > 1.f)
+		{
+			u = 1.f - u;
+			v = 1.f - v;
+		}
+		const Vector3 target{ triangle.v0 + (triangle.v1 - triangle.v0) * u + (triangle.v2 - triangle.v0) * v };
+		rays.push_back(MakeRay(random, set, target, Vector3::UnitX, triangle.normal, 3.f));
+	}
+
+	HitRecord hitRecord{};
+	Report("HitTest_Triangle", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return GeometryUtils::HitTest_Triangle(triangle, rays[i], hitRecord);
+		}));
+	Report("HitTest_Triangle (any hit)", ToString(set), Measure([&](size_t i)
+		{
+			return GeometryUtils::HitTest_Triangle(triangle, rays[i]);
+		}));
+
+	//Distance only, as the mesh loops use them, the watertight setup is per ray (shared by all triangles of a mesh)
+	std::vector<GeometryUtils::WatertightRay> watertightRays{};
+	watertightRays.reserve(NumInputs);
+	for (const Ray& ray : rays)
+	{
+		watertightRays.push_back(GeometryUtils::MakeWatertightRay(ray));
+	}
+
+	float t{};
+	float u{};
+	float v{};
+	Report("HitDistance_Triangle", ToString(set), Measure([&](size_t i)
+		{
+			return GeometryUtils::HitDistance_Triangle(triangle, rays[i], t, u, v);
+		}));
+	Report("HitDistance_TriangleWatertight", ToString(set), Measure([&](size_t i)
+		{
+			return GeometryUtils::HitDistance_TriangleWatertight(triangle, rays[i], watertightRays[i], t, u, v);
+		}));
+}
+
+static void BenchmarkSlabTest(RaySet set)
+{
+	RandomInputs random{ Seed };
+
+	//Unit cube
+	const std::vector<Vector3> positions{ { -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 }, { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } };
+	const std::vector<int> indices{ 0, 1, 2, 0, 2, 3, 4, 6, 5, 4, 7, 6, 0, 4, 5, 0, 5, 1, 3, 2, 6, 3, 6, 7, 0, 3, 7, 0, 7, 4, 1, 5, 6, 1, 6, 2 };
+	TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+	mesh.UpdateAABB();
+	mesh.UpdateTransforms();
+
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		//Point on the top face
+		const Vector3 target{ random.Next(-1.f, 1.f), 1.f, random.Next(-1.f, 1.f) };
+		rays.push_back(MakeRay(random, set, target, Vector3::UnitX, Vector3::UnitY, 3.f));
+	}
+
+	Report("SlabTest_TriangleMesh", ToString(set), Measure([&](size_t i)
+		{
+			return GeometryUtils::SlabTest_TriangleMesh(mesh, rays[i]);
+		}));
+}
+
+static void BenchmarkTriangleMesh(RaySet set)
+{
+	RandomInputs random{ Seed };
+
+	const TriangleMesh mesh{ CreateGridMesh(32) };
+
+	TriangleBVH bvh{};
+	bvh.Build(mesh);
+
+	TriangleMesh compressedMesh{ mesh };
+	compressedMesh.Compress();
+	TriangleBVH compressedBVH{};
+	compressedBVH.Build(compressedMesh);
+
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		const Vector3 target{ random.Next(-1.f, 1.f), 0.f, random.Next(-1.f, 1.f) };
+		rays.push_back(MakeRay(random, set, target, Vector3::UnitX, Vector3::UnitY, 3.f));
+	}
+
+	HitRecord hitRecord{};
+	Report("HitTest_TriangleMesh (2048)", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return GeometryUtils::HitTest_TriangleMesh(mesh, rays[i], hitRecord);
+		}));
+	Report("TriangleBVH::Intersect (2048)", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return bvh.Intersect(mesh, rays[i], hitRecord);
+		}));
+	Report("TriangleBVH::Intersect (any hit)", ToString(set), Measure([&](size_t i)
+		{
+			HitRecord anyHitRecord{};
+			return bvh.Intersect(mesh, rays[i], anyHitRecord, true);
+		}));
+	Report("TriangleBVH::Intersect watertight", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return bvh.Intersect(mesh, rays[i], hitRecord, false, TriangleKernel::Watertight);
+		}));
+	Report("TriangleBVH::Intersect compressed", ToString(set), Measure([&](size_t i)
+		{
+			hitRecord = {};
+			return compressedBVH.Intersect(compressedMesh, rays[i], hitRecord);
+		}));
+}
+//Rays aimed exactly at the vertices and edge midpoints of a closed grid, any miss slipped through a gap between triangles
+static void BenchmarkWatertightness()
+{
+	constexpr int GridSize{ 64 };
+	RandomInputs random{ Seed };
+
+	const TriangleMesh mesh{ CreateGridMesh(GridSize) };
+	TriangleBVH bvh{};
+	bvh.Build(mesh);
+
+	std::vector<Ray> rays{};
+	for (int z = 1; z < GridSize; ++z)
+	{
+		for (int x = 1; x < GridSize; ++x)
+		{
+			const int i{ z * (GridSize + 1) + x };
+			const Vector3& vertex = mesh.transformedPositions[i];
+			for (const Vector3& target : { vertex, (vertex + mesh.transformedPositions[i + 1]) * 0.5f, (vertex + mesh.transformedPositions[i + GridSize + 1]) * 0.5f })
+			{
+				//Steeper than the bumps (slope up to 0.7), so no ray only touches a silhouette
+				Vector3 offset{ random.NextDirection() };
+				offset.y = std::abs(offset.y) + 1.f;
+				const Vector3 origin{ target + offset * 3.f };
+				rays.push_back(Ray{ origin, (target - origin).Normalized() });
+			}
+		}
+	}
+
+	const auto countLeaks = [&](const auto& intersect)
+	{
+		size_t numLeaks{};
+		for (const Ray& ray : rays)
+		{
+			HitRecord hitRecord{};
+			numLeaks += intersect(ray, hitRecord) ? 0 : 1;
+		}
+		return numLeaks;
+	};
+
+	printf("\n%-30s %10s (of %zu rays through vertices and edges)\n", "watertightness", "leaks", rays.size());
+	for (const auto& [kernel, name] : { std::pair{ TriangleKernel::MollerTrumbore, "MollerTrumbore" }, std::pair{ TriangleKernel::Watertight, "Watertight" } })
+	{
+		const size_t bruteForceLeaks{ countLeaks([&](const Ray& ray, HitRecord& hitRecord) { return GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord, false, kernel); }) };
+		const size_t bvhLeaks{ countLeaks([&](const Ray& ray, HitRecord& hitRecord) { return bvh.Intersect(mesh, ray, hitRecord, false, kernel); }) };
+		printf("%-30s %10zu %10zu (TriangleBVH)\n", name, bruteForceLeaks, bvhLeaks);
+	}
+}
+#pragma endregion
+
+#pragma region Acceleration Structures
+static void BenchmarkBVHBuild(const char* meshName, const TriangleMesh& mesh)
+{
+	constexpr int NumBuilds{ 3 };
+
+	//Aimed at random points in the bounds, from above
+	RandomInputs random{ Seed };
+	std::vector<Ray> rays{};
+	rays.reserve(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		const Vector3 target{ random.Next(mesh.transformedMinAABB.x, mesh.transformedMaxAABB.x), random.Next(mesh.transformedMinAABB.y, mesh.transformedMaxAABB.y),
+			random.Next(mesh.transformedMinAABB.z, mesh.transformedMaxAABB.z) };
+		rays.push_back(MakeRay(random, RaySet::HitHeavy, target, Vector3::UnitX, Vector3::UnitY, 3.f));
+	}
+
+	const std::string title{ std::string{ "build, " } + meshName + " (" + std::to_string(mesh.indices.size() / 3) + ")" };
+	printf("\n%-30s %10s %10s %10s %10s %10s %13s %8s\n", title.c_str(), "time", "SAH cost", "nodes", "packets", "references", "trace/ray", "hits");
+	for (const auto& [method, name] : { std::pair{ BVHBuildMethod::BinnedSAH, "BinnedSAH" }, std::pair{ BVHBuildMethod::SpatialSplitSAH, "SpatialSplitSAH" },
+		std::pair{ BVHBuildMethod::MortonLBVH, "MortonLBVH" } })
+	{
+		//Fastest of a few builds, the first one also pays for page faults
+		TriangleBVH bvh{};
+		double buildTime{ DBL_MAX };
+		for (int i = 0; i < NumBuilds; ++i)
+		{
+			bvh.Build(mesh, method);
+			buildTime = std::min(buildTime, bvh.GetBuildStats().buildTime);
+		}
+
+		HitRecord hitRecord{};
+		const Result trace{ Measure([&](size_t i)
+			{
+				hitRecord = {};
+				return bvh.Intersect(mesh, rays[i], hitRecord);
+			}) };
+
+		const TriangleBVH::BuildStats& stats = bvh.GetBuildStats();
+		printf("%-30s %7.2f ms %10.2f %10u %10u %10u %10.2f ns %6.1f %%\n", name, buildTime * 1e3, stats.sahCost, stats.numNodes, stats.numPackets, stats.numReferences,
+			trace.nanosecondsPerTest, trace.hitRate * 100.0);
+	}
+}
+
+//Memory of the mesh and its BVH, full precision against compressed
+static void BenchmarkCompression(const char* meshName, const TriangleMesh& mesh)
+{
+	const auto bytesPerTriangle = [](const TriangleMesh& m, const TriangleBVH& bvh)
+	{
+		return static_cast<double>(m.GetGeometryBytes() + bvh.GetNumBytes()) / m.GetNumTriangles();
+	};
+
+	TriangleBVH bvh{};
+	bvh.Build(mesh);
+
+	TriangleMesh compressedMesh{ mesh };
+	compressedMesh.Compress();
+	TriangleBVH compressedBVH{};
+	compressedBVH.Build(compressedMesh);
+
+	const std::string title{ std::string{ "compression, " } + meshName + " (" + std::to_string(mesh.GetNumTriangles()) + ")" };
+	printf("\n%-30s %16s %16s %16s\n", title.c_str(), "full", "compressed", "mesh only");
+	printf("%-30s %9.1f B/tri %9.1f B/tri %7.1f x less\n", "mesh + BVH", bytesPerTriangle(mesh, bvh), bytesPerTriangle(compressedMesh, compressedBVH),
+		static_cast<double>(mesh.GetGeometryBytes()) / compressedMesh.GetGeometryBytes());
+}
+#pragma endregion
+
+#pragma region Frame
+//Heap allocations of one warmed up Scene::Update + Renderer::Render per scene and render mode, the steady state should need none
+static uint64_t BenchmarkSteadyStateAllocations()
+{
+	constexpr int NumWarmUpFrames{ 8 }; //Caches, frame arenas and history buffers reach their size, dynamic resolution settles
+
+	SDL_Window* pWindow{ SDL_CreateWindow("Benchmark", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 480, SDL_WINDOW_HIDDEN) };
+	if (!pWindow)
+	{
+		printf("\n%-30s %s\n", "steady state frame", "no window");
+		return 1;
+	}
+
+	//Scenes that need no files, the texture scene streams its tiles through the cache
+	const std::pair<const char*, Scene* (*)()> scenes[]{
+		{ "reference", []() -> Scene* { return new Scene_W4_ReferenceScene(); } },
+		{ "textures", []() -> Scene* { return new Scene_Textures(); } },
+		{ "stress", []() -> Scene* { return new Scene_Stress({ 2000, 32, 16 }); } } };
+
+	//Toggled on before and off again after the measured frame
+	const std::pair<const char*, void (*)(Renderer&)> modes[]{
+		{ "ray traced", [](Renderer&) {} },
+		{ "rasterized", [](Renderer& renderer) { renderer.ToggleRasterization(); } },
+		{ "path traced", [](Renderer& renderer) { renderer.TogglePathTracing(); } } };
+
+	printf("\n%-30s %-11s %10s\n", "steady state frame", "mode", "allocs");
+	uint64_t totalAllocations{};
+	for (const auto& [sceneName, createScene] : scenes)
+	{
+		Scene* pScene{ createScene() };
+		pScene->Initialize();
+		Renderer* pRenderer{ new Renderer(pWindow) };
+		Timer timer{};
+		timer.Start();
+
+		const auto runFrame{ [&]()
+			{
+				timer.Update();
+				pScene->Update(&timer);
+				pRenderer->Render(pScene);
+			} };
+
+		for (const auto& [modeName, toggleMode] : modes)
+		{
+			toggleMode(*pRenderer);
+			for (int i = 0; i < NumWarmUpFrames; ++i)
+				runFrame();
+
+			const uint64_t numAllocationsBefore{ AllocationCounter::GetNumAllocations() };
+			runFrame();
+			const uint64_t numAllocations{ AllocationCounter::GetNumAllocations() - numAllocationsBefore };
+			toggleMode(*pRenderer);
+
+			printf("%-30s %-11s %10llu\n", sceneName, modeName, static_cast<unsigned long long>(numAllocations));
+			totalAllocations += numAllocations;
+		}
+
+		delete pRenderer;
+		delete pScene;
+	}
+
+	SDL_DestroyWindow(pWindow);
+	return totalAllocations;
+}
+
+//A quad between one point light and the floor, moved and relit from outside by BenchmarkIncrementalFrames
+class Scene_IncrementalCheck final : public Scene
+{
+public:
+	void Initialize() override
+	{
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.updateFovAngle(45.f);
+
+		const unsigned char matLambert{ AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f) };
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert);
+		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert);
+		AddSphere({ -3.f, 1.f, 2.f }, 1.f, matLambert);
+
+		m_pQuad = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert);
+		m_pQuad->AppendTriangle({ { -0.75f, 0.f, -0.75f }, { 0.75f, 0.f, -0.75f }, { 0.75f, 0.f, 0.75f } }, true);
+		m_pQuad->AppendTriangle({ { -0.75f, 0.f, -0.75f }, { 0.75f, 0.f, 0.75f }, { -0.75f, 0.f, 0.75f } }, true);
+		m_pQuad->Translate({ 1.f, 2.5f, 1.f });
+		m_pQuad->UpdateAABB();
+		m_pQuad->UpdateTransforms();
+
+		m_pLight = AddPointLight({ 0.f, 6.f, 0.f }, 50.f, colors::White);
+	}
+
+	void MoveQuad(const Vector3& position)
+	{
+		m_pQuad->Translate(position);
+		m_pQuad->UpdateTransforms();
+		MarkMeshChanged(m_pQuad);
+	}
+	void SetLightIntensity(float intensity)
+	{
+		m_pLight->intensity = intensity;
+		MarkLightsChanged();
+	}
+
+private:
+	TriangleMesh* m_pQuad{ nullptr };
+	Light* m_pLight{ nullptr };
+};
+
+//Incremental frames against full ones of the same scene, after a mesh moved alone and after it moved in the same frame a light
+//was edited. Returns the pixels that differ, an incremental frame has to look exactly like a full one
+static uint64_t BenchmarkIncrementalFrames()
+{
+	SDL_Window* pWindows[2]{};
+	for (SDL_Window*& pWindow : pWindows)
+	{
+		pWindow = SDL_CreateWindow("Benchmark", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 480, SDL_WINDOW_HIDDEN);
+	}
+	if (!pWindows[0] || !pWindows[1])
+	{
+		printf("\n%-30s %s\n", "incremental frame", "no window");
+		return 1;
+	}
+
+	Scene_IncrementalCheck scene{};
+	scene.Initialize();
+	Renderer* pIncremental{ new Renderer(pWindows[0]) };
+	Renderer* pFull{ new Renderer(pWindows[1]) };
+	pFull->ToggleIncrementalRendering();
+
+	//The incremental renderer goes first, it has to be the one that takes the scene's changed bounds
+	const auto renderBoth{ [&]()
+		{
+			pIncremental->Render(&scene);
+			pFull->Render(&scene);
+		} };
+
+	const auto countDifferences{ [&]()
+		{
+			const SDL_Surface* pIncrementalSurface{ SDL_GetWindowSurface(pWindows[0]) };
+			const SDL_Surface* pFullSurface{ SDL_GetWindowSurface(pWindows[1]) };
+			uint64_t numDifferences{};
+			for (int y = 0; y < pFullSurface->h; ++y)
+			{
+				const uint32_t* pIncrementalRow{ reinterpret_cast<const uint32_t*>(static_cast<const char*>(pIncrementalSurface->pixels) + y * pIncrementalSurface->pitch) };
+				const uint32_t* pFullRow{ reinterpret_cast<const uint32_t*>(static_cast<const char*>(pFullSurface->pixels) + y * pFullSurface->pitch) };
+				for (int x = 0; x < pFullSurface->w; ++x)
+				{
+					numDifferences += pIncrementalRow[x] != pFullRow[x];
+				}
+			}
+			return numDifferences;
+		} };
+
+	//Two frames, so the second one is complete and the next can be incremental
+	renderBoth();
+	renderBoth();
+
+	printf("\n%-30s %-11s %10s\n", "incremental frame", "", "differing");
+	uint64_t totalDifferences{};
+
+	scene.MoveQuad({ 0.5f, 2.5f, 1.f });
+	renderBoth();
+	const uint64_t movedDifferences{ countDifferences() };
+	printf("%-30s %-11s %10llu\n", "quad moved", "", static_cast<unsigned long long>(movedDifferences));
+	totalDifferences += movedDifferences;
+
+	scene.MoveQuad({ 0.f, 2.5f, 1.f });
+	scene.SetLightIntensity(25.f);
+	renderBoth();
+	const uint64_t relitDifferences{ countDifferences() };
+	printf("%-30s %-11s %10llu\n", "quad moved, light edited", "", static_cast<unsigned long long>(relitDifferences));
+	totalDifferences += relitDifferences;
+
+	delete pFull;
+	delete pIncremental;
+	for (SDL_Window* pWindow : pWindows)
+	{
+		SDL_DestroyWindow(pWindow);
+	}
+	return totalDifferences;
+}
+#pragma endregion
+
+#pragma region Math
+static void BenchmarkTransformPoint()
+{
+	RandomInputs random{ Seed };
+	const Matrix transform{ Matrix::CreateRotationY(0.7f) * Matrix::CreateTranslation({ 1.f, 2.f, 3.f }) };
+
+	std::vector<Vector3> points(NumInputs);
+	for (Vector3& point : points)
+	{
+		point = random.NextPoint(10.f);
+	}
+
+	Report("Matrix::TransformPoint", "-", Measure([&](size_t i)
+		{
+			return transform.TransformPoint(points[i]).x > 0.f;
+		}));
+}
+#pragma endregion
+
+#pragma region Shading
+static void BenchmarkBRDFs()
+{
+	RandomInputs random{ Seed };
+
+	//Random light and view directions in the hemisphere of a random normal
+	struct ShadingInput
+	{
+		Vector3 n{};
+		Vector3 l{};
+		Vector3 v{};
+		Vector3 h{};
+		float roughness{};
+	};
+
+	std::vector<ShadingInput> inputs(NumInputs);
+	for (ShadingInput& input : inputs)
+	{
+		input.n = random.NextDirection();
+		input.l = random.NextDirection();
+		input.v = random.NextDirection();
+		if (Vector3::Dot(input.l, input.n) < 0.f)
+		{
+			input.l = -input.l;
+		}
+		if (Vector3::Dot(input.v, input.n) > 0.f)
+		{
+			//View direction points into the surface, like in the renderer
+			input.v = -input.v;
+		}
+		input.h = (input.l - input.v).Normalized();
+		input.roughness = random.Next(0.05f, 1.f);
+	}
+
+	const ColorRGB color{ 0.8f, 0.5f, 0.3f };
+	const ColorRGB f0{ 0.04f, 0.04f, 0.04f };
+
+	Report("BRDF::Lambert", "-", Measure([&](size_t i)
+		{
+			return BRDF::Lambert(inputs[i].roughness, color).r > 0.1f;
+		}));
+	Report("BRDF::Phong", "-", Measure([&](size_t i)
+		{
+			const ShadingInput& input = inputs[i];
+			return BRDF::Phong(0.5f, 60.f, input.l, input.v, input.n).r > 0.1f;
+		}));
+	Report("BRDF::FresnelFunction_Schlick", "-", Measure([&](size_t i)
+		{
+			const ShadingInput& input = inputs[i];
+			return BRDF::FresnelFunction_Schlick(input.h, -input.v, f0).r > 0.1f;
+		}));
+	Report("BRDF::NormalDistribution_GGX", "-", Measure([&](size_t i)
+		{
+			const ShadingInput& input = inputs[i];
+			return BRDF::NormalDistribution_GGX(input.n, input.h, input.roughness) > 0.1f;
+		}));
+	Report("BRDF::GeometryFunction_Smith", "-", Measure([&](size_t i)
+		{
+			const ShadingInput& input = inputs[i];
+			return BRDF::GeometryFunction_Smith(input.n, -input.v, input.l, input.roughness) > 0.1f;
+		}));
+	Report("BRDF::Sample_GGXVisibleNormal", "-", Measure([&](size_t i)
+		{
+			const ShadingInput& input = inputs[i];
+			return BRDF::Sample_GGXVisibleNormal(input.n, -input.v, input.roughness, { input.l.x * 0.5f + 0.5f, input.l.y * 0.5f + 0.5f }).z > 0.f;
+		}));
+}
+#pragma endregion
+
+#pragma region Textures
+//Trilinear samples through the TextureCache, the hits column is the share of bright texels (sanity check only).
+//Coherent samples walk along texel rows like neighbouring pixels do, scattered ones jump around with footprints up to 64 texels.
+//The small budget doesn't even fit the 8-bit pyramid, so the decoded tiles only get the minimum
+static void BenchmarkTextureSampling()
+{
+	constexpr uint32_t Size{ 2048 };
+	RandomInputs random{ Seed };
+
+	std::vector<uint32_t> texels(size_t(Size) * Size);
+	for (uint32_t& texel : texels)
+	{
+		texel = static_cast<uint32_t>(random.Next(0.f, 255.f)) * 0x010101u | 0xFF000000;
+	}
+
+	struct SampleInput
+	{
+		Vector2 uv{};
+		Vector2 dUVdx{};
+		Vector2 dUVdy{};
+	};
+
+	constexpr float TexelSize{ 1.f / Size };
+	std::vector<SampleInput> coherent(NumInputs);
+	std::vector<SampleInput> scattered(NumInputs);
+	for (size_t i = 0; i < NumInputs; ++i)
+	{
+		coherent[i] = { { static_cast<float>(i % 512) * TexelSize, static_cast<float>(i / 512) * TexelSize }, { TexelSize, 0.f }, { 0.f, TexelSize } };
+
+		const float footprint{ TexelSize * exp2f(random.Next(0.f, 6.f)) };
+		scattered[i] = { { random.Next(), random.Next() }, { footprint, 0.f }, { 0.f, footprint } };
+	}
+
+	printf("\n");
+	for (const size_t budget : { size_t(64) << 20, size_t(8) << 20 })
+	{
+		TextureCache cache{ budget };
+		const Texture texture{ Size, Size, texels, true, &cache };
+
+		const std::string name{ "Texture::Sample, " + std::to_string(budget >> 20) + " MB" };
+		for (const auto& [inputs, set] : { std::pair{ &coherent, "coherent" }, std::pair{ &scattered, "scattered" } })
+		{
+			Report(name, set, Measure([&](size_t i)
+				{
+					const SampleInput& input = (*inputs)[i];
+					return texture.Sample(input.uv, input.dUVdx, input.dUVdy).r > 0.2f;
+				}));
+		}
+		printf("%-30s %-11s %10.1f MB\n", name.c_str(), "resident", static_cast<double>(cache.GetResidentBytes()) / (1 << 20));
+	}
+}
+#pragma endregion
+
+int main()
+{
+	printf("%-30s %-11s %13s %21s %10s\n", "kernel", "set", "time/test", "throughput", "hits");
+
+	for (const RaySet set : { RaySet::HitHeavy, RaySet::MissHeavy, RaySet::Grazing })
+	{
+		BenchmarkSphere(set);
+		BenchmarkPlane(set);
+		BenchmarkTriangle(set);
+		BenchmarkSlabTest(set);
+		BenchmarkTriangleMesh(set);
+	}
+	BenchmarkWatertightness();
+
+	BenchmarkTransformPoint();
+	BenchmarkBRDFs();
+	BenchmarkBVHBuild("grid", CreateGridMesh(512));
+	BenchmarkBVHBuild("rotated strips", CreateStripMesh(4096));
+	BenchmarkCompression("grid", CreateGridMesh(512));
+	BenchmarkCompression("rotated strips", CreateStripMesh(4096));
+	BenchmarkTextureSampling();
+
+	//Fails the run, so a regression that allocates per frame or leaves stale tiles behind doesn't go unnoticed
+	SDL_SetMainReady();
+	SDL_Init(SDL_INIT_VIDEO);
+	const uint64_t numAllocations{ BenchmarkSteadyStateAllocations() };
+	const uint64_t numDifferences{ BenchmarkIncrementalFrames() };
+	SDL_Quit();
+	return numAllocations == 0 && numDifferences == 0 ? 0 : 1;
+}
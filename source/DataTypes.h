@@ -1,8 +1,11 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 
 #include "Math.h"
 #include "vector"
+#include <unordered_map>
 
 namespace dae
 {
@@ -60,6 +63,13 @@ namespace dae
 		NoCulling
 	};
 
+	//Ray-triangle test used by the mesh intersections
+	enum class TriangleKernel
+	{
+		MollerTrumbore, //Fewest operations, rays can slip through edges shared by two triangles
+		Watertight //Sheared, no gaps between triangles sharing an edge, slightly more work per triangle
+	};
+
 	struct Triangle
 	{
 		Triangle() = default;
@@ -84,6 +94,48 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	/**
+	 * \brief Packs a unit vector in 32 bits: projected onto an octahedron, the lower half folded over the upper one,
+	 * the resulting square stored as two 16 bit signed normalized values
+	 */
+	inline uint32_t EncodeOctahedral(const Vector3& v)
+	{
+		const float lengthL1{ std::abs(v.x) + std::abs(v.y) + std::abs(v.z) };
+		if (!(lengthL1 > 0.f))
+		{
+			//Degenerate (zero or NaN) normals, decode to +z
+			return 0;
+		}
+
+		float x{ v.x / lengthL1 };
+		float y{ v.y / lengthL1 };
+		if (v.z < 0.f)
+		{
+			const float foldedX{ (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f) };
+			const float foldedY{ (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f) };
+			x = foldedX;
+			y = foldedY;
+		}
+
+		const auto toSnorm16 = [](float value)
+		{
+			return static_cast<uint32_t>(static_cast<uint16_t>(static_cast<int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f))));
+		};
+		return toSnorm16(x) | (toSnorm16(y) << 16);
+	}
+
+	inline Vector3 DecodeOctahedral(uint32_t encoded)
+	{
+		const float x{ std::max(static_cast<int16_t>(encoded & 0xFFFF) / 32767.f, -1.f) };
+		const float y{ std::max(static_cast<int16_t>(encoded >> 16) / 32767.f, -1.f) };
+
+		Vector3 v{ x, y, 1.f - std::abs(x) - std::abs(y) };
+		const float fold{ std::max(-v.z, 0.f) };
+		v.x += v.x >= 0.f ? -fold : fold;
+		v.y += v.y >= 0.f ? -fold : fold;
+		return v.Normalized();
+	}
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -109,6 +161,8 @@ namespace dae
 
 		std::vector<Vector3> positions{};
 		std::vector<Vector3> normals{};
+		std::vector<Vector3> vertexNormals{}; //Optional, enables smooth shading
+		std::vector<Vector2> uvs{}; //Optional, per vertex texture coordinates
 		std::vector<int> indices{};
 		unsigned char materialIndex{};
 		Vector3 center;
@@ -128,6 +182,23 @@ namespace dae
 
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
+		std::vector<Vector3> transformedVertexNormals{};
+
+		//Compact storage for large meshes (Compress), replaces the full precision arrays above except uvs
+		struct CompressedGeometry
+		{
+			std::vector<uint16_t> positions{}; //xyz per vertex, quantized to minAABB - maxAABB
+			std::vector<uint32_t> normals{}; //Octahedral, per triangle
+			std::vector<uint32_t> vertexNormals{}; //Octahedral, optional
+			std::vector<uint16_t> indices{}; //Empty when there are too many vertices, indices is kept instead
+			Vector3 quantizationStep{}; //Object space size of one quantization level per axis
+			Matrix decodeTransform{}; //Quantized position to world space, dequantization and transform in one
+		};
+		CompressedGeometry compressed{};
+		bool isCompressed{ false };
+
+		static constexpr float QuantizationLevels{ 65535.f };
+		static constexpr size_t MaxShortIndexVertices{ 65536 };
 
 		void Translate(const Vector3& translation)
 		{
@@ -146,6 +217,7 @@ namespace dae
 
 		void AppendTriangle(const Triangle& triangle, bool ignoreTransformUpdate = false)
 		{
+			assert(!isCompressed);
 			int startIndex = static_cast<int>(positions.size());
 
 			positions.push_back(triangle.v0);
@@ -165,6 +237,7 @@ namespace dae
 
 		void CalculateNormals()
 		{
+			assert(!isCompressed);
 			normals.clear();
 			Vector3 normal{};
 			for (size_t i = 0; i < indices.size(); i += 3)
@@ -180,29 +253,279 @@ namespace dae
 			}
 		}
 
+		/**
+		 * \brief Generates smooth vertex normals by averaging the face normals around each vertex, weighted by the corner angle.
+		 * Vertices sharing the exact same position are welded, so triangle soups (e.g. the bunny) are smoothed as well.
+		 */
+		void CalculateVertexNormals()
+		{
+			assert(!isCompressed);
+			CalculateVertexNormals(positions, indices, vertexNormals);
+		}
+
+		//Same for loose arrays, used by the OBJ parser for the vertices the file has no normal for
+		static void CalculateVertexNormals(const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<Vector3>& vertexNormals)
+		{
+			struct PositionHash
+			{
+				size_t operator()(const Vector3& p) const
+				{
+					const std::hash<float> hasher{};
+					return hasher(p.x) ^ (hasher(p.y) << 1) ^ (hasher(p.z) << 2);
+				}
+			};
+			struct PositionEqual
+			{
+				bool operator()(const Vector3& a, const Vector3& b) const
+				{
+					return a.x == b.x && a.y == b.y && a.z == b.z;
+				}
+			};
+
+			std::unordered_map<Vector3, Vector3, PositionHash, PositionEqual> weldedNormals{};
+			weldedNormals.reserve(positions.size());
+
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				const Vector3& v0 = positions[indices[i]];
+				const Vector3& v1 = positions[indices[i + 1]];
+				const Vector3& v2 = positions[indices[i + 2]];
+
+				const Vector3 faceNormal{ Vector3::Cross(v1 - v0, v2 - v0) };
+				if (faceNormal.SqrMagnitude() <= 0.f)
+				{
+					//Degenerate triangle, doesn't contribute
+					continue;
+				}
+				const Vector3 normal{ faceNormal.Normalized() };
+
+				const Vector3* corners[3]{ &v0, &v1, &v2 };
+				for (int c = 0; c < 3; ++c)
+				{
+					const Vector3 toNext{ (*corners[(c + 1) % 3] - *corners[c]).Normalized() };
+					const Vector3 toPrev{ (*corners[(c + 2) % 3] - *corners[c]).Normalized() };
+					const float angle{ acosf(std::clamp(Vector3::Dot(toNext, toPrev), -1.f, 1.f)) };
+
+					weldedNormals[*corners[c]] += normal * angle;
+				}
+			}
+
+			vertexNormals.clear();
+			vertexNormals.reserve(positions.size());
+			for (const auto& p : positions)
+			{
+				const auto it = weldedNormals.find(p);
+				if (it == weldedNormals.end() || it->second.SqrMagnitude() <= 0.f)
+				{
+					vertexNormals.emplace_back(Vector3::UnitY);
+					continue;
+				}
+				vertexNormals.emplace_back(it->second.Normalized());
+			}
+		}
+
+		/**
+		 * \brief Switches the mesh to compact storage, for large meshes: positions quantized to 16 bits per axis over the object
+		 * space AABB, normals octahedral in 32 bits and indices 16 bit when every vertex fits. Compared to the positions, normals,
+		 * indices and their transformed copies, that is several times less memory per triangle.
+		 * Call once the mesh is complete, the full precision arrays are released, read it through the accessors below afterwards.
+		 * Vertices are decoded again whenever they're read, so intersecting costs a little more per triangle
+		 */
+		void Compress()
+		{
+			if (isCompressed)
+			{
+				return;
+			}
+
+			UpdateAABB();
+			const Vector3 extent{ maxAABB - minAABB };
+			compressed.quantizationStep = { extent.x / QuantizationLevels, extent.y / QuantizationLevels, extent.z / QuantizationLevels };
+
+			//Flat meshes have no extent along an axis, every vertex is at level 0 there
+			const auto quantize = [](float value, float min, float extent)
+			{
+				return static_cast<uint16_t>(extent > 0.f ? std::lround(std::clamp((value - min) / extent, 0.f, 1.f) * QuantizationLevels) : 0);
+			};
+			compressed.positions.resize(positions.size() * 3);
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				compressed.positions[i * 3] = quantize(positions[i].x, minAABB.x, extent.x);
+				compressed.positions[i * 3 + 1] = quantize(positions[i].y, minAABB.y, extent.y);
+				compressed.positions[i * 3 + 2] = quantize(positions[i].z, minAABB.z, extent.z);
+			}
+
+			compressed.normals.resize(normals.size());
+			std::transform(normals.begin(), normals.end(), compressed.normals.begin(), EncodeOctahedral);
+			compressed.vertexNormals.resize(vertexNormals.size());
+			std::transform(vertexNormals.begin(), vertexNormals.end(), compressed.vertexNormals.begin(), EncodeOctahedral);
+
+			if (positions.size() <= MaxShortIndexVertices)
+			{
+				compressed.indices.resize(indices.size());
+				std::transform(indices.begin(), indices.end(), compressed.indices.begin(), [](int index) { return static_cast<uint16_t>(index); });
+				std::vector<int>{}.swap(indices);
+			}
+
+			//Swapped with empty vectors, clear would keep the capacity
+			std::vector<Vector3>{}.swap(positions);
+			std::vector<Vector3>{}.swap(normals);
+			std::vector<Vector3>{}.swap(vertexNormals);
+			std::vector<Vector3>{}.swap(transformedPositions);
+			std::vector<Vector3>{}.swap(transformedNormals);
+			std::vector<Vector3>{}.swap(transformedVertexNormals);
+
+			isCompressed = true;
+			UpdateTransforms();
+		}
+
+		uint32_t GetNumTriangles() const
+		{
+			return static_cast<uint32_t>((compressed.indices.empty() ? indices.size() : compressed.indices.size()) / 3);
+		}
+
+		bool HasVertexNormals() const
+		{
+			return isCompressed ? !compressed.vertexNormals.empty() : !transformedVertexNormals.empty();
+		}
+
+		//Vertex of a corner in the index buffer (triangleIndex * 3 + corner)
+		uint32_t GetVertexIndex(size_t cornerIndex) const
+		{
+			return compressed.indices.empty() ? static_cast<uint32_t>(indices[cornerIndex]) : compressed.indices[cornerIndex];
+		}
+
+		Vector3 GetTransformedPosition(uint32_t vertexIndex) const
+		{
+			if (!isCompressed)
+			{
+				return transformedPositions[vertexIndex];
+			}
+
+			const uint16_t* pQuantized{ &compressed.positions[vertexIndex * size_t(3)] };
+			return compressed.decodeTransform.TransformPoint(static_cast<float>(pQuantized[0]), static_cast<float>(pQuantized[1]), static_cast<float>(pQuantized[2]));
+		}
+
+		//Corner 0, 1 or 2 of a triangle
+		Vector3 GetTransformedPosition(uint32_t triangleIndex, int corner) const
+		{
+			return GetTransformedPosition(GetVertexIndex(triangleIndex * size_t(3) + corner));
+		}
+
+		Vector3 GetTransformedNormal(uint32_t triangleIndex) const
+		{
+			return isCompressed ? rotationTransform.TransformVector(DecodeOctahedral(compressed.normals[triangleIndex])) : transformedNormals[triangleIndex];
+		}
+
+		Vector3 GetTransformedVertexNormal(uint32_t vertexIndex) const
+		{
+			return isCompressed ? rotationTransform.TransformVector(DecodeOctahedral(compressed.vertexNormals[vertexIndex])) : transformedVertexNormals[vertexIndex];
+		}
+
+		//Bytes of the geometry arrays, to compare the full precision and compressed storage
+		size_t GetGeometryBytes() const
+		{
+			return (positions.capacity() + normals.capacity() + vertexNormals.capacity() + transformedPositions.capacity() + transformedNormals.capacity()
+				+ transformedVertexNormals.capacity()) * sizeof(Vector3) + uvs.capacity() * sizeof(Vector2) + indices.capacity() * sizeof(int)
+				+ compressed.positions.capacity() * sizeof(uint16_t) + compressed.indices.capacity() * sizeof(uint16_t)
+				+ (compressed.normals.capacity() + compressed.vertexNormals.capacity()) * sizeof(uint32_t);
+		}
+
+		/**
+		 * \brief Interpolates the (transformed) vertex normals of a triangle
+		 * \param triangleIndex Index of the triangle in the index buffer (index / 3)
+		 * \param u Barycentric weight of the second vertex
+		 * \param v Barycentric weight of the third vertex
+		 * \return Normalized shading normal, falls back to the face normal if the mesh has no vertex normals
+		 */
+		Vector3 InterpolateNormal(uint32_t triangleIndex, float u, float v) const
+		{
+			if (!HasVertexNormals())
+			{
+				return GetTransformedNormal(triangleIndex);
+			}
+
+			const size_t i{ triangleIndex * size_t(3) };
+			const Vector3 n0{ GetTransformedVertexNormal(GetVertexIndex(i)) };
+			const Vector3 n1{ GetTransformedVertexNormal(GetVertexIndex(i + 1)) };
+			const Vector3 n2{ GetTransformedVertexNormal(GetVertexIndex(i + 2)) };
+
+			return ((1.f - u - v) * n0 + u * n1 + v * n2).Normalized();
+		}
+
+		Vector2 InterpolateUV(uint32_t triangleIndex, float u, float v) const
+		{
+			if (uvs.empty())
+			{
+				return {};
+			}
+
+			const size_t i{ triangleIndex * size_t(3) };
+			return (1.f - u - v) * uvs[GetVertexIndex(i)] + u * uvs[GetVertexIndex(i + 1)] + v * uvs[GetVertexIndex(i + 2)];
+		}
+
+		/**
+		 * \brief Barycentric coordinates of a point in the (transformed) plane of a triangle, the point can lie outside of the triangle
+		 * \param triangleIndex Index of the triangle in the index buffer (index / 3)
+		 * \param point Point in the plane of the triangle
+		 * \param u Barycentric weight of the second vertex
+		 * \param v Barycentric weight of the third vertex
+		 */
+		void GetBarycentrics(uint32_t triangleIndex, const Vector3& point, float& u, float& v) const
+		{
+			const Vector3 p0{ GetTransformedPosition(triangleIndex, 0) };
+			const Vector3 edge1{ GetTransformedPosition(triangleIndex, 1) - p0 };
+			const Vector3 edge2{ GetTransformedPosition(triangleIndex, 2) - p0 };
+			const Vector3 toPoint{ point - p0 };
+
+			const float d11{ Vector3::Dot(edge1, edge1) };
+			const float d12{ Vector3::Dot(edge1, edge2) };
+			const float d22{ Vector3::Dot(edge2, edge2) };
+			const float dp1{ Vector3::Dot(toPoint, edge1) };
+			const float dp2{ Vector3::Dot(toPoint, edge2) };
+			const float denominator{ d11 * d22 - d12 * d12 };
+			if (denominator == 0.f)
+			{
+				u = v = 0.f;
+				return;
+			}
+
+			u = (d22 * dp1 - d12 * dp2) / denominator;
+			v = (d11 * dp2 - d12 * dp1) / denominator;
+		}
+
 		void UpdateTransforms()
 		{
-			transformedPositions.clear();
-			transformedNormals.clear();
+			//Sized once, moving meshes update them every frame without allocating
+			transformedPositions.resize(positions.size());
+			transformedNormals.resize(normals.size());
+			transformedVertexNormals.resize(vertexNormals.size());
 
 			//const auto finalTransform{ translationTransform * rotationTransform * scaleTransform };
 			const auto finalTransform{ scaleTransform * rotationTransform * translationTransform };
 
-			transformedPositions.reserve(positions.size());
-
-			for (const auto& p : positions)
+			for (size_t i = 0; i < positions.size(); ++i)
 			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(p));
+				transformedPositions[i] = finalTransform.TransformPoint(positions[i]);
+			}
 
+			for (size_t i = 0; i < normals.size(); ++i)
+			{
+				transformedNormals[i] = rotationTransform.TransformVector(normals[i]);
+				//transformedNormals[i] = finalTransform.TransformVector(normals[i]).Normalized();
 			}
 
-			transformedNormals.reserve(normals.size());
+			for (size_t i = 0; i < vertexNormals.size(); ++i)
+			{
+				transformedVertexNormals[i] = rotationTransform.TransformVector(vertexNormals[i]);
+			}
 
-			for (const auto& n : normals)
+			if (isCompressed)
 			{
-				transformedNormals.emplace_back(rotationTransform.TransformVector(n));
-				//transformedNormals.emplace_back(finalTransform.TransformVector(n).Normalized());
-				
+				//Row vectors, scaling the rows by the step dequantizes before transforming, and minAABB is where level 0 lands
+				const Vector3& step = compressed.quantizationStep;
+				compressed.decodeTransform = Matrix{ finalTransform.GetAxisX() * step.x, finalTransform.GetAxisY() * step.y, finalTransform.GetAxisZ() * step.z,
+					finalTransform.TransformPoint(minAABB) };
 			}
 
 			UpdateTransformedAABB(finalTransform);
@@ -263,6 +586,20 @@ namespace dae
 		}
 
 	};
+
+	//Placement of a shared TriangleMesh, the mesh keeps its object space geometry and one BVH for all its instances
+	struct MeshInstance
+	{
+		uint32_t meshIndex{}; //Into the instanced meshes of the scene
+		unsigned char materialIndex{};
+
+		Matrix objectToWorld{};
+		Matrix worldToObject{};
+		Matrix normalToWorld{}; //Transposed worldToObject, keeps normals perpendicular under non uniform scales
+
+		Vector3 boundsMin{}; //World space box of the transformed mesh box
+		Vector3 boundsMax{};
+	};
 #pragma endregion
 #pragma region LIGHT
 	enum class LightType
@@ -277,23 +614,39 @@ namespace dae
 		Vector3 direction{};
 		ColorRGB color{};
 		float intensity{};
+		float range{ FLT_MAX }; //Distance where the radiance drops below LightUtils::RadianceCutoff, unbounded for directional lights
+		float radius{}; //Point lights with a radius are spheres for path tracing, the other modes treat them as points
 
 		LightType type{};
 	};
 #pragma endregion
 #pragma region MISC
+	//Axis aligned box in world space
+	struct Bounds
+	{
+		Vector3 boundsMin{};
+		Vector3 boundsMax{};
+	};
+
 	struct Ray
 	{
 		// Data Types
 		Vector3 origin{};
-		Vector3 direction{};
 
 		float min{ 0.0001f };
 		float max{ FLT_MAX };
 
+		//1 / direction, infinite for zero components, so box tests only multiply. Kept in sync by SetDirection
+		Vector3 inverseDirection{};
+		//Per axis, the box bound the ray enters through is the max one
+		bool isDirectionNegative[3]{};
+
 		// Constructor & Destructor
 		Ray(const Vector3& _origin, const Vector3& _direction)
-			: origin(_origin), direction(_direction) {}
+			: origin(_origin)
+		{
+			SetDirection(_direction);
+		}
 		~Ray() = default;
 
 		Ray(const Ray&) = default;
@@ -301,16 +654,63 @@ namespace dae
 		Ray& operator=(const Ray&) = default;
 		Ray& operator=(Ray&&) noexcept = default;
 
+		const Vector3& GetDirection() const { return m_Direction; }
+		//Refreshes the cached reciprocals and signs along with it
+		void SetDirection(const Vector3& direction)
+		{
+			m_Direction = direction;
+			inverseDirection = { 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+			isDirectionNegative[0] = std::signbit(direction.x);
+			isDirectionNegative[1] = std::signbit(direction.y);
+			isDirectionNegative[2] = std::signbit(direction.z);
+		}
+
+	private:
+		Vector3 m_Direction{};
+	};
+
+	//Offset rays through the neighbouring pixels, used to select texture LODs
+	struct RayDifferential
+	{
+		Vector3 rxOrigin{};
+		Vector3 rxDirection{};
+		Vector3 ryOrigin{};
+		Vector3 ryDirection{};
+
+		bool hasDifferentials{ false };
+	};
+
+	//What the primitiveIndex of a HitRecord refers to
+	enum class HitGeometry : unsigned char
+	{
+		None,
+		Plane, //Index into the planes of the scene
+		Sphere, //Index into the spheres of the scene
+		Triangle //Triangle of pMesh
 	};
 
 	struct HitRecord
 	{
 		Vector3 origin{};
-		Vector3 normal{};
+		Vector3 normal{}; //Shading normal, interpolated over triangles
+		Vector3 geometricNormal{}; //Of the surface itself, secondary rays start along it
 		float t = FLT_MAX;
 
+		//Barycentrics of triangle hits (weights of v1 and v2)
+		float u{};
+		float v{};
+		uint32_t primitiveIndex{};
+		const TriangleMesh* pMesh{ nullptr };
+		const MeshInstance* pInstance{ nullptr }; //Set for instanced triangles, pMesh is then in object space
+
+		//Texture coordinate and its screen-space derivatives
+		Vector2 uv{};
+		Vector2 dUVdx{};
+		Vector2 dUVdy{};
+
 		bool didHit{ false };
 		unsigned char materialIndex{ 0 };
+		HitGeometry geometry{ HitGeometry::None };
 	};
 #pragma endregion
 }
\ No newline at end of file
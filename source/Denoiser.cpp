@@ -0,0 +1,322 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+#include <ppl.h> // parallel_for
+
+namespace dae
+{
+	namespace
+	{
+		//Misses keep a finite depth so the weights never see inf - inf
+		constexpr float MissDepth{ 1e20f };
+		constexpr float MinAlbedo{ 0.01f };
+
+		//B3 spline, the 5x5 kernel is the outer product
+		constexpr float Kernel[5]{ 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+		//4 consecutive values of a row, columns outside of the image are clamped to the border
+		inline __m128 LoadClamped(const float* pRow, int x, int width)
+		{
+			if (x >= 0 && x + 4 <= width)
+				return _mm_loadu_ps(pRow + x);
+
+			return _mm_setr_ps(
+				pRow[std::clamp(x, 0, width - 1)],
+				pRow[std::clamp(x + 1, 0, width - 1)],
+				pRow[std::clamp(x + 2, 0, width - 1)],
+				pRow[std::clamp(x + 3, 0, width - 1)]);
+		}
+
+		inline __m128 Luminance(__m128 r, __m128 g, __m128 b)
+		{
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.2126f)), _mm_mul_ps(g, _mm_set1_ps(0.7152f))), _mm_mul_ps(b, _mm_set1_ps(0.0722f)));
+		}
+
+		inline __m128 Abs(__m128 x)
+		{
+			return _mm_andnot_ps(_mm_set1_ps(-0.f), x);
+		}
+
+		//e^x for x <= 0, 2^x split into exponent bits and a polynomial for the fraction
+		inline __m128 Exp(__m128 x)
+		{
+			const __m128 t{ _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-80.f)), _mm_set1_ps(1.44269504f)) };
+			const __m128 whole{ _mm_floor_ps(t) };
+			const __m128 f{ _mm_sub_ps(t, whole) };
+
+			__m128 p{ _mm_set1_ps(1.3333558e-3f) };
+			p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+			p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+			p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+			p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+			p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+
+			const __m128i exponent{ _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(whole), _mm_set1_epi32(127)), 23) };
+			return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+		}
+	}
+
+	void Denoiser::Denoise(int width, int height, const std::vector<ColorRGB>& color, const std::vector<ColorRGB>& albedo,
+		const std::vector<Vector3>& normals, const std::vector<float>& depth, std::vector<ColorRGB>& output)
+	{
+		Resize(width, height);
+
+		//Demodulate the albedo and split into planes, the padding columns repeat the last pixel
+		concurrency::parallel_for(0, m_Height, [&](int y)
+			{
+				for (int x = 0; x < m_Stride; ++x)
+				{
+					const size_t source{ size_t(y) * m_Width + std::min(x, m_Width - 1) };
+					const size_t target{ size_t(y) * m_Stride + x };
+
+					const ColorRGB& a = albedo[source];
+					m_Red[0][target] = color[source].r / std::max(a.r, MinAlbedo);
+					m_Green[0][target] = color[source].g / std::max(a.g, MinAlbedo);
+					m_Blue[0][target] = color[source].b / std::max(a.b, MinAlbedo);
+
+					m_NormalX[target] = normals[source].x;
+					m_NormalY[target] = normals[source].y;
+					m_NormalZ[target] = normals[source].z;
+					m_Depth[target] = std::min(depth[source], MissDepth);
+				}
+			});
+
+		//Largest screen-space depth change to a neighbour, planes at grazing angles change fast
+		concurrency::parallel_for(0, m_Height, [&](int y)
+			{
+				for (int x = 0; x < m_Stride; ++x)
+				{
+					const size_t index{ size_t(y) * m_Stride + x };
+					const float center{ m_Depth[index] };
+
+					float gradient{};
+					const auto compare = [&](int nx, int ny)
+					{
+						if (nx < 0 || ny < 0 || nx >= m_Width || ny >= m_Height)
+							return;
+						const float neighbour{ m_Depth[size_t(ny) * m_Stride + nx] };
+						if (neighbour < MissDepth && center < MissDepth)
+							gradient = std::max(gradient, std::abs(neighbour - center));
+					};
+					compare(x - 1, y);
+					compare(x + 1, y);
+					compare(x, y - 1);
+					compare(x, y + 1);
+
+					m_DepthGradient[index] = gradient;
+				}
+			});
+
+		const int numTiles{ GetNumTiles() };
+		int source{ 0 };
+		for (int iteration = 0; iteration < m_NumIterations; ++iteration)
+		{
+			concurrency::parallel_for(0, numTiles, [&](int tileIndex)
+				{
+					EstimateVariance(tileIndex, source);
+				});
+
+			concurrency::parallel_for(0, numTiles, [&](int tileIndex)
+				{
+					FilterTile(tileIndex, source, 1 << iteration);
+				});
+
+			source = 1 - source;
+		}
+
+		//Modulate the albedo back in
+		concurrency::parallel_for(0, m_Height, [&](int y)
+			{
+				for (int x = 0; x < m_Width; ++x)
+				{
+					const size_t target{ size_t(y) * m_Width + x };
+					const size_t index{ size_t(y) * m_Stride + x };
+
+					const ColorRGB& a = albedo[target];
+					output[target] = {
+						m_Red[source][index] * std::max(a.r, MinAlbedo),
+						m_Green[source][index] * std::max(a.g, MinAlbedo),
+						m_Blue[source][index] * std::max(a.b, MinAlbedo) };
+				}
+			});
+	}
+
+	void Denoiser::Resize(int width, int height)
+	{
+		if (width == m_Width && height == m_Height)
+			return;
+
+		m_Width = width;
+		m_Height = height;
+		m_Stride = (width + 3) & ~3;
+
+		const size_t size{ size_t(m_Stride) * m_Height };
+		for (int i = 0; i < 2; ++i)
+		{
+			m_Red[i].assign(size, 0.f);
+			m_Green[i].assign(size, 0.f);
+			m_Blue[i].assign(size, 0.f);
+		}
+		m_NormalX.assign(size, 0.f);
+		m_NormalY.assign(size, 0.f);
+		m_NormalZ.assign(size, 0.f);
+		m_Depth.assign(size, 0.f);
+		m_DepthGradient.assign(size, 0.f);
+		m_Variance.assign(size, 0.f);
+	}
+
+	int Denoiser::GetNumTiles() const
+	{
+		return ((m_Stride + TileSize - 1) / TileSize) * ((m_Height + TileSize - 1) / TileSize);
+	}
+
+	void Denoiser::EstimateVariance(int tileIndex, int source)
+	{
+		const int numTilesX{ (m_Stride + TileSize - 1) / TileSize };
+		const int tileX{ (tileIndex % numTilesX) * TileSize };
+		const int tileY{ (tileIndex / numTilesX) * TileSize };
+		const int tileEndX{ std::min(tileX + TileSize, m_Stride) };
+		const int tileEndY{ std::min(tileY + TileSize, m_Height) };
+
+		const float* pRed{ m_Red[source].data() };
+		const float* pGreen{ m_Green[source].data() };
+		const float* pBlue{ m_Blue[source].data() };
+
+		//Spatial 3x3 luminance variance, drives how much luminance difference the filter tolerates
+		const __m128 inverseCount{ _mm_set1_ps(1.f / 9.f) };
+		for (int y = tileY; y < tileEndY; ++y)
+		{
+			for (int x = tileX; x < tileEndX; x += 4)
+			{
+				__m128 sum{ _mm_setzero_ps() };
+				__m128 sumSqr{ _mm_setzero_ps() };
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					const size_t row{ size_t(std::clamp(y + dy, 0, m_Height - 1)) * m_Stride };
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						const __m128 luminance{ Luminance(
+							LoadClamped(pRed + row, x + dx, m_Width),
+							LoadClamped(pGreen + row, x + dx, m_Width),
+							LoadClamped(pBlue + row, x + dx, m_Width)) };
+						sum = _mm_add_ps(sum, luminance);
+						sumSqr = _mm_add_ps(sumSqr, _mm_mul_ps(luminance, luminance));
+					}
+				}
+
+				const __m128 mean{ _mm_mul_ps(sum, inverseCount) };
+				const __m128 variance{ _mm_max_ps(_mm_sub_ps(_mm_mul_ps(sumSqr, inverseCount), _mm_mul_ps(mean, mean)), _mm_setzero_ps()) };
+				_mm_storeu_ps(&m_Variance[size_t(y) * m_Stride + x], variance);
+			}
+		}
+	}
+
+	void Denoiser::FilterTile(int tileIndex, int source, int stepSize)
+	{
+		const int numTilesX{ (m_Stride + TileSize - 1) / TileSize };
+		const int tileX{ (tileIndex % numTilesX) * TileSize };
+		const int tileY{ (tileIndex / numTilesX) * TileSize };
+		const int tileEndX{ std::min(tileX + TileSize, m_Stride) };
+		const int tileEndY{ std::min(tileY + TileSize, m_Height) };
+
+		const float* pRed{ m_Red[source].data() };
+		const float* pGreen{ m_Green[source].data() };
+		const float* pBlue{ m_Blue[source].data() };
+		float* pRedOut{ m_Red[1 - source].data() };
+		float* pGreenOut{ m_Green[1 - source].data() };
+		float* pBlueOut{ m_Blue[1 - source].data() };
+
+		const __m128 zero{ _mm_setzero_ps() };
+
+		for (int y = tileY; y < tileEndY; ++y)
+		{
+			const size_t centerRow{ size_t(y) * m_Stride };
+			for (int x = tileX; x < tileEndX; x += 4)
+			{
+				const size_t center{ centerRow + x };
+
+				const __m128 centerRed{ _mm_loadu_ps(pRed + center) };
+				const __m128 centerGreen{ _mm_loadu_ps(pGreen + center) };
+				const __m128 centerBlue{ _mm_loadu_ps(pBlue + center) };
+				const __m128 centerLuminance{ Luminance(centerRed, centerGreen, centerBlue) };
+				const __m128 centerNormalX{ _mm_loadu_ps(&m_NormalX[center]) };
+				const __m128 centerNormalY{ _mm_loadu_ps(&m_NormalY[center]) };
+				const __m128 centerNormalZ{ _mm_loadu_ps(&m_NormalZ[center]) };
+				const __m128 centerDepth{ _mm_loadu_ps(&m_Depth[center]) };
+				const __m128 depthGradient{ _mm_loadu_ps(&m_DepthGradient[center]) };
+
+				//Negated inverse sigmas, the weights are exp(-difference / sigma)
+				const __m128 luminanceScale{ _mm_div_ps(_mm_set1_ps(-1.f),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m_SigmaLuminance), _mm_sqrt_ps(_mm_loadu_ps(&m_Variance[center]))), _mm_set1_ps(1e-4f))) };
+
+				__m128 sumRed{ zero };
+				__m128 sumGreen{ zero };
+				__m128 sumBlue{ zero };
+				__m128 sumWeight{ zero };
+
+				for (int ky = 0; ky < 5; ++ky)
+				{
+					const int dy{ ky - 2 };
+					const size_t row{ size_t(std::clamp(y + dy * stepSize, 0, m_Height - 1)) * m_Stride };
+					for (int kx = 0; kx < 5; ++kx)
+					{
+						const int dx{ kx - 2 };
+						const __m128 kernel{ _mm_set1_ps(Kernel[kx] * Kernel[ky]) };
+
+						if (dx == 0 && dy == 0)
+						{
+							sumRed = _mm_add_ps(sumRed, _mm_mul_ps(centerRed, kernel));
+							sumGreen = _mm_add_ps(sumGreen, _mm_mul_ps(centerGreen, kernel));
+							sumBlue = _mm_add_ps(sumBlue, _mm_mul_ps(centerBlue, kernel));
+							sumWeight = _mm_add_ps(sumWeight, kernel);
+							continue;
+						}
+
+						const int tapX{ x + dx * stepSize };
+						const __m128 red{ LoadClamped(pRed + row, tapX, m_Width) };
+						const __m128 green{ LoadClamped(pGreen + row, tapX, m_Width) };
+						const __m128 blue{ LoadClamped(pBlue + row, tapX, m_Width) };
+
+						//Luminance
+						const __m128 luminanceDifference{ Abs(_mm_sub_ps(centerLuminance, Luminance(red, green, blue))) };
+						__m128 weight{ _mm_mul_ps(luminanceDifference, luminanceScale) };
+
+						//Depth, tolerance grows with the distance of the tap and the local depth slope
+						const float tapDistance{ static_cast<float>(stepSize) * sqrtf(static_cast<float>(dx * dx + dy * dy)) };
+						const __m128 depthDifference{ Abs(_mm_sub_ps(centerDepth, LoadClamped(&m_Depth[row], tapX, m_Width))) };
+						const __m128 depthSigma{ _mm_add_ps(_mm_mul_ps(depthGradient, _mm_set1_ps(m_SigmaDepth * tapDistance)), _mm_set1_ps(1e-3f)) };
+						weight = _mm_sub_ps(weight, _mm_div_ps(depthDifference, depthSigma));
+						weight = Exp(weight);
+
+						//Normal, cos^sigma by repeated squaring
+						__m128 normalWeight{ _mm_add_ps(_mm_add_ps(
+							_mm_mul_ps(centerNormalX, LoadClamped(&m_NormalX[row], tapX, m_Width)),
+							_mm_mul_ps(centerNormalY, LoadClamped(&m_NormalY[row], tapX, m_Width))),
+							_mm_mul_ps(centerNormalZ, LoadClamped(&m_NormalZ[row], tapX, m_Width))) };
+						normalWeight = _mm_max_ps(normalWeight, zero);
+						for (float exponent = 1.f; exponent < m_SigmaNormal; exponent *= 2.f)
+						{
+							normalWeight = _mm_mul_ps(normalWeight, normalWeight);
+						}
+
+						weight = _mm_mul_ps(_mm_mul_ps(weight, normalWeight), kernel);
+
+						sumRed = _mm_add_ps(sumRed, _mm_mul_ps(red, weight));
+						sumGreen = _mm_add_ps(sumGreen, _mm_mul_ps(green, weight));
+						sumBlue = _mm_add_ps(sumBlue, _mm_mul_ps(blue, weight));
+						sumWeight = _mm_add_ps(sumWeight, weight);
+					}
+				}
+
+				//The center tap keeps the weight above zero
+				const __m128 inverseWeight{ _mm_div_ps(_mm_set1_ps(1.f), sumWeight) };
+				_mm_storeu_ps(pRedOut + center, _mm_mul_ps(sumRed, inverseWeight));
+				_mm_storeu_ps(pGreenOut + center, _mm_mul_ps(sumGreen, inverseWeight));
+				_mm_storeu_ps(pBlueOut + center, _mm_mul_ps(sumBlue, inverseWeight));
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	/**
+	 * \brief Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010, SVGF style edge stopping) for low sample path traced frames.
+	 * The color is divided by the albedo first so texture detail isn't blurred, then filtered with a 5x5 B3 spline kernel whose
+	 * taps spread further apart every iteration. Taps are weighted by how similar their luminance, normal and depth are to the center.
+	 * Works on planar (structure of arrays) buffers, 4 pixels at a time with SSE, tiles are filtered in parallel.
+	 */
+	class Denoiser final
+	{
+	public:
+		Denoiser() = default;
+		~Denoiser() = default;
+
+		Denoiser(const Denoiser&) = delete;
+		Denoiser(Denoiser&&) noexcept = delete;
+		Denoiser& operator=(const Denoiser&) = delete;
+		Denoiser& operator=(Denoiser&&) noexcept = delete;
+
+		/**
+		 * \brief Filters the color buffer into the output buffer, all buffers are width * height, row-major
+		 * \param color Noisy radiance, left untouched
+		 * \param albedo Albedo of the primary hits
+		 * \param normals Normals of the primary hits (zero where nothing was hit)
+		 * \param depth Distance to the primary hits (FLT_MAX where nothing was hit)
+		 * \param output Filtered radiance, sized by the caller
+		 */
+		void Denoise(int width, int height, const std::vector<ColorRGB>& color, const std::vector<ColorRGB>& albedo,
+			const std::vector<Vector3>& normals, const std::vector<float>& depth, std::vector<ColorRGB>& output);
+
+		void SetNumIterations(int numIterations) { m_NumIterations = numIterations; }
+
+	private:
+		static constexpr int TileSize{ 32 };
+
+		int m_NumIterations{ 5 };
+		float m_SigmaLuminance{ 4.f };
+		float m_SigmaNormal{ 128.f }; //Exponent, only a power of two is supported
+		float m_SigmaDepth{ 1.f };
+
+		int m_Width{};
+		int m_Height{};
+		int m_Stride{}; //Width rounded up to a multiple of 4
+
+		//Ping-pong color planes
+		std::vector<float> m_Red[2]{};
+		std::vector<float> m_Green[2]{};
+		std::vector<float> m_Blue[2]{};
+
+		//Guides
+		std::vector<float> m_NormalX{};
+		std::vector<float> m_NormalY{};
+		std::vector<float> m_NormalZ{};
+		std::vector<float> m_Depth{};
+		std::vector<float> m_DepthGradient{};
+		std::vector<float> m_Variance{};
+
+		void Resize(int width, int height);
+		void EstimateVariance(int tileIndex, int source);
+		void FilterTile(int tileIndex, int source, int stepSize);
+		int GetNumTiles() const;
+	};
+}
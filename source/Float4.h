@@ -0,0 +1,90 @@
+#pragma once
+#include <xmmintrin.h> //SSE
+#include <emmintrin.h> //SSE2
+
+#include "Vector3.h"
+#include "Vector4.h"
+
+namespace dae
+{
+	/**
+	 * \brief Four floats in one SSE register, for math that does the same thing to every component (transforms, slab tests).
+	 * Loading from a Vector3 fills w with a chosen value, no reads past the 12 bytes of the vector.
+	 */
+	struct alignas(16) Float4
+	{
+		__m128 data;
+
+		Float4() : data{ _mm_setzero_ps() } {}
+		Float4(__m128 _data) : data{ _data } {}
+		Float4(float _x, float _y, float _z, float _w) : data{ _mm_setr_ps(_x, _y, _z, _w) } {}
+		explicit Float4(float scalar) : data{ _mm_set1_ps(scalar) } {}
+		explicit Float4(const Vector3& v, float _w = 0.f) : data{ _mm_setr_ps(v.x, v.y, v.z, _w) } {}
+		explicit Float4(const Vector4& v) : data{ _mm_loadu_ps(&v.x) } {}
+
+		float X() const { return _mm_cvtss_f32(data); }
+		float Y() const { return _mm_cvtss_f32(_mm_shuffle_ps(data, data, _MM_SHUFFLE(1, 1, 1, 1))); }
+		float Z() const { return _mm_cvtss_f32(_mm_shuffle_ps(data, data, _MM_SHUFFLE(2, 2, 2, 2))); }
+		float W() const { return _mm_cvtss_f32(_mm_shuffle_ps(data, data, _MM_SHUFFLE(3, 3, 3, 3))); }
+
+		Vector3 ToVector3() const
+		{
+			alignas(16) float values[4];
+			_mm_store_ps(values, data);
+			return { values[0], values[1], values[2] };
+		}
+
+		Vector4 ToVector4() const
+		{
+			Vector4 v;
+			_mm_storeu_ps(&v.x, data);
+			return v;
+		}
+
+		//Component wise
+		static Float4 Min(const Float4& a, const Float4& b) { return _mm_min_ps(a.data, b.data); }
+		static Float4 Max(const Float4& a, const Float4& b) { return _mm_max_ps(a.data, b.data); }
+		static Float4 Sqrt(const Float4& a) { return _mm_sqrt_ps(a.data); }
+		//Multiply-add, a * b + c
+		static Float4 MulAdd(const Float4& a, const Float4& b, const Float4& c) { return _mm_add_ps(_mm_mul_ps(a.data, b.data), c.data); }
+
+		//Per component, a where the mask is set (all bits, as from a comparison), b elsewhere
+		static Float4 Select(const Float4& mask, const Float4& a, const Float4& b) { return _mm_or_ps(_mm_and_ps(mask.data, a.data), _mm_andnot_ps(mask.data, b.data)); }
+		//Mask of the components that are less than those of b
+		static Float4 Less(const Float4& a, const Float4& b) { return _mm_cmplt_ps(a.data, b.data); }
+
+		//Same value in every component
+		static Float4 SplatX(const Float4& a) { return _mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(0, 0, 0, 0)); }
+		static Float4 SplatY(const Float4& a) { return _mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(1, 1, 1, 1)); }
+		static Float4 SplatZ(const Float4& a) { return _mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(2, 2, 2, 2)); }
+
+		//Horizontal, over x, y and z only
+		static float Dot3(const Float4& a, const Float4& b)
+		{
+			const __m128 product{ _mm_mul_ps(a.data, b.data) };
+			const __m128 yz{ _mm_add_ss(_mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 2, 2, 2))) };
+			return _mm_cvtss_f32(_mm_add_ss(product, yz));
+		}
+		static float MinComponent3(const Float4& a)
+		{
+			const __m128 yz{ _mm_min_ss(_mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(2, 2, 2, 2))) };
+			return _mm_cvtss_f32(_mm_min_ss(a.data, yz));
+		}
+		static float MaxComponent3(const Float4& a)
+		{
+			const __m128 yz{ _mm_max_ss(_mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(a.data, a.data, _MM_SHUFFLE(2, 2, 2, 2))) };
+			return _mm_cvtss_f32(_mm_max_ss(a.data, yz));
+		}
+
+#pragma region Operator Overloads
+		Float4 operator+(const Float4& v) const { return _mm_add_ps(data, v.data); }
+		Float4 operator-(const Float4& v) const { return _mm_sub_ps(data, v.data); }
+		Float4 operator*(const Float4& v) const { return _mm_mul_ps(data, v.data); }
+		Float4 operator/(const Float4& v) const { return _mm_div_ps(data, v.data); }
+		Float4 operator*(float scale) const { return _mm_mul_ps(data, _mm_set1_ps(scale)); }
+		Float4 operator-() const { return _mm_sub_ps(_mm_setzero_ps(), data); }
+		Float4& operator+=(const Float4& v) { data = _mm_add_ps(data, v.data); return *this; }
+		Float4& operator*=(const Float4& v) { data = _mm_mul_ps(data, v.data); return *this; }
+#pragma endregion
+	};
+}
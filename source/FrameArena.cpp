@@ -0,0 +1,63 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+
+namespace dae
+{
+	std::atomic<uint32_t> FrameArena::s_FrameIndex{};
+
+	FrameArena::Scope::Scope() :
+		m_Arena{ FrameArena::Get() },
+		m_BlockIndex{ m_Arena.m_BlockIndex },
+		m_Offset{ m_Arena.m_Offset }
+	{
+	}
+
+	FrameArena::Scope::~Scope()
+	{
+		m_Arena.m_BlockIndex = m_BlockIndex;
+		m_Arena.m_Offset = m_Offset;
+	}
+
+	FrameArena& FrameArena::Get()
+	{
+		thread_local FrameArena arena{};
+
+		const uint32_t frameIndex{ s_FrameIndex.load(std::memory_order_relaxed) };
+		if (arena.m_FrameIndex != frameIndex)
+		{
+			arena.m_FrameIndex = frameIndex;
+			arena.m_BlockIndex = 0;
+			arena.m_Offset = 0;
+		}
+		return arena;
+	}
+
+	void FrameArena::NextFrame()
+	{
+		s_FrameIndex.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void* FrameArena::Allocate(size_t size, size_t alignment)
+	{
+		//The rest of a block that's too small is skipped until the arena is rewound
+		for (; m_BlockIndex < m_Blocks.size(); ++m_BlockIndex, m_Offset = 0)
+		{
+			const Block& block = m_Blocks[m_BlockIndex];
+			const uintptr_t begin{ reinterpret_cast<uintptr_t>(block.pData.get()) };
+			const uintptr_t aligned{ (begin + m_Offset + alignment - 1) & ~(alignment - 1) };
+			if (aligned + size <= begin + block.size)
+			{
+				m_Offset = aligned + size - begin;
+				return reinterpret_cast<void*>(aligned);
+			}
+		}
+
+		const size_t blockSize{ std::max({ MinBlockSize, size + alignment, m_Capacity }) };
+		m_Blocks.push_back({ std::unique_ptr<std::byte[]>{ new std::byte[blockSize] }, blockSize });
+		m_Capacity += blockSize;
+		m_BlockIndex = m_Blocks.size() - 1;
+		m_Offset = 0;
+		return Allocate(size, alignment);
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace dae
+{
+	/**
+	 * \brief Bump allocator for scratch memory that doesn't outlive the frame, one per thread so allocating never locks.
+	 * An arena is rewound the first time its thread uses it after NextFrame, a Scope rewinds it sooner. Blocks are never freed,
+	 * once the first frames have grown them large enough the frame doesn't touch the heap anymore.
+	 */
+	class FrameArena final
+	{
+	public:
+		//Rewinds the calling thread's arena to where it was when the scope started, for work that may also run outside of a frame
+		class Scope final
+		{
+		public:
+			Scope();
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope(Scope&&) noexcept = delete;
+			Scope& operator=(const Scope&) = delete;
+			Scope& operator=(Scope&&) noexcept = delete;
+
+		private:
+			FrameArena& m_Arena;
+			size_t m_BlockIndex{};
+			size_t m_Offset{};
+		};
+
+		FrameArena() = default;
+		~FrameArena() = default;
+
+		FrameArena(const FrameArena&) = delete;
+		FrameArena(FrameArena&&) noexcept = delete;
+		FrameArena& operator=(const FrameArena&) = delete;
+		FrameArena& operator=(FrameArena&&) noexcept = delete;
+
+		//The calling thread's arena
+		static FrameArena& Get();
+		//Every arena is rewound before its next allocation. Only call while no thread still uses memory from the last frame
+		static void NextFrame();
+
+		void* Allocate(size_t size, size_t alignment);
+		template<typename T>
+		T* Allocate(size_t count)
+		{
+			return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+		}
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<std::byte[]> pData{};
+			size_t size{};
+		};
+
+		static constexpr size_t MinBlockSize{ 1 << 16 };
+		static std::atomic<uint32_t> s_FrameIndex;
+
+		std::vector<Block> m_Blocks{};
+		size_t m_Capacity{}; //Of all blocks, new ones are at least as large so a frame needs few
+		size_t m_BlockIndex{}; //Allocating from this block
+		size_t m_Offset{};
+		uint32_t m_FrameIndex{};
+	};
+
+	//Standard allocator on the calling thread's FrameArena, freeing is a no-op
+	template<typename T>
+	struct FrameAllocator
+	{
+		using value_type = T;
+
+		FrameAllocator() = default;
+		template<typename U>
+		FrameAllocator(const FrameAllocator<U>&) noexcept {}
+
+		T* allocate(size_t count) { return FrameArena::Get().Allocate<T>(count); }
+		void deallocate(T*, size_t) noexcept {}
+
+		template<typename U>
+		bool operator==(const FrameAllocator<U>&) const noexcept { return true; }
+	};
+
+	template<typename T>
+	using FrameVector = std::vector<T, FrameAllocator<T>>;
+}
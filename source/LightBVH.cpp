@@ -0,0 +1,248 @@
+#include "LightBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dae
+{
+	namespace
+	{
+		//cos(max(0, a - b)) from the cosines and sines of a and b
+		float CosSubClamped(float sinA, float cosA, float sinB, float cosB)
+		{
+			if (cosA > cosB)
+				return 1.f;
+			return cosA * cosB + sinA * sinB;
+		}
+
+		//sin(max(0, a - b))
+		float SinSubClamped(float sinA, float cosA, float sinB, float cosB)
+		{
+			if (cosA > cosB)
+				return 0.f;
+			return sinA * cosB - cosA * sinB;
+		}
+
+		float SinFromCos(float cosTheta)
+		{
+			return sqrtf(std::max(0.f, 1.f - cosTheta * cosTheta));
+		}
+	}
+
+	void LightBVH::Build(const std::vector<Light>& lights)
+	{
+		m_Nodes.clear();
+		m_InfiniteLights.clear();
+		m_LightToLeaf.assign(lights.size(), InvalidIndex);
+
+		std::vector<BuildLight> buildLights{};
+		buildLights.reserve(lights.size());
+
+		for (uint32_t i = 0; i < lights.size(); ++i)
+		{
+			const Light& light = lights[i];
+			if (light.type == LightType::Directional)
+			{
+				m_InfiniteLights.push_back(i);
+				continue;
+			}
+
+			const float power{ light.intensity * (light.color.r + light.color.g + light.color.b) / 3.f };
+			if (power <= 0.f)
+				continue;
+
+			buildLights.push_back({ light.origin, power, light.range, light.radius, i });
+		}
+
+		m_NumBoundedLights = static_cast<uint32_t>(buildLights.size());
+		if (buildLights.empty())
+			return;
+
+		m_Nodes.reserve(buildLights.size() * 2 - 1);
+		BuildRecursive(buildLights, 0, buildLights.size());
+	}
+
+	uint32_t LightBVH::BuildRecursive(std::vector<BuildLight>& buildLights, size_t first, size_t last)
+	{
+		const uint32_t nodeIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+		m_Nodes.emplace_back();
+
+		if (last - first == 1)
+		{
+			//Point lights emit in all directions
+			Node& leaf = m_Nodes[nodeIndex];
+			const Vector3 extent{ buildLights[first].radius, buildLights[first].radius, buildLights[first].radius };
+			leaf.boundsMin = buildLights[first].position - extent;
+			leaf.boundsMax = buildLights[first].position + extent;
+			leaf.power = buildLights[first].power;
+			leaf.range = buildLights[first].range;
+			leaf.cosThetaO = -1.f;
+			leaf.cosThetaE = 0.f;
+			leaf.index = buildLights[first].lightIndex;
+			leaf.isLeaf = true;
+			m_LightToLeaf[leaf.index] = nodeIndex;
+			return nodeIndex;
+		}
+
+		//Split at the median along the largest axis
+		Vector3 centroidMin{ buildLights[first].position };
+		Vector3 centroidMax{ buildLights[first].position };
+		for (size_t i = first + 1; i < last; ++i)
+		{
+			centroidMin = Vector3::Min(centroidMin, buildLights[i].position);
+			centroidMax = Vector3::Max(centroidMax, buildLights[i].position);
+		}
+
+		const Vector3 extent{ centroidMax - centroidMin };
+		int axis{ 0 };
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		const size_t middle{ (first + last) / 2 };
+		std::nth_element(buildLights.begin() + first, buildLights.begin() + middle, buildLights.begin() + last,
+			[axis](const BuildLight& a, const BuildLight& b) { return a.position[axis] < b.position[axis]; });
+
+		BuildRecursive(buildLights, first, middle);
+		const uint32_t secondChild{ BuildRecursive(buildLights, middle, last) };
+		m_Nodes[nodeIndex + 1].parent = nodeIndex;
+		m_Nodes[secondChild].parent = nodeIndex;
+
+		const Node& a = m_Nodes[nodeIndex + 1];
+		const Node& b = m_Nodes[secondChild];
+
+		Node& node = m_Nodes[nodeIndex];
+		node.boundsMin = Vector3::Min(a.boundsMin, b.boundsMin);
+		node.boundsMax = Vector3::Max(a.boundsMax, b.boundsMax);
+		node.power = a.power + b.power;
+		node.range = std::max(a.range, b.range);
+
+		//Cone union, only omni lights for now so the cone always covers the sphere
+		node.coneAxis = a.coneAxis;
+		node.cosThetaO = std::min(a.cosThetaO, b.cosThetaO);
+		node.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+		node.index = secondChild;
+		node.isLeaf = false;
+		return nodeIndex;
+	}
+
+	bool LightBVH::Sample(const Vector3& p, const Vector3& n, float u, uint32_t& lightIndex, float& pmf) const
+	{
+		if (m_Nodes.empty())
+			return false;
+
+		pmf = 1.f;
+		uint32_t nodeIndex{ 0 };
+		while (!m_Nodes[nodeIndex].isLeaf)
+		{
+			const uint32_t first{ nodeIndex + 1 };
+			const uint32_t second{ m_Nodes[nodeIndex].index };
+
+			const float importanceFirst{ Importance(m_Nodes[first], p, n) };
+			const float importanceSecond{ Importance(m_Nodes[second], p, n) };
+			const float total{ importanceFirst + importanceSecond };
+			if (total <= 0.f)
+				return false;
+
+			//Pick a child and remap u so it can be reused further down
+			const float probabilityFirst{ importanceFirst / total };
+			if (u < probabilityFirst)
+			{
+				u = std::min(u / probabilityFirst, 0.99999994f);
+				pmf *= probabilityFirst;
+				nodeIndex = first;
+			}
+			else
+			{
+				u = std::min((u - probabilityFirst) / (1.f - probabilityFirst), 0.99999994f);
+				pmf *= 1.f - probabilityFirst;
+				nodeIndex = second;
+			}
+		}
+
+		if (Importance(m_Nodes[nodeIndex], p, n) <= 0.f)
+			return false;
+
+		lightIndex = m_Nodes[nodeIndex].index;
+		return true;
+	}
+
+	float LightBVH::Pmf(const Vector3& p, const Vector3& n, uint32_t lightIndex) const
+	{
+		if (lightIndex >= m_LightToLeaf.size() || m_LightToLeaf[lightIndex] == InvalidIndex)
+			return 0.f;
+
+		uint32_t nodeIndex{ m_LightToLeaf[lightIndex] };
+		if (Importance(m_Nodes[nodeIndex], p, n) <= 0.f)
+			return 0.f;
+
+		//Same choices as Sample, walked from the leaf up
+		float pmf{ 1.f };
+		while (m_Nodes[nodeIndex].parent != InvalidIndex)
+		{
+			const uint32_t parent{ m_Nodes[nodeIndex].parent };
+			const uint32_t first{ parent + 1 };
+			const uint32_t second{ m_Nodes[parent].index };
+
+			const float importanceFirst{ Importance(m_Nodes[first], p, n) };
+			const float importanceSecond{ Importance(m_Nodes[second], p, n) };
+			const float total{ importanceFirst + importanceSecond };
+			if (total <= 0.f)
+				return 0.f;
+
+			pmf *= (nodeIndex == first ? importanceFirst : importanceSecond) / total;
+			nodeIndex = parent;
+		}
+		return pmf;
+	}
+
+	float LightBVH::Importance(const Node& node, const Vector3& p, const Vector3& n)
+	{
+		//None of the lights reach the shading point
+		const Vector3 closestPoint{ Vector3::Max(node.boundsMin, Vector3::Min(p, node.boundsMax)) };
+		if ((closestPoint - p).SqrMagnitude() > node.range * node.range)
+			return 0.f;
+
+		const Vector3 center{ (node.boundsMin + node.boundsMax) * 0.5f };
+		const float radius{ (node.boundsMax - node.boundsMin).Magnitude() * 0.5f };
+
+		//Clamp the distance to the size of the node, close to (or inside) a big node every light could be near
+		const Vector3 toCenter{ center - p };
+		const float distanceSqr{ std::max(toCenter.SqrMagnitude(), radius * radius) };
+		const float distance{ toCenter.Magnitude() };
+
+		//Angle subtended by the bounding sphere of the node
+		float cosThetaB{ -1.f };
+		if (distance > radius)
+		{
+			const float sinThetaB{ radius / distance };
+			cosThetaB = sqrtf(std::max(0.f, 1.f - sinThetaB * sinThetaB));
+		}
+		const float sinThetaB{ SinFromCos(cosThetaB) };
+
+		const Vector3 wi{ distance > 0.f ? toCenter / distance : n };
+
+		//Emission cone, bound on the angle between the cone axis and the direction towards the shading point
+		const float cosThetaW{ Vector3::Dot(node.coneAxis, -wi) };
+		const float sinThetaW{ SinFromCos(cosThetaW) };
+		const float sinThetaO{ SinFromCos(node.cosThetaO) };
+		const float cosThetaX{ CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosThetaO) };
+		const float sinThetaX{ SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosThetaO) };
+		const float cosThetaP{ CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB) };
+		if (cosThetaP <= node.cosThetaE)
+			return 0.f;
+
+		//Receiver, lights below the horizon of the surface can't contribute. Without a normal every direction counts
+		float cosThetaPI{ 1.f };
+		if (n.SqrMagnitude() > 0.f)
+		{
+			const float cosThetaI{ Vector3::Dot(wi, n) };
+			const float sinThetaI{ SinFromCos(cosThetaI) };
+			cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+			if (cosThetaPI <= 0.f)
+				return 0.f;
+		}
+
+		return node.power * cosThetaP * cosThetaPI / distanceSqr;
+	}
+}
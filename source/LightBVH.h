@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+#include "DataTypes.h"
+
+namespace dae
+{
+	/**
+	 * \brief Hierarchy over the point lights of a scene, used to pick lights proportional to their estimated contribution.
+	 * Every node bounds its lights spatially, by total power and by an emission cone (omni lights have a full sphere).
+	 * Directional lights can't be bounded and are kept outside of the tree.
+	 */
+	class LightBVH final
+	{
+	public:
+		LightBVH() = default;
+		~LightBVH() = default;
+
+		LightBVH(const LightBVH&) = delete;
+		LightBVH(LightBVH&&) noexcept = delete;
+		LightBVH& operator=(const LightBVH&) = delete;
+		LightBVH& operator=(LightBVH&&) noexcept = delete;
+
+		void Build(const std::vector<Light>& lights);
+
+		/**
+		 * \brief Stochastic traversal, picks one light with a probability proportional to its importance at the shading point
+		 * \param p Shading point
+		 * \param n Surface normal at the shading point, zero to also pick lights below its horizon
+		 * \param u Uniform random number in [0, 1)
+		 * \param lightIndex Index of the picked light in the scene light list
+		 * \param pmf Probability of picking that light
+		 * \return False if no light can contribute
+		 */
+		bool Sample(const Vector3& p, const Vector3& n, float u, uint32_t& lightIndex, float& pmf) const;
+
+		/**
+		 * \brief Probability Sample picks the given light at the shading point, for weighting paths that hit the light by themselves
+		 * \return Zero for lights outside of the tree (directional)
+		 */
+		float Pmf(const Vector3& p, const Vector3& n, uint32_t lightIndex) const;
+
+		const std::vector<uint32_t>& GetInfiniteLights() const { return m_InfiniteLights; }
+		uint32_t GetNumBoundedLights() const { return m_NumBoundedLights; }
+		bool IsEmpty() const { return m_Nodes.empty(); }
+
+	private:
+		static constexpr uint32_t InvalidIndex{ 0xFFFFFFFFu };
+
+		struct Node
+		{
+			Vector3 boundsMin{};
+			Vector3 boundsMax{};
+
+			//Emission cone, all directions within thetaO of the axis (+ thetaE falloff)
+			Vector3 coneAxis{ Vector3::UnitZ };
+			float cosThetaO{ -1.f };
+			float cosThetaE{ 0.f };
+
+			float power{};
+			float range{}; //Largest light range in the node, points farther than this from the bounds receive nothing
+
+			//Leaf >> light index, interior >> index of the second child (first child follows the node)
+			uint32_t index{};
+			uint32_t parent{ InvalidIndex };
+			bool isLeaf{ false };
+		};
+
+		struct BuildLight
+		{
+			Vector3 position{};
+			float power{};
+			float range{};
+			float radius{};
+			uint32_t lightIndex{};
+		};
+
+		std::vector<Node> m_Nodes{};
+		std::vector<uint32_t> m_InfiniteLights{};
+		std::vector<uint32_t> m_LightToLeaf{}; //Scene light index >> leaf node
+		uint32_t m_NumBoundedLights{};
+
+		uint32_t BuildRecursive(std::vector<BuildLight>& buildLights, size_t first, size_t last);
+		static float Importance(const Node& node, const Vector3& p, const Vector3& n);
+	};
+}
@@ -2,6 +2,7 @@
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "Texture.h"
 
 namespace dae
 {
@@ -25,7 +26,56 @@ namespace dae
 		 * \return color
 		 */
 		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
-		virtual float GetReflectivity() { return 0.0f; }
+		virtual float GetReflectivity(const HitRecord& = {}) { return 0.0f; }
+		//Base color, used to separate texture detail from lighting when denoising
+		virtual ColorRGB GetAlbedo(const HitRecord& = {}) { return colors::White; }
+		//Whether the shading changes with the view direction (specular lobes, reflections)
+		virtual bool IsViewDependent() const { return false; }
+
+		/**
+		 * \brief Importance samples a light direction for path tracing, cosine weighted by default (exact for diffuse materials)
+		 * \param hitRecord current hitrecord
+		 * \param v view direction
+		 * \param u two uniform numbers in [0, 1) for the direction
+		 * \param uLobe uniform number in [0, 1) picking the lobe of layered materials
+		 * \param l sampled light direction
+		 * \param pdf solid angle density of l, same as GetPdf
+		 * \return false if no direction could be sampled
+		 */
+		virtual bool SampleDirection(const HitRecord& hitRecord, const Vector3& /*v*/, const Vector2& u, float, Vector3& l, float& pdf)
+		{
+			l = BRDF::Sample_CosineHemisphere(hitRecord.normal, u);
+			pdf = BRDF::Pdf_CosineHemisphere(hitRecord.normal, l);
+			return pdf > 0.f;
+		}
+
+		/**
+		 * \brief Density SampleDirection generates l with, used to weight light samples against material samples
+		 * \param hitRecord current hitrecord
+		 * \param l light direction
+		 * \param v view direction
+		 * \return solid angle density
+		 */
+		virtual float GetPdf(const HitRecord& hitRecord, const Vector3& l, const Vector3& /*v*/)
+		{
+			return BRDF::Pdf_CosineHemisphere(hitRecord.normal, l);
+		}
+
+	protected:
+		//Texture sample at the hit, scaled by the constant (constant only if there is no texture)
+		static ColorRGB SampleMap(const Texture* pTexture, const ColorRGB& constant, const HitRecord& hitRecord)
+		{
+			if (!pTexture)
+				return constant;
+			return constant * pTexture->Sample(hitRecord.uv, hitRecord.dUVdx, hitRecord.dUVdy);
+		}
+
+		static float SampleMap(const Texture* pTexture, float constant, const HitRecord& hitRecord)
+		{
+			if (!pTexture)
+				return constant;
+			return constant * pTexture->Sample(hitRecord.uv, hitRecord.dUVdx, hitRecord.dUVdy).r;
+		}
 
 	};
 #pragma endregion
@@ -45,6 +95,11 @@ namespace dae
 			return m_Color;
 		}
 
+		ColorRGB GetAlbedo(const HitRecord& hitRecord = {}) override
+		{
+			return m_Color;
+		}
+
 	private:
 		ColorRGB m_Color{colors::White};
 	};
@@ -56,18 +111,24 @@ namespace dae
 	class Material_Lambert final : public Material
 	{
 	public:
-		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
+		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance, const Texture* pDiffuseMap = nullptr) :
+			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance), m_pDiffuseMap(pDiffuseMap){}
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			return BRDF::Lambert(m_DiffuseReflectance, SampleMap(m_pDiffuseMap, m_DiffuseColor, hitRecord));
+
+		}
 
+		ColorRGB GetAlbedo(const HitRecord& hitRecord = {}) override
+		{
+			return SampleMap(m_pDiffuseMap, m_DiffuseColor, hitRecord) * m_DiffuseReflectance;
 		}
 
 	private:
 		ColorRGB m_DiffuseColor{colors::White};
 		float m_DiffuseReflectance{1.f}; //kd
+		const Texture* m_pDiffuseMap{ nullptr }; //Owned by the scene
 	};
 #pragma endregion
 
@@ -89,6 +150,16 @@ namespace dae
 				BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, v, hitRecord.normal);
 		}
 
+		ColorRGB GetAlbedo(const HitRecord& hitRecord = {}) override
+		{
+			return m_DiffuseColor * m_DiffuseReflectance;
+		}
+
+		bool IsViewDependent() const override
+		{
+			return m_SpecularReflectance > 0.f;
+		}
+
 	private:
 		ColorRGB m_DiffuseColor{colors::White};
 		float m_DiffuseReflectance{0.5f}; //kd
@@ -102,8 +173,15 @@ namespace dae
 	class Material_CookTorrence final : public Material
 	{
 	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+		/**
+		 * \param albedo Albedo, scales the albedo map if there is one
+		 * \param metalness Metalness, scales the metalness map (red channel) if there is one
+		 * \param roughness Roughness, scales the roughness map (red channel) if there is one
+		 */
+		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness,
+			const Texture* pAlbedoMap = nullptr, const Texture* pMetalnessMap = nullptr, const Texture* pRoughnessMap = nullptr):
+			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness),
+			m_pAlbedoMap(pAlbedoMap), m_pMetalnessMap(pMetalnessMap), m_pRoughnessMap(pRoughnessMap)
 		{
 			if (m_Roughness == 0.0f)
 			{
@@ -113,38 +191,95 @@ namespace dae
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
-			bool ismetal{ static_cast<bool>(m_Metalness) };
-			ColorRGB f0 = ColorRGB(0.04f, 0.04f, 0.04f);
-			if (ismetal)
-			{
-				f0 = m_Albedo;
-			}
+			const ColorRGB albedo{ SampleMap(m_pAlbedoMap, m_Albedo, hitRecord) };
+			const float metalness{ SampleMap(m_pMetalnessMap, m_Metalness, hitRecord) };
+			const float roughness{ GetRoughness(hitRecord) };
+
+			//Metals reflect their albedo, dielectrics ~4%
+			const ColorRGB f0{ ColorRGB::Lerp(ColorRGB(0.04f, 0.04f, 0.04f), albedo, metalness) };
 
 			Vector3 halfVector{ (-v + l) / (-v + l).Magnitude() };
 
-			ColorRGB fresnel{};
-			fresnel = BRDF::FresnelFunction_Schlick(halfVector, -v, f0);
+			//Const, the non-const ColorRGB operators would overwrite it while building the specular term
+			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(halfVector, -v, f0) };
 
 			ColorRGB cookTorrance{};
-			float normalDistribution{ BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, m_Roughness) };
-			float geometryFunction{ BRDF::GeometryFunction_Smith(hitRecord.normal, -v, l, m_Roughness) };
+			float normalDistribution{ BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, roughness) };
+			float geometryFunction{ BRDF::GeometryFunction_Smith(hitRecord.normal, -v, l, roughness) };
+
+			cookTorrance = fresnel * (normalDistribution * geometryFunction / (4 * Vector3::Dot(-v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal)));
+
+			const ColorRGB kd{ (ColorRGB(1, 1, 1) - fresnel) * (1.f - metalness) };
+
+			return BRDF::Lambert(kd, albedo) + cookTorrance;
+		}
+
+		float GetReflectivity(const HitRecord& hitRecord = {}) override
+		{
+			return (1.0f - GetRoughness(hitRecord)) * SampleMap(m_pMetalnessMap, m_Metalness, hitRecord);
+		}
+
+		ColorRGB GetAlbedo(const HitRecord& hitRecord = {}) override
+		{
+			return SampleMap(m_pAlbedoMap, m_Albedo, hitRecord);
+		}
 
-			cookTorrance = (fresnel * normalDistribution * geometryFunction) / (4 * Vector3::Dot(-v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal));
+		bool IsViewDependent() const override
+		{
+			return true;
+		}
 
-			ColorRGB kd = (static_cast<bool>(m_Metalness)) ? ColorRGB(0, 0, 0) : (ColorRGB(1, 1, 1) - fresnel);
+		//Picks between GGX visible normal sampling and cosine sampling of the diffuse lobe
+		bool SampleDirection(const HitRecord& hitRecord, const Vector3& v, const Vector2& u, float uLobe, Vector3& l, float& pdf) override
+		{
+			if (uLobe < GetSpecularProbability(hitRecord, v))
+			{
+				const Vector3 halfVector{ BRDF::Sample_GGXVisibleNormal(hitRecord.normal, -v, GetRoughness(hitRecord), u) };
+				l = Vector3::Reflect(v, halfVector);
+			}
+			else
+			{
+				l = BRDF::Sample_CosineHemisphere(hitRecord.normal, u);
+			}
 
-			return BRDF::Lambert(kd, m_Albedo) + cookTorrance;
+			pdf = GetPdf(hitRecord, l, v);
+			return pdf > 0.f;
 		}
 
-		float GetReflectivity() override
+		float GetPdf(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
 		{
-			return (1.0f - m_Roughness) * m_Metalness;
+			const float specularProbability{ GetSpecularProbability(hitRecord, v) };
+			return specularProbability * BRDF::Pdf_GGXVisibleNormal(hitRecord.normal, -v, l, GetRoughness(hitRecord))
+				+ (1.f - specularProbability) * BRDF::Pdf_CosineHemisphere(hitRecord.normal, l);
 		}
 
 	private:
 		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
 		float m_Metalness{1.0f};
 		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+
+		//Owned by the scene
+		const Texture* m_pAlbedoMap{ nullptr };
+		const Texture* m_pMetalnessMap{ nullptr };
+		const Texture* m_pRoughnessMap{ nullptr };
+
+		float GetRoughness(const HitRecord& hitRecord) const
+		{
+			return std::max(SampleMap(m_pRoughnessMap, m_Roughness, hitRecord), 0.01f);
+		}
+
+		//Chance to sample the specular lobe, Fresnel reflectance at the view angle against the diffuse albedo
+		float GetSpecularProbability(const HitRecord& hitRecord, const Vector3& v) const
+		{
+			const ColorRGB albedo{ SampleMap(m_pAlbedoMap, m_Albedo, hitRecord) };
+			const float metalness{ SampleMap(m_pMetalnessMap, m_Metalness, hitRecord) };
+			const ColorRGB f0{ ColorRGB::Lerp(ColorRGB(0.04f, 0.04f, 0.04f), albedo, metalness) };
+
+			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(hitRecord.normal, -v, f0) };
+			const float specular{ (fresnel.r + fresnel.g + fresnel.b) / 3.f };
+			const float diffuse{ (albedo.r + albedo.g + albedo.b) / 3.f * (1.f - metalness) * (1.f - specular) };
+			return specular / (specular + diffuse);
+		}
 	};
 #pragma endregion
 }
@@ -1,7 +1,9 @@
 #pragma once
+#include "Vector2.h"
 #include "Vector3.h"
 #include "Vector4.h"
 #include "Matrix.h"
+#include "Float4.h"
 #include "ColorRGB.h"
 #include "MathHelpers.h"
 
@@ -14,6 +14,15 @@ namespace dae
 	constexpr auto TO_DEGREES = (180.0f / PI);
 	constexpr auto TO_RADIANS(PI / 180.0f);
 
+	//Bound on the relative error of n rounded float operations, n * u / (1 - n * u) with u half an ulp of 1 (Pharr et al.)
+	constexpr float Gamma(int n)
+	{
+		return (n * FLT_EPSILON * 0.5f) / (1.f - n * FLT_EPSILON * 0.5f);
+	}
+
+	//Box exit distances are scaled by this (1 + 2 * gamma(3)), so rounding in a slab test never misses a box the ray grazes
+	constexpr auto SLAB_FAR_SCALE = 1.f + 2.f * Gamma(3);
+
 	inline float Square(float a)
 	{
 		return a * a;
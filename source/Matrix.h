@@ -1,24 +1,29 @@
 #pragma once
+#include <cassert>
+#include <cmath>
+
 #include "Vector3.h"
 #include "Vector4.h"
+#include "Float4.h"
 
 namespace dae {
 	struct Matrix
 	{
 		Matrix() = default;
-		Matrix(
+		constexpr Matrix(
 			const Vector3& xAxis,
 			const Vector3& yAxis,
 			const Vector3& zAxis,
 			const Vector3& t);
 
-		Matrix(
+		constexpr Matrix(
 			const Vector4& xAxis,
 			const Vector4& yAxis,
 			const Vector4& zAxis,
 			const Vector4& t);
 
-		Matrix(const Matrix& m);
+		Matrix(const Matrix& m) = default;
+		Matrix& operator=(const Matrix& m) = default;
 
 		Vector3 TransformVector(const Vector3& v) const;
 		Vector3 TransformVector(float x, float y, float z) const;
@@ -26,26 +31,30 @@ namespace dae {
 		Vector3 TransformPoint(float x, float y, float z) const;
 		const Matrix& Transpose();
 
-		Vector3 GetAxisX() const;
-		Vector3 GetAxisY() const;
-		Vector3 GetAxisZ() const;
-		Vector3 GetTranslation() const;
+		constexpr Vector3 GetAxisX() const;
+		constexpr Vector3 GetAxisY() const;
+		constexpr Vector3 GetAxisZ() const;
+		constexpr Vector3 GetTranslation() const;
 
-		static Matrix CreateTranslation(float x, float y, float z);
-		static Matrix CreateTranslation(const Vector3& t);
+		static constexpr Matrix CreateTranslation(float x, float y, float z);
+		static constexpr Matrix CreateTranslation(const Vector3& t);
 		static Matrix CreateRotationX(float pitch);
 		static Matrix CreateRotationY(float yaw);
 		static Matrix CreateRotationZ(float roll);
 		static Matrix CreateRotation(float pitch, float yaw, float roll);
 		static Matrix CreateRotation(const Vector3& r);
-		static Matrix CreateScale(float sx, float sy, float sz);
-		static Matrix CreateScale(const Vector3& s);
+		static constexpr Matrix CreateScale(float sx, float sy, float sz);
+		static constexpr Matrix CreateScale(const Vector3& s);
 		static Matrix Transpose(const Matrix& m);
+		//Inverse of a transform without projection (last column 0 0 0 1), the upper 3x3 has to be invertible
+		static Matrix InverseAffine(const Matrix& m);
 
 		Vector4& operator[](int index);
 		Vector4 operator[](int index) const;
 		Matrix operator*(const Matrix& m) const;
 		const Matrix& operator*=(const Matrix& m);
+		//Exact, for detecting that a transform changed
+		bool operator==(const Matrix& m) const;
 
 	private:
 
@@ -62,5 +71,237 @@ namespace dae {
 		// v1x v1y v1z v1w
 		// v2x v2y v2z v2w
 		// v3x v3y v3z v3w
+
+		Float4 LoadRow(int index) const { return Float4{ data[index] }; }
 	};
-}
\ No newline at end of file
+
+	//Header only so every call inlines, the mesh transforms and the camera call these per vertex and per ray
+	constexpr Matrix::Matrix(const Vector3& xAxis, const Vector3& yAxis, const Vector3& zAxis, const Vector3& t) :
+		Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
+	{
+	}
+
+	constexpr Matrix::Matrix(const Vector4& xAxis, const Vector4& yAxis, const Vector4& zAxis, const Vector4& t) :
+		data{ xAxis, yAxis, zAxis, t }
+	{
+	}
+
+	inline Vector3 Matrix::TransformVector(const Vector3& v) const
+	{
+		return TransformVector(v[0], v[1], v[2]);
+	}
+
+	inline Vector3 Matrix::TransformVector(float x, float y, float z) const
+	{
+		//Rows scaled by the components and summed, four lanes at a time
+		const Float4 result{ Float4::MulAdd(LoadRow(0), Float4{ x }, Float4::MulAdd(LoadRow(1), Float4{ y }, LoadRow(2) * z)) };
+		return result.ToVector3();
+	}
+
+	inline Vector3 Matrix::TransformPoint(const Vector3& p) const
+	{
+		return TransformPoint(p[0], p[1], p[2]);
+	}
+
+	inline Vector3 Matrix::TransformPoint(float x, float y, float z) const
+	{
+		const Float4 result{ Float4::MulAdd(LoadRow(0), Float4{ x }, Float4::MulAdd(LoadRow(1), Float4{ y }, Float4::MulAdd(LoadRow(2), Float4{ z }, LoadRow(3)))) };
+		return result.ToVector3();
+	}
+
+	inline const Matrix& Matrix::Transpose()
+	{
+		Matrix result{};
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			for (int c{ 0 }; c < 4; ++c)
+			{
+				result[r][c] = data[c][r];
+			}
+		}
+
+		data[0] = result[0];
+		data[1] = result[1];
+		data[2] = result[2];
+		data[3] = result[3];
+
+		return *this;
+	}
+
+	inline Matrix Matrix::Transpose(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Transpose();
+
+		return out;
+	}
+
+	inline Matrix Matrix::InverseAffine(const Matrix& m)
+	{
+		//Rows of the inverse 3x3 are the components of the cofactor columns, bc, ca and ab over the determinant
+		const Vector3 a{ m.GetAxisX() };
+		const Vector3 b{ m.GetAxisY() };
+		const Vector3 c{ m.GetAxisZ() };
+		const Vector3 bc{ Vector3::Cross(b, c) };
+		const Vector3 ca{ Vector3::Cross(c, a) };
+		const Vector3 ab{ Vector3::Cross(a, b) };
+		const float inverseDeterminant{ 1.f / Vector3::Dot(a, bc) };
+
+		const Vector3 xAxis{ Vector3{ bc.x, ca.x, ab.x } * inverseDeterminant };
+		const Vector3 yAxis{ Vector3{ bc.y, ca.y, ab.y } * inverseDeterminant };
+		const Vector3 zAxis{ Vector3{ bc.z, ca.z, ab.z } * inverseDeterminant };
+		const Vector3 t{ m.GetTranslation() };
+		return { xAxis, yAxis, zAxis, -(xAxis * t.x + yAxis * t.y + zAxis * t.z) };
+	}
+
+	constexpr Vector3 Matrix::GetAxisX() const
+	{
+		return data[0];
+	}
+
+	constexpr Vector3 Matrix::GetAxisY() const
+	{
+		return data[1];
+	}
+
+	constexpr Vector3 Matrix::GetAxisZ() const
+	{
+		return data[2];
+	}
+
+	constexpr Vector3 Matrix::GetTranslation() const
+	{
+		return data[3];
+	}
+
+	constexpr Matrix Matrix::CreateTranslation(float x, float y, float z)
+	{
+		return Matrix{
+			Vector4{ 1, 0, 0, 0 },
+			Vector4{ 0, 1, 0, 0 },
+			Vector4{ 0, 0, 1, 0 },
+			Vector4{ x, y, z, 1 } 
+		};
+	}
+
+	constexpr Matrix Matrix::CreateTranslation(const Vector3& t)
+	{
+		return CreateTranslation(t.x, t.y, t.z);
+	}
+
+	inline Matrix Matrix::CreateRotationX(float pitch)
+	{
+		float c = cos(pitch);
+		float s = sin(pitch);
+
+		return Matrix{
+			Vector4{ 1, 0, 0, 0 },
+			Vector4{ 0, c, -s, 0 },
+			Vector4{ 0, s, c, 0 },
+			Vector4{ 0, 0, 0, 1 } };
+	}
+
+	inline Matrix Matrix::CreateRotationY(float yaw)
+	{
+		float c = cos(yaw);
+		float s = sin(yaw);
+
+		return Matrix{
+			Vector4{ c, 0, -s, 0 },
+			Vector4{ 0, 1, 0, 0 },
+			Vector4{ s, 0, c, 0 },
+			Vector4{ 0, 0, 0, 1 } };
+	}
+
+	inline Matrix Matrix::CreateRotationZ(float roll)
+	{
+		float c = cos(roll);
+		float s = sin(roll);
+
+		return Matrix{
+			Vector4{ c, s, 0, 0 },
+			Vector4{ -s, c, 0, 0 },
+			Vector4{ 0, 0, 1, 0 },
+			Vector4{ 0, 0, 0, 1 } };
+	}
+
+	inline Matrix Matrix::CreateRotation(const Vector3& r)
+	{
+		return CreateRotation(r.x, r.y, r.z);
+	}
+
+	inline Matrix Matrix::CreateRotation(float pitch, float yaw, float roll)
+	{
+		return Matrix{
+			Vector4{ cos(pitch), 0, sin(pitch), 0},
+			Vector4{ sin(pitch) * sin(yaw), cos(yaw), -sin(yaw) * cos(pitch), 0},
+			Vector4{ -cos(yaw) * sin(pitch), sin(yaw), cos(yaw) * cos(pitch), 0},
+			Vector4{ 0, 0, 0, 1 } };
+	}
+
+	constexpr Matrix Matrix::CreateScale(float sx, float sy, float sz)
+	{
+		return Matrix{
+			Vector4{ sx, 0, 0, 0 },
+			Vector4{ 0, sy, 0, 0 },
+			Vector4{ 0, 0, sz, 0 },
+			Vector4{ 0, 0, 0, 1 } };
+	}
+
+	constexpr Matrix Matrix::CreateScale(const Vector3& s)
+	{
+		return CreateScale(s.x, s.y, s.z);
+	}
+
+#pragma region Operator Overloads
+	inline Vector4& Matrix::operator[](int index)
+	{
+		assert(index <= 3 && index >= 0);
+		return data[index];
+	}
+
+	inline Vector4 Matrix::operator[](int index) const
+	{
+		assert(index <= 3 && index >= 0);
+		return data[index];
+	}
+
+	inline Matrix Matrix::operator*(const Matrix& m) const
+	{
+		//Every row of the result is the row of this matrix transforming m, as in TransformPoint
+		Matrix result{};
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			const Float4 row{ LoadRow(r) };
+			const Float4 product{ Float4::MulAdd(m.LoadRow(0), Float4::SplatX(row),
+				Float4::MulAdd(m.LoadRow(1), Float4::SplatY(row),
+				Float4::MulAdd(m.LoadRow(2), Float4::SplatZ(row), m.LoadRow(3) * data[r].w))) };
+			result.data[r] = product.ToVector4();
+		}
+
+		return result;
+	}
+
+	inline const Matrix& Matrix::operator*=(const Matrix& m)
+	{
+		*this = *this * m;
+		return *this;
+	}
+
+	inline bool Matrix::operator==(const Matrix& m) const
+	{
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			for (int c{ 0 }; c < 4; ++c)
+			{
+				if (data[r][c] != m.data[r][c])
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+#pragma endregion
+}
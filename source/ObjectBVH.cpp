@@ -0,0 +1,146 @@
+#include "ObjectBVH.h"
+
+#include <numeric>
+
+namespace dae
+{
+	namespace
+	{
+		float HalfArea(const Vector3& boundsMin, const Vector3& boundsMax)
+		{
+			const Vector3 extent{ boundsMax - boundsMin };
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	}
+
+	void ObjectBVH::Build(const std::vector<Bounds>& objectBounds)
+	{
+		m_Nodes.clear();
+		m_ObjectIndices.resize(objectBounds.size());
+		if (objectBounds.empty())
+			return;
+
+		std::iota(m_ObjectIndices.begin(), m_ObjectIndices.end(), 0u);
+
+		std::vector<Vector3> centroids(objectBounds.size());
+		for (size_t i = 0; i < objectBounds.size(); ++i)
+		{
+			centroids[i] = (objectBounds[i].boundsMin + objectBounds[i].boundsMax) * 0.5f;
+		}
+
+		m_Nodes.reserve(objectBounds.size() * 2 / MaxLeafObjects + 1);
+		BuildRecursive(objectBounds, centroids, 0, static_cast<uint32_t>(objectBounds.size()), 0);
+	}
+
+	uint32_t ObjectBVH::BuildRecursive(const std::vector<Bounds>& objectBounds, const std::vector<Vector3>& centroids, uint32_t first, uint32_t last, uint32_t depth)
+	{
+		const uint32_t nodeIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+		m_Nodes.emplace_back();
+
+		Vector3 boundsMin{ objectBounds[m_ObjectIndices[first]].boundsMin };
+		Vector3 boundsMax{ objectBounds[m_ObjectIndices[first]].boundsMax };
+		Vector3 centroidMin{ centroids[m_ObjectIndices[first]] };
+		Vector3 centroidMax{ centroidMin };
+		for (uint32_t i = first + 1; i < last; ++i)
+		{
+			const uint32_t objectIndex{ m_ObjectIndices[i] };
+			boundsMin = Vector3::Min(boundsMin, objectBounds[objectIndex].boundsMin);
+			boundsMax = Vector3::Max(boundsMax, objectBounds[objectIndex].boundsMax);
+			centroidMin = Vector3::Min(centroidMin, centroids[objectIndex]);
+			centroidMax = Vector3::Max(centroidMax, centroids[objectIndex]);
+		}
+		m_Nodes[nodeIndex].boundsMin = boundsMin;
+		m_Nodes[nodeIndex].boundsMax = boundsMax;
+
+		const uint32_t count{ last - first };
+		const Vector3 extent{ centroidMax - centroidMin };
+		int axis{ 0 };
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		//Few objects left, or all of them at the same spot
+		if (count <= MaxLeafObjects || extent[axis] <= 0.f)
+		{
+			m_Nodes[nodeIndex].index = first;
+			m_Nodes[nodeIndex].count = count;
+			return nodeIndex;
+		}
+
+		//Binned SAH along the largest centroid axis, bins of equal width
+		uint32_t middle{ first };
+		if (depth < MaxSAHDepth)
+		{
+			struct Bin
+			{
+				Vector3 boundsMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+				Vector3 boundsMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+				uint32_t count{};
+			};
+			Bin bins[NumBins]{};
+
+			const float binScale{ static_cast<float>(NumBins) / extent[axis] };
+			const auto getBin = [&](uint32_t objectIndex)
+				{
+					return std::min(static_cast<int>((centroids[objectIndex][axis] - centroidMin[axis]) * binScale), NumBins - 1);
+				};
+
+			for (uint32_t i = first; i < last; ++i)
+			{
+				Bin& bin = bins[getBin(m_ObjectIndices[i])];
+				bin.boundsMin = Vector3::Min(bin.boundsMin, objectBounds[m_ObjectIndices[i]].boundsMin);
+				bin.boundsMax = Vector3::Max(bin.boundsMax, objectBounds[m_ObjectIndices[i]].boundsMax);
+				++bin.count;
+			}
+
+			//Area times count of everything right of each plane, swept from the right
+			float rightCosts[NumBins]{};
+			Bin right{};
+			for (int i = NumBins - 1; i > 0; --i)
+			{
+				right.boundsMin = Vector3::Min(right.boundsMin, bins[i].boundsMin);
+				right.boundsMax = Vector3::Max(right.boundsMax, bins[i].boundsMax);
+				right.count += bins[i].count;
+				rightCosts[i] = right.count > 0 ? HalfArea(right.boundsMin, right.boundsMax) * static_cast<float>(right.count) : 0.f;
+			}
+
+			float bestCost{ HalfArea(boundsMin, boundsMax) * static_cast<float>(count) };
+			int bestBin{ -1 };
+			Bin left{};
+			for (int i = 0; i < NumBins - 1; ++i)
+			{
+				left.boundsMin = Vector3::Min(left.boundsMin, bins[i].boundsMin);
+				left.boundsMax = Vector3::Max(left.boundsMax, bins[i].boundsMax);
+				left.count += bins[i].count;
+				if (left.count == 0 || left.count == count)
+					continue;
+
+				const float cost{ HalfArea(left.boundsMin, left.boundsMax) * static_cast<float>(left.count) + rightCosts[i + 1] };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestBin = i;
+				}
+			}
+
+			if (bestBin >= 0)
+			{
+				middle = static_cast<uint32_t>(std::partition(m_ObjectIndices.begin() + first, m_ObjectIndices.begin() + last,
+					[&](uint32_t objectIndex) { return getBin(objectIndex) <= bestBin; }) - m_ObjectIndices.begin());
+			}
+		}
+
+		//No plane pays off, or too deep already
+		if (middle == first || middle == last)
+		{
+			middle = (first + last) / 2;
+			std::nth_element(m_ObjectIndices.begin() + first, m_ObjectIndices.begin() + middle, m_ObjectIndices.begin() + last,
+				[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+
+		BuildRecursive(objectBounds, centroids, first, middle, depth + 1);
+		const uint32_t secondChild{ BuildRecursive(objectBounds, centroids, middle, last, depth + 1) };
+		m_Nodes[nodeIndex].index = secondChild;
+		m_Nodes[nodeIndex].count = 0;
+		return nodeIndex;
+	}
+}
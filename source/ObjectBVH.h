@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+#include "DataTypes.h"
+
+namespace dae
+{
+	/**
+	 * \brief Binary hierarchy over whole objects given by their world bounds (spheres, mesh instances), the level above TriangleBVH.
+	 * Built top down with binned SAH over the box centroids, leaves hold a few objects. The caller intersects the objects itself,
+	 * so the same tree answers closest hit and any hit queries.
+	 */
+	class ObjectBVH final
+	{
+	public:
+		ObjectBVH() = default;
+		~ObjectBVH() = default;
+
+		ObjectBVH(const ObjectBVH&) = delete;
+		ObjectBVH(ObjectBVH&&) noexcept = delete;
+		ObjectBVH& operator=(const ObjectBVH&) = delete;
+		ObjectBVH& operator=(ObjectBVH&&) noexcept = delete;
+
+		void Build(const std::vector<Bounds>& objectBounds);
+
+		/**
+		 * \brief Visits the objects whose box the ray enters before maxDistance, nearer boxes first
+		 * \param maxDistance Read before every box test, closer hits recorded by intersectObject prune the rest of the tree
+		 * \param intersectObject bool(uint32_t objectIndex), returning true stops the traversal (any hit queries)
+		 * \return True if intersectObject stopped the traversal
+		 */
+		template<typename IntersectObject>
+		bool Intersect(const Ray& ray, const float& maxDistance, IntersectObject&& intersectObject) const;
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		uint32_t GetNumObjects() const { return static_cast<uint32_t>(m_ObjectIndices.size()); }
+
+	private:
+		static constexpr uint32_t MaxLeafObjects{ 4 };
+		static constexpr int NumBins{ 16 };
+		static constexpr uint32_t MaxSAHDepth{ 32 }; //Deeper nodes split at the median, so the traversal stack can't overflow
+		static constexpr int StackSize{ 64 };
+
+		struct Node
+		{
+			Vector3 boundsMin{};
+			uint32_t index{}; //Leaf >> first entry of m_ObjectIndices, interior >> second child (the first is the next node)
+			Vector3 boundsMax{};
+			uint32_t count{}; //Objects in the leaf, 0 for interior nodes
+		};
+
+		std::vector<Node> m_Nodes{};
+		std::vector<uint32_t> m_ObjectIndices{};
+
+		uint32_t BuildRecursive(const std::vector<Bounds>& objectBounds, const std::vector<Vector3>& centroids, uint32_t first, uint32_t last, uint32_t depth);
+		//Distance the ray enters the box at, FLT_MAX when it misses it or only enters past maxDistance
+		static float EntryDistance(const Node& node, const Ray& ray, float maxDistance);
+	};
+
+	template<typename IntersectObject>
+	bool ObjectBVH::Intersect(const Ray& ray, const float& maxDistance, IntersectObject&& intersectObject) const
+	{
+		if (m_Nodes.empty() || EntryDistance(m_Nodes[0], ray, maxDistance) == FLT_MAX)
+		{
+			return false;
+		}
+
+		struct StackEntry
+		{
+			uint32_t nodeIndex;
+			float entryDistance;
+		};
+		StackEntry stack[StackSize];
+		int stackSize{ 0 };
+		stack[stackSize++] = { 0, ray.min };
+
+		while (stackSize > 0)
+		{
+			const StackEntry entry{ stack[--stackSize] };
+
+			//A closer hit was found since it was pushed
+			if (entry.entryDistance > maxDistance)
+			{
+				continue;
+			}
+
+			const Node& node = m_Nodes[entry.nodeIndex];
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.index; i < node.index + node.count; ++i)
+				{
+					if (intersectObject(m_ObjectIndices[i]))
+					{
+						return true;
+					}
+				}
+				continue;
+			}
+
+			//Farthest first, so the nearest child is popped next
+			uint32_t nearIndex{ entry.nodeIndex + 1 };
+			uint32_t farIndex{ node.index };
+			float nearDistance{ EntryDistance(m_Nodes[nearIndex], ray, maxDistance) };
+			float farDistance{ EntryDistance(m_Nodes[farIndex], ray, maxDistance) };
+			if (farDistance < nearDistance)
+			{
+				std::swap(nearIndex, farIndex);
+				std::swap(nearDistance, farDistance);
+			}
+
+			assert(stackSize + 2 <= StackSize);
+			if (farDistance != FLT_MAX)
+			{
+				stack[stackSize++] = { farIndex, farDistance };
+			}
+			if (nearDistance != FLT_MAX)
+			{
+				stack[stackSize++] = { nearIndex, nearDistance };
+			}
+		}
+		return false;
+	}
+
+	inline float ObjectBVH::EntryDistance(const Node& node, const Ray& ray, float maxDistance)
+	{
+		//Same plane selection as GeometryUtils::SlabTest, the NaNs of axis parallel rays are dropped by keeping them the second operand
+		float tNear{ ray.min };
+		float tFar{ maxDistance };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float nearPlane{ ray.isDirectionNegative[axis] ? node.boundsMax[axis] : node.boundsMin[axis] };
+			const float farPlane{ ray.isDirectionNegative[axis] ? node.boundsMin[axis] : node.boundsMax[axis] };
+			tNear = std::max(tNear, (nearPlane - ray.origin[axis]) * ray.inverseDirection[axis]);
+			tFar = std::min(tFar, (farPlane - ray.origin[axis]) * ray.inverseDirection[axis] * SLAB_FAR_SCALE);
+		}
+		return tNear <= tFar ? tNear : FLT_MAX;
+	}
+}
@@ -0,0 +1,538 @@
+#include "Rasterizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h> //AVX
+#include <ppl.h> // parallel_for
+
+#include "Camera.h"
+#include "Scene.h"
+#include "Utils.h"
+
+namespace dae
+{
+	namespace
+	{
+		//Vertices this close to the camera plane are past any ray's min distance, the clipped part behind them is never seen
+		constexpr float ClipDepth{ 1e-6f };
+
+		inline Vector3 ToCameraSpace(const Vector3& point, const Vector3& origin, const Vector3& axisX, const Vector3& axisY, const Vector3& axisZ)
+		{
+			const Vector3 toPoint{ point - origin };
+			return { Vector3::Dot(toPoint, axisX), Vector3::Dot(toPoint, axisY), Vector3::Dot(toPoint, axisZ) };
+		}
+	}
+
+	void Rasterizer::Setup(const Scene& scene, const Camera& camera, float fov, float aspectRatio, int width, int height, int tileSize)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_TileSize = std::min(tileSize, MaxTileSize);
+		m_NumTilesX = (width + m_TileSize - 1) / m_TileSize;
+		m_NumTilesY = (height + m_TileSize - 1) / m_TileSize;
+		const uint32_t numTiles{ static_cast<uint32_t>(m_NumTilesX * m_NumTilesY) };
+
+		//The exact inverse of Renderer::GetPrimaryRay, pixel centers land on px + 0.5
+		Projection projection{};
+		projection.origin = camera.origin;
+		projection.axisX = camera.cameraToWorld.GetAxisX();
+		projection.axisY = camera.cameraToWorld.GetAxisY();
+		projection.axisZ = camera.cameraToWorld.GetAxisZ();
+		projection.scaleX = static_cast<float>(width) * 0.5f / (aspectRatio * fov);
+		projection.scaleY = static_cast<float>(height) * 0.5f / fov;
+		projection.centerX = static_cast<float>(width) * 0.5f;
+		projection.centerY = static_cast<float>(height) * 0.5f;
+
+		const std::vector<TriangleMesh>& meshes = scene.GetTriangleMeshGeometries();
+		m_MeshTriangleOffsets.resize(meshes.size() + 1);
+		m_MeshTriangleOffsets[0] = 0;
+		for (size_t i = 0; i < meshes.size(); ++i)
+		{
+			m_MeshTriangleOffsets[i + 1] = m_MeshTriangleOffsets[i] + meshes[i].GetNumTriangles();
+		}
+		const uint32_t numTriangles{ m_MeshTriangleOffsets.back() };
+		m_Triangles.resize(numTriangles);
+
+		m_NumChunks = (numTriangles + ChunkSize - 1) / ChunkSize;
+		if (m_Chunks.size() < m_NumChunks)
+		{
+			m_Chunks.resize(m_NumChunks);
+		}
+		concurrency::parallel_for(0u, m_NumChunks, [this, &scene, &projection, numTiles](uint32_t chunkIndex)
+			{
+				Chunk& chunk = m_Chunks[chunkIndex];
+				//Last frame's arena memory is gone, the bins start over instead of keeping their capacity
+				chunk.bins.resize(numTiles);
+				for (FrameVector<uint32_t>& bin : chunk.bins)
+				{
+					bin = FrameVector<uint32_t>{};
+				}
+				chunk.isTileTraced.assign(numTiles, 0);
+
+				SetupChunk(scene, projection, chunkIndex);
+			});
+
+		m_IsTileTraced.assign(numTiles, 0);
+		for (uint32_t chunkIndex = 0; chunkIndex < m_NumChunks; ++chunkIndex)
+		{
+			for (uint32_t tileIndex = 0; tileIndex < numTiles; ++tileIndex)
+			{
+				m_IsTileTraced[tileIndex] |= m_Chunks[chunkIndex].isTileTraced[tileIndex];
+			}
+		}
+
+		BinSpheres(scene, projection);
+		BinInstances(scene, projection);
+	}
+
+	void Rasterizer::SetupChunk(const Scene& scene, const Projection& projection, uint32_t chunkIndex)
+	{
+		Chunk& chunk = m_Chunks[chunkIndex];
+		const std::vector<TriangleMesh>& meshes = scene.GetTriangleMeshGeometries();
+
+		const uint32_t begin{ chunkIndex * ChunkSize };
+		const uint32_t end{ std::min(begin + ChunkSize, m_MeshTriangleOffsets.back()) };
+		uint32_t meshIndex{ static_cast<uint32_t>(std::upper_bound(m_MeshTriangleOffsets.begin(), m_MeshTriangleOffsets.end(), begin) - m_MeshTriangleOffsets.begin()) - 1 };
+
+		for (uint32_t triangleIndex = begin; triangleIndex < end; ++triangleIndex)
+		{
+			while (triangleIndex >= m_MeshTriangleOffsets[meshIndex + 1])
+			{
+				++meshIndex;
+			}
+			const TriangleMesh& mesh = meshes[meshIndex];
+			const uint32_t primitiveIndex{ triangleIndex - m_MeshTriangleOffsets[meshIndex] };
+
+			const Vector3 vertices[3]{
+				mesh.GetTransformedPosition(primitiveIndex, 0),
+				mesh.GetTransformedPosition(primitiveIndex, 1),
+				mesh.GetTransformedPosition(primitiveIndex, 2) };
+
+			//The side the ray tracer culls, every ray from the camera through the triangle's plane sees the same one
+			const float dotNV{ Vector3::Dot(mesh.GetTransformedNormal(primitiveIndex), vertices[0] - projection.origin) };
+			if (dotNV == 0.f || (mesh.cullMode == TriangleCullMode::BackFaceCulling && dotNV > 0.f)
+				|| (mesh.cullMode == TriangleCullMode::FrontFaceCulling && dotNV < 0.f))
+			{
+				continue;
+			}
+
+			Vector3 cameraVertices[3]{};
+			float minDepth{ FLT_MAX };
+			float maxDepth{ -FLT_MAX };
+			for (int i = 0; i < 3; ++i)
+			{
+				cameraVertices[i] = ToCameraSpace(vertices[i], projection.origin, projection.axisX, projection.axisY, projection.axisZ);
+				minDepth = std::min(minDepth, cameraVertices[i].z);
+				maxDepth = std::max(maxDepth, cameraVertices[i].z);
+			}
+
+			if (maxDepth <= 0.f)
+			{
+				continue;
+			}
+			if (minDepth < NearDepth)
+			{
+				MarkTracedTiles(chunk, cameraVertices, projection);
+				continue;
+			}
+
+			float screenX[3]{};
+			float screenY[3]{};
+			ScreenTriangle& triangle = m_Triangles[triangleIndex];
+			for (int i = 0; i < 3; ++i)
+			{
+				triangle.inverseDepths[i] = 1.f / cameraVertices[i].z;
+				screenX[i] = projection.centerX + cameraVertices[i].x * triangle.inverseDepths[i] * projection.scaleX;
+				screenY[i] = projection.centerY - cameraVertices[i].y * triangle.inverseDepths[i] * projection.scaleY;
+			}
+
+			const float area{ (screenX[1] - screenX[0]) * (screenY[2] - screenY[0]) - (screenY[1] - screenY[0]) * (screenX[2] - screenX[0]) };
+			if (area == 0.f || !std::isfinite(area))
+			{
+				continue;
+			}
+
+			if (!GetPixelRange(std::min(screenX[0], std::min(screenX[1], screenX[2])), std::min(screenY[0], std::min(screenY[1], screenY[2])),
+				std::max(screenX[0], std::max(screenX[1], screenX[2])), std::max(screenY[0], std::max(screenY[1], screenY[2])),
+				triangle.pixelMinX, triangle.pixelMinY, triangle.pixelMaxX, triangle.pixelMaxY))
+			{
+				continue;
+			}
+
+			for (int i = 0; i < 3; ++i)
+			{
+				const int a{ (i + 1) % 3 };
+				const int b{ (i + 2) % 3 };
+				const bool isSwapped{ screenX[b] < screenX[a] || (screenX[b] == screenX[a] && screenY[b] < screenY[a]) };
+				const int from{ isSwapped ? b : a };
+				const int to{ isSwapped ? a : b };
+
+				triangle.originX[i] = screenX[from];
+				triangle.originY[i] = screenY[from];
+				triangle.deltaX[i] = screenX[to] - screenX[from];
+				triangle.deltaY[i] = screenY[to] - screenY[from];
+				triangle.sign[i] = (isSwapped ? -1.f : 1.f) * (area > 0.f ? 1.f : -1.f);
+			}
+			triangle.inverseArea = 1.f / std::abs(area);
+			triangle.meshIndex = meshIndex;
+			triangle.primitiveIndex = primitiveIndex;
+
+			for (int tileY = triangle.pixelMinY / m_TileSize; tileY <= triangle.pixelMaxY / m_TileSize; ++tileY)
+			{
+				for (int tileX = triangle.pixelMinX / m_TileSize; tileX <= triangle.pixelMaxX / m_TileSize; ++tileX)
+				{
+					chunk.bins[tileX + tileY * m_NumTilesX].push_back(triangleIndex);
+				}
+			}
+		}
+	}
+
+	void Rasterizer::MarkTracedTiles(Chunk& chunk, const Vector3* cameraVertices, const Projection& projection) const
+	{
+		float minX{ FLT_MAX };
+		float minY{ FLT_MAX };
+		float maxX{ -FLT_MAX };
+		float maxY{ -FLT_MAX };
+		const auto addPoint = [&](const Vector3& point)
+			{
+				const float x{ projection.centerX + point.x / point.z * projection.scaleX };
+				const float y{ projection.centerY - point.y / point.z * projection.scaleY };
+				minX = std::min(minX, x);
+				minY = std::min(minY, y);
+				maxX = std::max(maxX, x);
+				maxY = std::max(maxY, y);
+			};
+
+		//Clipped against the camera plane, the vertices in front and where the edges cross it
+		for (int i = 0; i < 3; ++i)
+		{
+			const Vector3& current = cameraVertices[i];
+			const Vector3& next = cameraVertices[(i + 1) % 3];
+			if (current.z >= ClipDepth)
+			{
+				addPoint(current);
+			}
+			if ((current.z >= ClipDepth) != (next.z >= ClipDepth))
+			{
+				const float f{ (ClipDepth - current.z) / (next.z - current.z) };
+				addPoint(Vector3{ current.x + (next.x - current.x) * f, current.y + (next.y - current.y) * f, ClipDepth });
+			}
+		}
+
+		int pixelMinX{};
+		int pixelMinY{};
+		int pixelMaxX{};
+		int pixelMaxY{};
+		if (!GetPixelRange(minX, minY, maxX, maxY, pixelMinX, pixelMinY, pixelMaxX, pixelMaxY))
+		{
+			return;
+		}
+
+		for (int tileY = pixelMinY / m_TileSize; tileY <= pixelMaxY / m_TileSize; ++tileY)
+		{
+			for (int tileX = pixelMinX / m_TileSize; tileX <= pixelMaxX / m_TileSize; ++tileX)
+			{
+				chunk.isTileTraced[tileX + tileY * m_NumTilesX] = 1;
+			}
+		}
+	}
+
+	void Rasterizer::BinSpheres(const Scene& scene, const Projection& projection)
+	{
+		m_SphereBins.resize(m_NumTilesX * m_NumTilesY);
+		for (FrameVector<uint32_t>& bin : m_SphereBins)
+		{
+			bin = FrameVector<uint32_t>{};
+		}
+		m_UnboundedSpheres.clear();
+
+		const std::vector<Sphere>& spheres = scene.GetSphereGeometries();
+		for (uint32_t i = 0; i < spheres.size(); ++i)
+		{
+			const Vector3 center{ ToCameraSpace(spheres[i].origin, projection.origin, projection.axisX, projection.axisY, projection.axisZ) };
+			const float radius{ spheres[i].radius };
+			if (center.z + radius <= 0.f)
+			{
+				continue;
+			}
+			if (center.z - radius < NearDepth)
+			{
+				m_UnboundedSpheres.push_back(i);
+				continue;
+			}
+
+			//x / z and y / z over the sphere's box are extreme at its corners
+			const float nearInverse{ 1.f / (center.z - radius) };
+			const float farInverse{ 1.f / (center.z + radius) };
+			const float minX{ std::min((center.x - radius) * nearInverse, (center.x - radius) * farInverse) };
+			const float maxX{ std::max((center.x + radius) * nearInverse, (center.x + radius) * farInverse) };
+			const float minY{ std::min((center.y - radius) * nearInverse, (center.y - radius) * farInverse) };
+			const float maxY{ std::max((center.y + radius) * nearInverse, (center.y + radius) * farInverse) };
+
+			int pixelMinX{};
+			int pixelMinY{};
+			int pixelMaxX{};
+			int pixelMaxY{};
+			if (!GetPixelRange(projection.centerX + minX * projection.scaleX, projection.centerY - maxY * projection.scaleY,
+				projection.centerX + maxX * projection.scaleX, projection.centerY - minY * projection.scaleY, pixelMinX, pixelMinY, pixelMaxX, pixelMaxY))
+			{
+				continue;
+			}
+
+			for (int tileY = pixelMinY / m_TileSize; tileY <= pixelMaxY / m_TileSize; ++tileY)
+			{
+				for (int tileX = pixelMinX / m_TileSize; tileX <= pixelMaxX / m_TileSize; ++tileX)
+				{
+					m_SphereBins[tileX + tileY * m_NumTilesX].push_back(i);
+				}
+			}
+		}
+	}
+
+	void Rasterizer::BinInstances(const Scene& scene, const Projection& projection)
+	{
+		m_InstanceBins.resize(m_NumTilesX * m_NumTilesY);
+		for (FrameVector<uint32_t>& bin : m_InstanceBins)
+		{
+			bin = FrameVector<uint32_t>{};
+		}
+		m_UnboundedInstances.clear();
+
+		const std::vector<MeshInstance>& instances = scene.GetMeshInstances();
+		for (uint32_t i = 0; i < instances.size(); ++i)
+		{
+			//Screen bounds of the world box corners
+			float minX{ FLT_MAX };
+			float minY{ FLT_MAX };
+			float maxX{ -FLT_MAX };
+			float maxY{ -FLT_MAX };
+			float minDepth{ FLT_MAX };
+			float maxDepth{ -FLT_MAX };
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const Vector3 point{ (corner & 1) ? instances[i].boundsMax.x : instances[i].boundsMin.x,
+					(corner & 2) ? instances[i].boundsMax.y : instances[i].boundsMin.y,
+					(corner & 4) ? instances[i].boundsMax.z : instances[i].boundsMin.z };
+				const Vector3 cameraPoint{ ToCameraSpace(point, projection.origin, projection.axisX, projection.axisY, projection.axisZ) };
+				minDepth = std::min(minDepth, cameraPoint.z);
+				maxDepth = std::max(maxDepth, cameraPoint.z);
+				if (cameraPoint.z >= NearDepth)
+				{
+					minX = std::min(minX, cameraPoint.x / cameraPoint.z);
+					maxX = std::max(maxX, cameraPoint.x / cameraPoint.z);
+					minY = std::min(minY, cameraPoint.y / cameraPoint.z);
+					maxY = std::max(maxY, cameraPoint.y / cameraPoint.z);
+				}
+			}
+			if (maxDepth <= 0.f)
+			{
+				continue;
+			}
+			if (minDepth < NearDepth)
+			{
+				m_UnboundedInstances.push_back(i);
+				continue;
+			}
+
+			int pixelMinX{};
+			int pixelMinY{};
+			int pixelMaxX{};
+			int pixelMaxY{};
+			if (!GetPixelRange(projection.centerX + minX * projection.scaleX, projection.centerY - maxY * projection.scaleY,
+				projection.centerX + maxX * projection.scaleX, projection.centerY - minY * projection.scaleY, pixelMinX, pixelMinY, pixelMaxX, pixelMaxY))
+			{
+				continue;
+			}
+
+			for (int tileY = pixelMinY / m_TileSize; tileY <= pixelMaxY / m_TileSize; ++tileY)
+			{
+				for (int tileX = pixelMinX / m_TileSize; tileX <= pixelMaxX / m_TileSize; ++tileX)
+				{
+					m_InstanceBins[tileX + tileY * m_NumTilesX].push_back(i);
+				}
+			}
+		}
+	}
+
+	bool Rasterizer::GetPixelRange(float minX, float minY, float maxX, float maxY, int& pixelMinX, int& pixelMinY, int& pixelMaxX, int& pixelMaxY) const
+	{
+		//Also false for NaNs
+		if (!(minX <= maxX && minY <= maxY))
+		{
+			return false;
+		}
+
+		//Clamped before converting, the bounds can be far outside of the screen
+		pixelMinX = static_cast<int>(std::ceil(std::max(minX - 0.5f, 0.f)));
+		pixelMinY = static_cast<int>(std::ceil(std::max(minY - 0.5f, 0.f)));
+		pixelMaxX = static_cast<int>(std::floor(std::min(maxX - 0.5f, static_cast<float>(m_Width - 1))));
+		pixelMaxY = static_cast<int>(std::floor(std::min(maxY - 0.5f, static_cast<float>(m_Height - 1))));
+		return pixelMinX <= pixelMaxX && pixelMinY <= pixelMaxY;
+	}
+
+	bool Rasterizer::RasterizeTile(uint32_t tileIndex, TileVisibility& visibility) const
+	{
+		if (tileIndex >= m_IsTileTraced.size() || m_IsTileTraced[tileIndex])
+		{
+			return false;
+		}
+
+		std::fill(std::begin(visibility.triangles), std::end(visibility.triangles), NoTriangle);
+		std::fill(std::begin(visibility.inverseDepths), std::end(visibility.inverseDepths), 0.f);
+
+		const int tileX{ static_cast<int>(tileIndex % m_NumTilesX) * m_TileSize };
+		const int tileY{ static_cast<int>(tileIndex / m_NumTilesX) * m_TileSize };
+		for (uint32_t chunkIndex = 0; chunkIndex < m_NumChunks; ++chunkIndex)
+		{
+			for (const uint32_t triangleIndex : m_Chunks[chunkIndex].bins[tileIndex])
+			{
+				RasterizeTriangle(m_Triangles[triangleIndex], triangleIndex, tileX, tileY, visibility);
+			}
+		}
+		return true;
+	}
+
+	void Rasterizer::RasterizeTriangle(const ScreenTriangle& triangle, uint32_t triangleIndex, int tileX, int tileY, TileVisibility& visibility) const
+	{
+		const int minX{ std::max(triangle.pixelMinX, tileX) };
+		const int minY{ std::max(triangle.pixelMinY, tileY) };
+		const int maxX{ std::min(triangle.pixelMaxX, tileX + m_TileSize - 1) };
+		const int maxY{ std::min(triangle.pixelMaxY, tileY + m_TileSize - 1) };
+
+		const __m256 laneCenters{ _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f) };
+		const __m256 zero{ _mm256_setzero_ps() };
+		const __m256 inverseArea{ _mm256_set1_ps(triangle.inverseArea) };
+		const __m256 id{ _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(triangleIndex))) };
+
+		__m256 originX[3]{};
+		__m256 deltaY[3]{};
+		__m256 sign[3]{};
+		__m256 inverseDepths[3]{};
+		for (int i = 0; i < 3; ++i)
+		{
+			originX[i] = _mm256_set1_ps(triangle.originX[i]);
+			deltaY[i] = _mm256_set1_ps(triangle.deltaY[i]);
+			sign[i] = _mm256_set1_ps(triangle.sign[i]);
+			inverseDepths[i] = _mm256_set1_ps(triangle.inverseDepths[i]);
+		}
+
+		const int firstBlockX{ tileX + ((minX - tileX) & ~7) };
+		for (int py = minY; py <= maxY; ++py)
+		{
+			//The row part of every edge function, the same operations in the same order as for the neighbouring triangle
+			__m256 rowTerms[3]{};
+			for (int i = 0; i < 3; ++i)
+			{
+				rowTerms[i] = _mm256_set1_ps(triangle.deltaX[i] * ((static_cast<float>(py) + 0.5f) - triangle.originY[i]));
+			}
+
+			for (int blockX = firstBlockX; blockX <= maxX; blockX += 8)
+			{
+				const __m256 centerX{ _mm256_add_ps(_mm256_set1_ps(static_cast<float>(blockX)), laneCenters) };
+
+				__m256 edges[3]{};
+				__m256 isCovered{ _mm256_castsi256_ps(_mm256_set1_epi32(-1)) };
+				for (int i = 0; i < 3; ++i)
+				{
+					edges[i] = _mm256_mul_ps(sign[i], _mm256_sub_ps(rowTerms[i], _mm256_mul_ps(deltaY[i], _mm256_sub_ps(centerX, originX[i]))));
+					isCovered = _mm256_and_ps(isCovered, _mm256_cmp_ps(edges[i], zero, _CMP_GE_OQ));
+				}
+				if (_mm256_movemask_ps(isCovered) == 0)
+				{
+					continue;
+				}
+
+				//1 / z is linear in screen space
+				const __m256 inverseDepth{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edges[0], inverseDepths[0]), _mm256_mul_ps(edges[1], inverseDepths[1])),
+					_mm256_mul_ps(edges[2], inverseDepths[2])), inverseArea) };
+
+				const int localIndex{ (blockX - tileX) + (py - tileY) * m_TileSize };
+				float* pDepths{ visibility.inverseDepths + localIndex };
+				float* pTriangles{ reinterpret_cast<float*>(visibility.triangles + localIndex) };
+				const __m256 depths{ _mm256_loadu_ps(pDepths) };
+				const __m256 isCloser{ _mm256_and_ps(isCovered, _mm256_cmp_ps(inverseDepth, depths, _CMP_GT_OQ)) };
+				_mm256_storeu_ps(pDepths, _mm256_blendv_ps(depths, inverseDepth, isCloser));
+				_mm256_storeu_ps(pTriangles, _mm256_blendv_ps(_mm256_loadu_ps(pTriangles), id, isCloser));
+			}
+		}
+	}
+
+	void Rasterizer::ResolveHit(const Scene& scene, uint32_t tileIndex, const TileVisibility& visibility, int localIndex, const Ray& viewRay, HitRecord& hit) const
+	{
+		const uint32_t triangleIndex{ visibility.triangles[localIndex] };
+		if (triangleIndex != NoTriangle)
+		{
+			const ScreenTriangle& screenTriangle = m_Triangles[triangleIndex];
+			const TriangleMesh& mesh = scene.GetTriangleMeshGeometries()[screenTriangle.meshIndex];
+
+			Triangle triangle{};
+			triangle.v0 = mesh.GetTransformedPosition(screenTriangle.primitiveIndex, 0);
+			triangle.v1 = mesh.GetTransformedPosition(screenTriangle.primitiveIndex, 1);
+			triangle.v2 = mesh.GetTransformedPosition(screenTriangle.primitiveIndex, 2);
+			triangle.normal = mesh.GetTransformedNormal(screenTriangle.primitiveIndex);
+			triangle.cullMode = mesh.cullMode;
+
+			float t{};
+			float u{};
+			float v{};
+			const bool isHit{ scene.GetTriangleKernel() == TriangleKernel::Watertight
+				? GeometryUtils::HitDistance_TriangleWatertight(triangle, viewRay, GeometryUtils::MakeWatertightRay(viewRay), t, u, v)
+				: GeometryUtils::HitDistance_Triangle(triangle, viewRay, t, u, v) };
+			if (!isHit)
+			{
+				//The pixel center is on an edge and the ray test rounded the other way, rare enough to just trace it
+				scene.GetClosestHit(viewRay, hit);
+				return;
+			}
+
+			hit.t = t;
+			hit.u = u;
+			hit.v = v;
+			hit.primitiveIndex = screenTriangle.primitiveIndex;
+			hit.pMesh = &mesh;
+			hit.geometry = HitGeometry::Triangle;
+		}
+
+		//Few enough to test at every pixel
+		float t{};
+		const std::vector<Plane>& planes = scene.GetPlaneGeometries();
+		for (uint32_t i = 0; i < planes.size(); ++i)
+		{
+			if (GeometryUtils::HitDistance_Plane(planes[i], viewRay, t) && t < hit.t)
+			{
+				hit.t = t;
+				hit.primitiveIndex = i;
+				hit.geometry = HitGeometry::Plane;
+			}
+		}
+
+		const std::vector<Sphere>& spheres = scene.GetSphereGeometries();
+		const auto testSpheres = [&](const auto& sphereIndices)
+			{
+				for (const uint32_t i : sphereIndices)
+				{
+					if (GeometryUtils::HitDistance_Sphere(spheres[i], viewRay, t) && t < hit.t)
+					{
+						hit.t = t;
+						hit.primitiveIndex = i;
+						hit.geometry = HitGeometry::Sphere;
+					}
+				}
+			};
+		testSpheres(m_SphereBins[tileIndex]);
+		testSpheres(m_UnboundedSpheres);
+
+		//Last, like Scene::GetClosestHit does
+		for (const uint32_t i : m_InstanceBins[tileIndex])
+		{
+			scene.IntersectInstance(i, viewRay, hit, false);
+		}
+		for (const uint32_t i : m_UnboundedInstances)
+		{
+			scene.IntersectInstance(i, viewRay, hit, false);
+		}
+
+		scene.FinalizeHit(viewRay, hit);
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+#include "DataTypes.h"
+#include "FrameArena.h"
+
+namespace dae
+{
+	//Forward Declarations
+	struct Camera;
+	class Scene;
+
+	/**
+	 * \brief Primary visibility by rasterization instead of ray tracing. The hits it resolves are the same records Scene::GetClosestHit
+	 * fills, so shadows and reflections are still traced from them.
+	 * Triangles are projected and binned into the renderer's screen tiles once per frame (in parallel), every tile then rasterizes its bin
+	 * 8 pixels at a time with AVX edge functions into a visibility buffer, the nearest triangle per pixel by interpolated 1/z.
+	 * Every edge is evaluated from the same end by both triangles sharing it, so the two never leave a pixel center uncovered.
+	 * The winning triangle is intersected exactly with the pixel's ray for t and the barycentrics, spheres and planes are intersected
+	 * analytically per pixel. Mesh instances are binned by their screen bounds and ray traced per pixel through their own hierarchy.
+	 * Tiles touched by triangles crossing the camera plane are left to the ray tracer.
+	 */
+	class Rasterizer final
+	{
+	public:
+		static constexpr int MaxTileSize{ 16 }; //Multiple of 8, the AVX width
+		static constexpr uint32_t NoTriangle{ 0xFFFFFFFF };
+
+		//Nearest triangle per pixel of a tile, tile size per row
+		struct TileVisibility
+		{
+			uint32_t triangles[MaxTileSize * MaxTileSize];
+			float inverseDepths[MaxTileSize * MaxTileSize];
+		};
+
+		Rasterizer() = default;
+		~Rasterizer() = default;
+
+		Rasterizer(const Rasterizer&) = delete;
+		Rasterizer(Rasterizer&&) noexcept = delete;
+		Rasterizer& operator=(const Rasterizer&) = delete;
+		Rasterizer& operator=(Rasterizer&&) noexcept = delete;
+
+		/**
+		 * \brief Projects and bins the triangles, spheres and mesh instances of the scene, once per frame before any tile is rasterized
+		 * \param fov Tangent of half the vertical field of view, like Camera::fovAngle
+		 * \param tileSize Tiles are row-major, tileSize pixels square (at most MaxTileSize, a multiple of 8)
+		 */
+		void Setup(const Scene& scene, const Camera& camera, float fov, float aspectRatio, int width, int height, int tileSize);
+		//False when the tile has to be ray traced instead
+		bool RasterizeTile(uint32_t tileIndex, TileVisibility& visibility) const;
+		/**
+		 * \brief Closest primary hit of a pixel of a rasterized tile, finalized like Scene::GetClosestHit does
+		 * \param localIndex Pixel inside the tile, tile size per row
+		 * \param viewRay Primary ray through the pixel center
+		 * \param hit Expected to be reset, like for Scene::GetClosestHit
+		 */
+		void ResolveHit(const Scene& scene, uint32_t tileIndex, const TileVisibility& visibility, int localIndex, const Ray& viewRay, HitRecord& hit) const;
+
+	private:
+		//Triangles are set up and binned in chunks of this many, in parallel
+		static constexpr uint32_t ChunkSize{ 4096 };
+		//Triangles closer to the camera plane than this are ray traced, projecting them would lose all precision
+		static constexpr float NearDepth{ 0.01f };
+
+		//World to screen, the inverse of the renderer's primary rays
+		struct Projection
+		{
+			Vector3 origin;
+			Vector3 axisX;
+			Vector3 axisY;
+			Vector3 axisZ;
+			float scaleX; //Pixels per unit of x / z
+			float scaleY;
+			float centerX;
+			float centerY;
+		};
+
+		struct ScreenTriangle
+		{
+			//Edge opposite vertex i, E = sign * (dx * (y - oy) - dy * (x - ox)), positive inside. The origin is the lower of the
+			//two end points, so triangles sharing the edge get exactly opposite values
+			float originX[3];
+			float originY[3];
+			float deltaX[3];
+			float deltaY[3];
+			float sign[3];
+			//1 / z of vertex i, weighted by its edge function
+			float inverseDepths[3];
+			float inverseArea;
+			//Pixel center range covered, inclusive
+			int pixelMinX;
+			int pixelMinY;
+			int pixelMaxX;
+			int pixelMaxY;
+			uint32_t meshIndex;
+			uint32_t primitiveIndex;
+		};
+
+		struct Chunk
+		{
+			std::vector<FrameVector<uint32_t>> bins{}; //Per tile, indices into m_Triangles
+			std::vector<char> isTileTraced{}; //Per tile, touched by a triangle crossing the camera plane
+		};
+
+		int m_Width{};
+		int m_Height{};
+		int m_TileSize{};
+		int m_NumTilesX{};
+		int m_NumTilesY{};
+
+		std::vector<ScreenTriangle> m_Triangles{}; //One slot per scene triangle, culled ones aren't binned
+		std::vector<uint32_t> m_MeshTriangleOffsets{}; //First slot of every mesh, and the total
+		std::vector<Chunk> m_Chunks{}; //Only kept growing
+		uint32_t m_NumChunks{};
+		std::vector<char> m_IsTileTraced{};
+		std::vector<FrameVector<uint32_t>> m_SphereBins{}; //Per tile, spheres whose screen bounds overlap it
+		std::vector<uint32_t> m_UnboundedSpheres{}; //Spheres reaching behind the camera plane, tested everywhere
+		std::vector<FrameVector<uint32_t>> m_InstanceBins{}; //Per tile, mesh instances whose screen bounds overlap it
+		std::vector<uint32_t> m_UnboundedInstances{}; //Instances reaching behind the camera plane, tested everywhere
+
+		void SetupChunk(const Scene& scene, const Projection& projection, uint32_t chunkIndex);
+		void BinSpheres(const Scene& scene, const Projection& projection);
+		void BinInstances(const Scene& scene, const Projection& projection);
+		//Flags the tiles a triangle crossing the camera plane can cover, from its part in front of the camera
+		void MarkTracedTiles(Chunk& chunk, const Vector3* cameraVertices, const Projection& projection) const;
+		void RasterizeTriangle(const ScreenTriangle& triangle, uint32_t triangleIndex, int tileX, int tileY, TileVisibility& visibility) const;
+		//Pixel center range covered by screen bounds, false when nothing is covered
+		bool GetPixelRange(float minX, float minY, float maxX, float maxY, int& pixelMinX, int& pixelMinY, int& pixelMaxX, int& pixelMaxY) const;
+	};
+}
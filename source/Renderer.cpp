@@ -1,15 +1,20 @@
 //External includes
 #include "SDL.h"
 #include "SDL_surface.h"
-#include <future> //async
+#include <algorithm>
+#include <chrono>
 #include <ppl.h> // parallel_for
+#include <thread>
 
 //Project includes
 #include "Renderer.h"
+#include "FrameArena.h"
 #include "Matrix.h"
 #include "Material.h"
+#include "Sampler.h"
 #include "Scene.h"
 #include "Utils.h"
+#include "WorkerPool.h"
 
 //#define ASYNC
 #define PARALLEL_FOR
@@ -25,183 +30,1232 @@ Renderer::Renderer(SDL_Window* pWindow) :
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
 	m_AspectRatio = static_cast<float>(m_Width) / static_cast<float>(m_Height);
 
+	SetRenderResolution(m_Width, m_Height);
 }
 
-void Renderer::Render(Scene* pScene) const
+Renderer::~Renderer()
 {
+	delete m_pWorkerPool;
+	m_pWorkerPool = nullptr;
+}
+
+void Renderer::SetRenderResolution(int width, int height)
+{
+	m_RenderWidth = width;
+	m_RenderHeight = height;
+
+	m_NumTilesX = (m_RenderWidth + TileSize - 1) / TileSize;
+	m_NumTilesY = (m_RenderHeight + TileSize - 1) / TileSize;
+	m_TileLights.resize(m_NumTilesX * m_NumTilesY);
+
+	//No tile has been rendered at this resolution, the first frame can't be cut short
+	m_TileOrder.resize(m_NumTilesX * m_NumTilesY);
+	m_TileChange.assign(m_NumTilesX * m_NumTilesY, 0.f);
+	m_TileAge.assign(m_NumTilesX * m_NumTilesY, TileNeverRendered);
+	m_TileRendered.assign(m_NumTilesX * m_NumTilesY, 0);
+
+	const size_t numPixels{ size_t(m_RenderWidth) * m_RenderHeight };
+	m_ColorBuffer.resize(numPixels);
+	m_DenoisedBuffer.resize(numPixels);
+	m_AlbedoBuffer.resize(numPixels);
+	m_NormalBuffer.resize(numPixels);
+	m_DepthBuffer.resize(numPixels);
+	m_History[0].resize(numPixels);
+	m_History[1].resize(numPixels);
+	m_GBuffer.resize(size_t(m_NumTilesX) * m_NumTilesY * TileSize * TileSize);
+	m_TileGBufferVersion.assign(m_NumTilesX * m_NumTilesY, 0);
+
+	//The history pixels don't line up anymore
+	m_HistoryValid = false;
+	m_IsPreviousFrameComplete = false;
+}
+
+void Renderer::Render(Scene* pScene)
+{
+	const auto frameStart{ std::chrono::steady_clock::now() };
+
+	//Nothing from the last frame is in use anymore
+	FrameArena::NextFrame();
+
 	Camera& camera = pScene->GetCamera();
 
 	camera.CalculateCameraToWorld();
+	pScene->UpdateLightBVH();
+	pScene->UpdateAccelerationStructures();
 
 	auto& materials = pScene->GetMaterials();
 	auto& lights = pScene->GetLights();
 
 	const float fov = camera.fovAngle;
 
-	const uint32_t numPixels = m_Width * m_Height;
+	//Every light is a candidate for secondary bounces
+	if (m_AllLightIndices.size() != lights.size())
+	{
+		m_AllLightIndices.resize(lights.size());
+		for (uint32_t i = 0; i < lights.size(); ++i)
+		{
+			m_AllLightIndices[i] = i;
+		}
+	}
+
+	//Shading can only be reused as long as nothing moved or was edited (lights and shadows would be stale)
+	m_ReuseShading = pScene->GetGeometryVersion() == m_PreviousGeometryVersion && pScene->GetShadingVersion() == m_PreviousShadingVersion;
 
-#if defined(ASYNC)
-	// Async logic
+	//Taken every frame so the scene's record of where the meshes were stays current. Incremental only when last frame is complete,
+	//was shaded the same way (no toggles, no light or material edits since) and seen from the same view
+	const bool hasLocalizedChanges{ pScene->TakeChangedBounds(m_ChangedBounds) };
+	m_IsIncrementalFrame = m_IncrementalRenderingEnabled && hasLocalizedChanges && !m_ChangedBounds.empty() && m_IsPreviousFrameComplete && !m_PathTracingEnabled
+		&& pScene->GetShadingVersion() == m_PreviousShadingVersion && pScene == m_pGBufferScene && camera.cameraToWorld == m_GBufferCameraToWorld && camera.fovAngle == m_GBufferFov;
+	UpdateGBufferVersion(pScene, camera);
 
-	const uint32_t numCores = std::thread::hardware_concurrency();
-	std::vector<std::future<void>> async_futures{};
-	const uint32_t numPixelsPerTask = numPixels / numCores;
-	uint32_t numUnassignedPixels = numPixels % numCores;
-	uint32_t currPixelIndex = 0;
+	const uint32_t numTiles = m_NumTilesX * m_NumTilesY;
 
-	for (uint32_t coreId = 0; coreId < numCores; ++coreId)
+	//Projected and binned for the whole screen whenever a tile could fill its G-buffer this frame
+	if (m_RasterizationEnabled && (m_IsIncrementalFrame
+		|| std::any_of(m_TileGBufferVersion.begin(), m_TileGBufferVersion.end(), [this](uint32_t version) { return version != m_GBufferVersion; })))
 	{
-		uint32_t taskSize = numPixelsPerTask;
-		if (numUnassignedPixels > 0)
+		m_Rasterizer.Setup(*pScene, camera, fov, m_AspectRatio, m_RenderWidth, m_RenderHeight, TileSize);
+	}
+	SortTilesByPriority();
+
+	//Tiles are taken in priority order, once the budget is spent the rest keep last frame and go first next frame
+	const auto renderNextTile = [=, this, &camera, &lights, &materials](uint32_t orderIndex)
 		{
-			++taskSize;
-			--numUnassignedPixels;
-		}
+			const uint32_t tileIndex{ m_TileOrder[orderIndex] };
+			const bool isOverBudget{ m_FrameBudget > 0.f
+				&& std::chrono::duration<float>(std::chrono::steady_clock::now() - frameStart).count() > m_FrameBudget };
+			if (isOverBudget && m_TileAge[tileIndex] != TileNeverRendered)
+			{
+				m_TileRendered[tileIndex] = 0;
+				return;
+			}
 
-		async_futures.push_back(std::async(std::launch::async, [=, this]
+			if (m_IsIncrementalFrame)
 			{
-				//Render all the pixels for this task.
-				const uint32_t pixelIndexEnd = currPixelIndex + taskSize;
-				for (uint32_t pixelIndex = currPixelIndex; pixelIndex < pixelIndexEnd; ++pixelIndex)
+				if (!IsTileAffected(tileIndex, fov, m_AspectRatio, camera, lights, materials))
 				{
-					RenderPixel(pScene, pixelIndex, fov, m_AspectRatio, camera, lights, materials);
+					m_TileRendered[tileIndex] = TileUnchanged;
+					return;
 				}
-			}));
+				//Its cached hits may show the meshes where they were
+				m_TileGBufferVersion[tileIndex] = m_GBufferVersion - 1;
+			}
 
-		currPixelIndex += taskSize;
-	}
+			RenderTile(pScene, tileIndex, fov, m_AspectRatio, camera, lights, materials);
+			m_TileRendered[tileIndex] = 1;
+		};
 
-	//Wait for async completion of all tasks.
-	for (const std::future<void>& f : async_futures)
+#if defined(ASYNC)
+	// Async logic, one task per core on threads that are kept between frames
+
+	if (!m_pWorkerPool)
 	{
-		f.wait();
+		m_pWorkerPool = new WorkerPool(std::max(std::thread::hardware_concurrency(), 1u));
 	}
+	const uint32_t numCores{ m_pWorkerPool->GetNumWorkers() };
+
+	//Waits for completion of all tasks
+	m_pWorkerPool->Run([=](uint32_t coreId)
+		{
+			//Every task strides through the order, so all of them start with the most important tiles
+			for (uint32_t orderIndex = coreId; orderIndex < numTiles; orderIndex += numCores)
+			{
+				renderNextTile(orderIndex);
+			}
+		});
 
 #elif defined(PARALLEL_FOR)
 	// Parallel-For Logic
 
-	concurrency::parallel_for(0u, numPixels, [=, this](int i)
+	concurrency::parallel_for(0u, numTiles, [=](uint32_t i)
 		{
-			RenderPixel(pScene, i, fov, m_AspectRatio, camera, lights, materials);
+			renderNextTile(i);
 		});
 
 #else
 	// Synchronous Logic (no threading)
 
-	for (uint32_t i = 0; i < numPixels; ++i)
+	for (uint32_t i = 0; i < numTiles; ++i)
 	{
-		RenderPixel(pScene, i, fov, m_AspectRatio, camera, lights, materials);
+		renderNextTile(i);
 	}
 #endif
 
+	//Skipped tiles carry their history over and wait one frame longer, unchanged ones carry it over and are up to date
+	for (uint32_t tileIndex = 0; tileIndex < numTiles; ++tileIndex)
+	{
+		if (m_TileRendered[tileIndex] == 1)
+		{
+			m_TileAge[tileIndex] = 0;
+			continue;
+		}
+
+		if (m_TileRendered[tileIndex] == TileUnchanged)
+		{
+			m_TileAge[tileIndex] = 0;
+			m_TileChange[tileIndex] = 0.f;
+		}
+		else
+		{
+			++m_TileAge[tileIndex];
+		}
+		CopyTileHistory(tileIndex);
+	}
+
+	//Filtered into its own buffer, accumulation and the tile change estimates need the unfiltered radiance
+	const bool isDenoised{ m_PathTracingEnabled && m_DenoiserEnabled };
+	if (isDenoised)
+	{
+		m_Denoiser.Denoise(m_RenderWidth, m_RenderHeight, m_ColorBuffer, m_AlbedoBuffer, m_NormalBuffer, m_DepthBuffer, m_DenoisedBuffer);
+	}
+
+	Present(isDenoised ? m_DenoisedBuffer : m_ColorBuffer);
+
+	//This frame becomes the history of the next one
+	m_PreviousCameraToWorld = camera.cameraToWorld;
+	m_PreviousFov = fov;
+	m_PreviousGeometryVersion = pScene->GetGeometryVersion();
+	m_PreviousShadingVersion = pScene->GetShadingVersion();
+	m_CurrentHistory = 1 - m_CurrentHistory;
+	m_HistoryValid = m_TemporalReuseEnabled;
+	m_IsPreviousFrameComplete = true;
+
+	UpdateResolutionScale(std::chrono::duration<float>(std::chrono::steady_clock::now() - frameStart).count());
+
 	//@END
 	//Update SDL Surface
 	SDL_UpdateWindowSurface(m_pWindow);
+	++m_FrameIndex;
+}
+
+void dae::Renderer::UpdateGBufferVersion(const Scene* pScene, const Camera& camera)
+{
+	//Incremental frames invalidate the affected tiles one by one instead
+	if (pScene == m_pGBufferScene && camera.cameraToWorld == m_GBufferCameraToWorld && camera.fovAngle == m_GBufferFov
+		&& (pScene->GetGeometryVersion() == m_GBufferGeometryVersion || m_IsIncrementalFrame))
+	{
+		m_GBufferGeometryVersion = pScene->GetGeometryVersion();
+		return;
+	}
+
+	++m_GBufferVersion;
+	m_pGBufferScene = pScene;
+	m_GBufferCameraToWorld = camera.cameraToWorld;
+	m_GBufferFov = camera.fovAngle;
+	m_GBufferGeometryVersion = pScene->GetGeometryVersion();
+}
+
+bool dae::Renderer::IsTileAffected(uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+{
+	//Skipped over budget last frame, or never traced at all
+	if (m_TileAge[tileIndex] != 0 || m_TileGBufferVersion[tileIndex] != m_GBufferVersion)
+	{
+		return true;
+	}
+
+	const int tileX = (tileIndex % m_NumTilesX) * TileSize;
+	const int tileY = (tileIndex / m_NumTilesX) * TileSize;
+	const int tileEndX = std::min(tileX + TileSize, m_RenderWidth);
+	const int tileEndY = std::min(tileY + TileSize, m_RenderHeight);
+
+	const HitRecord* primaryHits{ &m_GBuffer[size_t(tileIndex) * TileSize * TileSize] };
+	const std::vector<uint32_t>& tileLights = m_TileLights[tileIndex].indices;
+
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			const HitRecord& hit = primaryHits[(px - tileX) + (py - tileY) * TileSize];
+
+			//A mesh in front of the cached hit, or the hit itself was on a mesh (its old box contains it). The margin covers the
+			//hit sitting on a face of the box
+			RayDifferential rayDifferential{};
+			const Ray viewRay{ GetPrimaryRay(px, py, fov, aspectRatio, camera, rayDifferential) };
+			const float viewMax{ hit.didHit ? hit.t * 1.001f : FLT_MAX };
+			for (const Bounds& bounds : m_ChangedBounds)
+			{
+				if (GeometryUtils::SlabTest(bounds.boundsMin, bounds.boundsMax, viewRay, viewMax))
+				{
+					return true;
+				}
+			}
+
+			if (!hit.didHit)
+			{
+				continue;
+			}
+
+			//Reflections can show the meshes from anywhere
+			if (m_ReflectionsEnabled && materials[hit.materialIndex]->GetReflectivity(hit) > 0.f)
+			{
+				return true;
+			}
+
+			//The same shadow rays ShadeLight casts, lights are points outside of path tracing
+			if (!m_ShadowsEnabled)
+			{
+				continue;
+			}
+
+			for (const uint32_t lightIndex : tileLights)
+			{
+				const Vector3 startPoint{ GeometryUtils::OffsetRayOrigin(hit, LightUtils::GetDirectionToLight(lights[lightIndex], hit.origin)) };
+				const Vector3 direction{ LightUtils::GetDirectionToLight(lights[lightIndex], startPoint) };
+				const Ray lightRay{ startPoint, direction.Normalized() };
+				const float lightMax{ direction.Magnitude() };
+				for (const Bounds& bounds : m_ChangedBounds)
+				{
+					if (GeometryUtils::SlabTest(bounds.boundsMin, bounds.boundsMax, lightRay, lightMax))
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void dae::Renderer::SortTilesByPriority()
+{
+	const float centerX{ static_cast<float>(m_NumTilesX) * 0.5f };
+	const float centerY{ static_cast<float>(m_NumTilesY) * 0.5f };
+	const float maxDistanceSqr{ centerX * centerX + centerY * centerY };
+
+	float* priorities{ FrameArena::Get().Allocate<float>(m_TileOrder.size()) };
+	for (uint32_t tileIndex = 0; tileIndex < m_TileOrder.size(); ++tileIndex)
+	{
+		m_TileOrder[tileIndex] = tileIndex;
+
+		//Stale tiles first, then the ones that changed or are noisy, then the screen center
+		const float dx{ static_cast<float>(tileIndex % m_NumTilesX) + 0.5f - centerX };
+		const float dy{ static_cast<float>(tileIndex / m_NumTilesX) + 0.5f - centerY };
+		const float centerWeight{ 1.f - (dx * dx + dy * dy) / maxDistanceSqr };
+
+		priorities[tileIndex] = static_cast<float>(m_TileAge[tileIndex]) + m_TileChange[tileIndex] * m_TileChangeWeight + centerWeight * m_TileCenterWeight;
+	}
+
+	std::sort(m_TileOrder.begin(), m_TileOrder.end(), [priorities](uint32_t a, uint32_t b)
+		{
+			return priorities[a] > priorities[b];
+		});
+}
+
+void dae::Renderer::CopyTileHistory(uint32_t tileIndex)
+{
+	const int tileX = (tileIndex % m_NumTilesX) * TileSize;
+	const int tileY = (tileIndex / m_NumTilesX) * TileSize;
+	const int tileEndX = std::min(tileX + TileSize, m_RenderWidth);
+	const int tileEndY = std::min(tileY + TileSize, m_RenderHeight);
+
+	const std::vector<HistoryPixel>& previous = m_History[1 - m_CurrentHistory];
+	std::vector<HistoryPixel>& history = m_History[m_CurrentHistory];
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		std::copy(previous.begin() + (tileX + py * m_RenderWidth), previous.begin() + (tileEndX + py * m_RenderWidth), history.begin() + (tileX + py * m_RenderWidth));
+	}
+}
+
+void dae::Renderer::RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials)
+{
+	const int tileX = (tileIndex % m_NumTilesX) * TileSize;
+	const int tileY = (tileIndex / m_NumTilesX) * TileSize;
+	const int tileEndX = std::min(tileX + TileSize, m_RenderWidth);
+	const int tileEndY = std::min(tileY + TileSize, m_RenderHeight);
+
+	//Last frame's brightness, the difference decides how soon the tile is rendered again
+	float previousLuminance[TileSize * TileSize]{};
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			previousLuminance[(px - tileX) + (py - tileY) * TileSize] = m_ColorBuffer[px + (py * m_RenderWidth)].Luminance();
+		}
+	}
+
+	//Primary visibility for the whole tile first, the hits decide which lights matter. Cached in the G-buffer, so it's only traced
+	//(or rasterized) again once the camera or the geometry changed
+	HitRecord* primaryHits{ &m_GBuffer[size_t(tileIndex) * TileSize * TileSize] };
+	const bool isGBufferValid{ m_TileGBufferVersion[tileIndex] == m_GBufferVersion };
+	Rasterizer::TileVisibility visibility;
+	const bool isRasterized{ !isGBufferValid && m_RasterizationEnabled && m_Rasterizer.RasterizeTile(tileIndex, visibility) };
+	Vector3 boundsMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+	Vector3 boundsMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			HitRecord& hit = primaryHits[(px - tileX) + (py - tileY) * TileSize];
+			if (!isGBufferValid)
+			{
+				RayDifferential rayDifferential{};
+				const Ray viewRay{ GetPrimaryRay(px, py, fov, aspectRatio, camera, rayDifferential) };
+
+				hit = {};
+				if (isRasterized)
+				{
+					m_Rasterizer.ResolveHit(*pScene, tileIndex, visibility, (px - tileX) + (py - tileY) * TileSize, viewRay, hit);
+				}
+				else
+				{
+					pScene->GetClosestHit(viewRay, hit);
+				}
+			}
+
+			if (hit.didHit)
+			{
+				boundsMin = Vector3::Min(boundsMin, hit.origin);
+				boundsMax = Vector3::Max(boundsMax, hit.origin);
+			}
+		}
+	}
+	m_TileGBufferVersion[tileIndex] = m_GBufferVersion;
+
+	//Lights whose range reaches the tile, directional ones first
+	TileLightList& tileLights = m_TileLights[tileIndex];
+	tileLights.indices.clear();
+	tileLights.cdf.clear();
+	tileLights.numInfinite = 0;
+	if (boundsMin.x <= boundsMax.x)
+	{
+		for (uint32_t i = 0; i < lights.size(); ++i)
+		{
+			if (lights[i].type == LightType::Directional)
+			{
+				tileLights.indices.push_back(i);
+			}
+		}
+		tileLights.numInfinite = static_cast<uint32_t>(tileLights.indices.size());
+
+		for (uint32_t i = 0; i < lights.size(); ++i)
+		{
+			const Light& light = lights[i];
+			if (light.type == LightType::Directional)
+			{
+				continue;
+			}
+
+			const Vector3 closestPoint{ Vector3::Max(boundsMin, Vector3::Min(light.origin, boundsMax)) };
+			if ((closestPoint - light.origin).SqrMagnitude() <= light.range * light.range)
+			{
+				tileLights.indices.push_back(i);
+			}
+		}
+
+		//Too many to shade all of them, the shadow rays pick point lights by power over the distance to the tile
+		if (tileLights.indices.size() > m_MaxShadedLights)
+		{
+			const Vector3 center{ (boundsMin + boundsMax) * 0.5f };
+			const float halfDiagonalSqr{ (boundsMax - boundsMin).SqrMagnitude() * 0.25f };
+			float sum{};
+			for (size_t i = tileLights.numInfinite; i < tileLights.indices.size(); ++i)
+			{
+				const Light& light = lights[tileLights.indices[i]];
+				const float power{ light.intensity * (light.color.r + light.color.g + light.color.b) / 3.f };
+				sum += power / std::max((light.origin - center).SqrMagnitude(), halfDiagonalSqr);
+				tileLights.cdf.push_back(sum);
+			}
+		}
+	}
+
+	std::vector<HistoryPixel>& history = m_History[m_CurrentHistory];
+	bool isReconstructed[TileSize * TileSize]{};
+	bool hasReconstructed{ false };
+
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			const uint32_t pixelIndex{ static_cast<uint32_t>(px + (py * m_RenderWidth)) };
+			const HitRecord& primaryHit = primaryHits[(px - tileX) + (py - tileY) * TileSize];
+
+			//Guides for the denoiser
+			m_AlbedoBuffer[pixelIndex] = primaryHit.didHit ? materials[primaryHit.materialIndex]->GetAlbedo(primaryHit) : ColorRGB{};
+			m_NormalBuffer[pixelIndex] = primaryHit.didHit ? primaryHit.normal : Vector3{};
+			m_DepthBuffer[pixelIndex] = primaryHit.didHit ? primaryHit.t : FLT_MAX;
+
+			ColorRGB historyColor{};
+			uint16_t historyAge{};
+			const bool hasHistory{ ReprojectHistory(primaryHit, camera, historyColor, historyAge) };
+
+			//The deterministic modes reuse the old shading, staggered refreshes pick up lighting changes. Specular highlights and
+			//reflections move with the camera, those are always shaded again
+			if (hasHistory && m_ReuseShading && !m_PathTracingEnabled && historyAge < GetHistoryRefreshAge(pixelIndex)
+				&& !materials[primaryHit.materialIndex]->IsViewDependent())
+			{
+				m_ColorBuffer[pixelIndex] = historyColor;
+				history[pixelIndex] = { historyColor, primaryHit.origin, primaryHit.normal, static_cast<uint16_t>(historyAge + 1), primaryHit.materialIndex, true };
+				continue;
+			}
+
+			//Pixels skipped by the interleave pattern keep their reprojected color, or are filled from their neighbours once the tile is done
+			if (primaryHit.didHit && !IsPixelTraced(px, py))
+			{
+				if (hasHistory)
+				{
+					m_ColorBuffer[pixelIndex] = historyColor;
+					history[pixelIndex] = { historyColor, primaryHit.origin, primaryHit.normal, historyAge, primaryHit.materialIndex, true };
+				}
+				else
+				{
+					isReconstructed[(px - tileX) + (py - tileY) * TileSize] = true;
+					hasReconstructed = true;
+				}
+				continue;
+			}
+
+			RenderPixel(pScene, pixelIndex, fov, aspectRatio, camera, lights, materials, primaryHit, tileLights);
+
+			//Path tracing accumulates, the blend factor bottoms out so moving content doesn't smear forever
+			uint16_t age{};
+			if (hasHistory && m_PathTracingEnabled)
+			{
+				const float blend{ std::max(1.f / (static_cast<float>(historyAge) + 2.f), m_MinHistoryBlend) };
+				m_ColorBuffer[pixelIndex] = ColorRGB::Lerp(historyColor, m_ColorBuffer[pixelIndex], blend);
+				age = static_cast<uint16_t>(std::min(historyAge + 1, 0xFFFF));
+			}
+
+			history[pixelIndex] = { m_ColorBuffer[pixelIndex], primaryHit.origin, primaryHit.normal, age, primaryHit.materialIndex, primaryHit.didHit };
+		}
+	}
+
+	if (hasReconstructed)
+	{
+		ReconstructTile(pScene, tileIndex, fov, aspectRatio, camera, lights, materials, primaryHits, isReconstructed, tileLights);
+	}
+
+	float change{};
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			change += std::abs(m_ColorBuffer[px + (py * m_RenderWidth)].Luminance() - previousLuminance[(px - tileX) + (py - tileY) * TileSize]);
+		}
+	}
+	m_TileChange[tileIndex] = change / static_cast<float>((tileEndX - tileX) * (tileEndY - tileY));
+}
+
+void dae::Renderer::ReconstructTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+	const HitRecord* primaryHits, const bool* isReconstructed, const TileLightList& tileLights)
+{
+	const int tileX = (tileIndex % m_NumTilesX) * TileSize;
+	const int tileY = (tileIndex / m_NumTilesX) * TileSize;
+	const int tileEndX = std::min(tileX + TileSize, m_RenderWidth);
+	const int tileEndY = std::min(tileY + TileSize, m_RenderHeight);
+
+	std::vector<HistoryPixel>& history = m_History[m_CurrentHistory];
+
+	//Disoccluded pixels that weren't traced, averaged from the neighbours (inside the tile, the other tiles may still be rendering) on the same surface
+	for (int py = tileY; py < tileEndY; ++py)
+	{
+		for (int px = tileX; px < tileEndX; ++px)
+		{
+			const int localIndex{ (px - tileX) + (py - tileY) * TileSize };
+			if (!isReconstructed[localIndex])
+			{
+				continue;
+			}
+
+			const uint32_t pixelIndex{ static_cast<uint32_t>(px + (py * m_RenderWidth)) };
+			const HitRecord& primaryHit = primaryHits[localIndex];
+
+			ColorRGB sumColor{};
+			float sumWeight{};
+			for (int y = std::max(py - 1, tileY); y <= std::min(py + 1, tileEndY - 1); ++y)
+			{
+				for (int x = std::max(px - 1, tileX); x <= std::min(px + 1, tileEndX - 1); ++x)
+				{
+					const int neighbourIndex{ (x - tileX) + (y - tileY) * TileSize };
+					const HitRecord& neighbourHit = primaryHits[neighbourIndex];
+					if (isReconstructed[neighbourIndex] || !neighbourHit.didHit || neighbourHit.materialIndex != primaryHit.materialIndex
+						|| Vector3::Dot(neighbourHit.normal, primaryHit.normal) < 0.9f
+						|| std::abs(neighbourHit.t - primaryHit.t) > m_InterleaveDepthTolerance * primaryHit.t)
+					{
+						continue;
+					}
+
+					//Edge neighbours are closer than the corners
+					const float weight{ (x == px || y == py) ? 1.f : 0.5f };
+					sumColor += m_ColorBuffer[x + (y * m_RenderWidth)] * weight;
+					sumWeight += weight;
+				}
+			}
+
+			if (sumWeight > 0.f)
+			{
+				m_ColorBuffer[pixelIndex] = sumColor * (1.f / sumWeight);
+			}
+			else
+			{
+				//Nothing similar around (thin features, silhouettes), trace it after all
+				RenderPixel(pScene, pixelIndex, fov, aspectRatio, camera, lights, materials, primaryHit, tileLights);
+			}
+
+			history[pixelIndex] = { m_ColorBuffer[pixelIndex], primaryHit.origin, primaryHit.normal, uint16_t{}, primaryHit.materialIndex, true };
+		}
+	}
+}
+
+bool dae::Renderer::IsPixelTraced(int px, int py) const
+{
+	switch (m_InterleaveFactor)
+	{
+	case 2:
+		//Checkerboard, the two halves alternate
+		return ((px + py + m_FrameIndex) & 1) == 0;
+	case 4:
+		{
+			//One pixel of every 2x2 block, diagonal pairs first so every two frames cover a checkerboard
+			constexpr int order[4]{ 0, 3, 1, 2 };
+			return (px & 1) + ((py & 1) << 1) == order[m_FrameIndex & 3];
+		}
+	default:
+		return true;
+	}
+}
+
+bool dae::Renderer::ReprojectHistory(const HitRecord& hitRecord, const Camera& camera, ColorRGB& color, uint16_t& age) const
+{
+	if (!m_HistoryValid || !hitRecord.didHit)
+	{
+		return false;
+	}
+
+	//Into the previous camera, inverse of GetPrimaryRay
+	const Vector3 previousOrigin{ m_PreviousCameraToWorld.GetTranslation() };
+	const Vector3 toPoint{ hitRecord.origin - previousOrigin };
+	const float z{ Vector3::Dot(toPoint, m_PreviousCameraToWorld.GetAxisZ()) };
+	if (z <= 0.f)
+	{
+		return false;
+	}
+
+	const float cx{ Vector3::Dot(toPoint, m_PreviousCameraToWorld.GetAxisX()) / z };
+	const float cy{ Vector3::Dot(toPoint, m_PreviousCameraToWorld.GetAxisY()) / z };
+	const float rx{ (cx / (m_AspectRatio * m_PreviousFov) + 1.f) * 0.5f * static_cast<float>(m_RenderWidth) - 0.5f };
+	const float ry{ (1.f - cy / m_PreviousFov) * 0.5f * static_cast<float>(m_RenderHeight) - 0.5f };
+
+	//Shading depends on the view direction, only reuse it when that barely changed
+	if (!m_PathTracingEnabled)
+	{
+		const Vector3 previousView{ toPoint.Normalized() };
+		const Vector3 currentView{ (hitRecord.origin - camera.origin).Normalized() };
+		if (Vector3::Dot(previousView, currentView) < m_HistoryViewCosine)
+		{
+			return false;
+		}
+	}
+
+	//Bilinear over the history pixels that still show the same surface
+	const std::vector<HistoryPixel>& history = m_History[1 - m_CurrentHistory];
+	const int x0{ static_cast<int>(floorf(rx)) };
+	const int y0{ static_cast<int>(floorf(ry)) };
+	const float fx{ rx - static_cast<float>(x0) };
+	const float fy{ ry - static_cast<float>(y0) };
+	const float maxDistanceSqr{ Square(m_HistoryPositionTolerance * hitRecord.t) };
+
+	ColorRGB sumColor{};
+	float sumWeight{};
+	uint16_t maxAge{};
+	for (int tap = 0; tap < 4; ++tap)
+	{
+		const int x{ x0 + (tap & 1) };
+		const int y{ y0 + (tap >> 1) };
+		if (x < 0 || y < 0 || x >= m_RenderWidth || y >= m_RenderHeight)
+		{
+			continue;
+		}
+
+		const HistoryPixel& previous = history[x + (y * m_RenderWidth)];
+		if (!previous.isValid || previous.materialIndex != hitRecord.materialIndex
+			|| Vector3::Dot(previous.normal, hitRecord.normal) < 0.9f
+			|| (previous.position - hitRecord.origin).SqrMagnitude() > maxDistanceSqr)
+		{
+			continue;
+		}
+
+		const float weight{ ((tap & 1) ? fx : 1.f - fx) * ((tap >> 1) ? fy : 1.f - fy) };
+		sumColor += previous.color * weight;
+		sumWeight += weight;
+		maxAge = std::max(maxAge, previous.age);
+	}
+
+	if (sumWeight < 0.01f)
+	{
+		return false;
+	}
+
+	color = sumColor * (1.f / sumWeight);
+	age = maxAge;
+	return true;
 }
 
-void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+uint16_t dae::Renderer::GetHistoryRefreshAge(uint32_t pixelIndex) const
 {
-	const int px = pixelIndex % m_Width;
-	const int py = pixelIndex / m_Width;
+	const uint32_t halfAge{ m_MaxHistoryAge / 2u };
+	return static_cast<uint16_t>(halfAge + Sampler::Hash(pixelIndex) % (halfAge + 1u));
+}
 
+Ray dae::Renderer::GetPrimaryRay(int px, int py, float fov, float aspectRatio, const Camera& camera, RayDifferential& rayDifferential) const
+{
 	const float rx = px + 0.5f;
 	const float ry = py + 0.5f;
 
-	const float cx = (2 * (rx / float(m_Width)) - 1) * aspectRatio * fov;
-	const float cy = (1 - (2 * (ry / float(m_Height)))) * fov;
+	const float cx = (2 * (rx / float(m_RenderWidth)) - 1) * aspectRatio * fov;
+	const float cy = (1 - (2 * (ry / float(m_RenderHeight)))) * fov;
 
 	const Vector3 forwardVec{ cx, cy, 1 };
 
 	const Vector3 rayDirection{ camera.cameraToWorld.TransformVector(forwardVec.Normalized())};
-	rayDirection.Normalized();
 
-	Ray viewRay{ camera.origin, rayDirection };
+	//Rays through the neighbouring pixels, for texture filtering
+	rayDifferential.rxOrigin = camera.origin;
+	rayDifferential.ryOrigin = camera.origin;
+	rayDifferential.rxDirection = camera.cameraToWorld.TransformVector(Vector3{ cx + 2.f / float(m_RenderWidth) * aspectRatio * fov, cy, 1 }.Normalized());
+	rayDifferential.ryDirection = camera.cameraToWorld.TransformVector(Vector3{ cx, cy - 2.f / float(m_RenderHeight) * fov, 1 }.Normalized());
+	rayDifferential.hasDifferentials = true;
+
+	return { camera.origin, rayDirection };
+}
+
+void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+	const HitRecord& primaryHit, const TileLightList& tileLights)
+{
+	const int px = pixelIndex % m_RenderWidth;
+	const int py = pixelIndex / m_RenderWidth;
+
+	RayDifferential rayDifferential{};
+	Ray viewRay{ GetPrimaryRay(px, py, fov, aspectRatio, camera, rayDifferential) };
+	const Vector3 rayDirection{ viewRay.GetDirection() };
+
+	if (m_PathTracingEnabled)
+	{
+		//Consecutive frames continue the sequence of the pixel
+		ColorRGB finalColor{};
+		for (uint32_t sample = 0; sample < m_PathSamplesPerPixel; ++sample)
+		{
+			LowDiscrepancySampler sequence{ pixelIndex, m_FrameIndex * m_PathSamplesPerPixel + sample };
+			finalColor += TracePath(pScene, viewRay, primaryHit, lights, materials, sequence);
+		}
+		m_ColorBuffer[pixelIndex] = finalColor * (1.f / static_cast<float>(m_PathSamplesPerPixel));
+		return;
+	}
+
+	//Seeded by the pixel alone, the same light samples every frame so the image doesn't flicker
+	Sampler sampler{ pixelIndex, 0 };
+
 	ColorRGB finalColor{};
-	float lambda = 1.0f;
-	float reflectivity{};
+	float throughput{ 1.f };
 
 	for (int bounce = 0; bounce <= m_NumBounces; bounce++)
 	{
 		HitRecord closestHit{};
-		pScene->GetClosestHit(viewRay, closestHit);
+		if (bounce == 0)
+		{
+			closestHit = primaryHit;
+		}
+		else
+		{
+			pScene->GetClosestHit(viewRay, closestHit);
+		}
 
 		if (closestHit.didHit)
 		{
-			for (const auto& i : lights)
-			{
-				const Vector3 startPoint{ closestHit.origin + closestHit.normal * 0.01f };
-				const Vector3 direction{ LightUtils::GetDirectionToLight(i, startPoint) };
-				Ray lightRay{ startPoint, direction.Normalized() };
-				lightRay.min = 0.0001f;
-				lightRay.max = direction.Magnitude();
-				bool occluderHit{ false };
+			GeometryUtils::ComputeUVDerivatives(closestHit, rayDifferential);
+
+			//Only the Combined mode is attenuated along the reflection path
+			const float pathFactor{ (bounce > 0 && m_CurrentLightingMode == LightingMode::Combined) ? throughput : 1.f };
 
-				const auto lambertCosine{ GetLambertCosine(closestHit.normal, LightUtils::GetDirectionToLight(i, closestHit.origin)) };
-				const auto radiance{ LightUtils::GetRadiance(i, closestHit.origin) };
-				const auto brdf{ materials[closestHit.materialIndex]->Shade(closestHit, LightUtils::GetDirectionToLight(i, closestHit.origin).Normalized(), rayDirection) };
+			//Primary hits only consider the lights reaching their tile
+			const std::vector<uint32_t>& candidateLights = bounce == 0 ? tileLights.indices : m_AllLightIndices;
 
-				if (m_ShadowsEnabled)
+			const LightBVH& lightBVH = pScene->GetLightBVH();
+			if (candidateLights.size() <= m_MaxShadedLights)
+			{
+				//Few lights, evaluating all of them is noise free
+				for (const uint32_t lightIndex : candidateLights)
+				{
+					finalColor += ShadeLight(pScene, lights[lightIndex], closestHit, rayDirection, materials) * pathFactor;
+				}
+			}
+			else
+			{
+				const uint32_t* pInfiniteLights{ bounce == 0 ? tileLights.indices.data() : lightBVH.GetInfiniteLights().data() };
+				const size_t numInfinite{ bounce == 0 ? tileLights.numInfinite : lightBVH.GetInfiniteLights().size() };
+				for (size_t i = 0; i < numInfinite; ++i)
 				{
-					occluderHit = pScene->DoesHit(lightRay);
+					finalColor += ShadeLight(pScene, lights[pInfiniteLights[i]], closestHit, rayDirection, materials) * pathFactor;
 				}
-				if (!occluderHit)
+
+				//Only the Lambert cosine drops the lights below the horizon, the other modes need them in the estimate
+				const bool hasCosine{ m_CurrentLightingMode == LightingMode::ObservedArea || m_CurrentLightingMode == LightingMode::Combined };
+				const Vector3 sampleNormal{ hasCosine ? closestHit.normal : Vector3{} };
+
+				//Fixed number of shadow rays, lights picked proportional to their estimated contribution
+				const float sampleWeight{ pathFactor / static_cast<float>(m_NumLightSamples) };
+				for (uint32_t sample = 0; sample < m_NumLightSamples; ++sample)
 				{
-					switch (m_CurrentLightingMode)
+					const float u{ (static_cast<float>(sample) + sampler.NextFloat()) / static_cast<float>(m_NumLightSamples) };
+					uint32_t lightIndex{};
+					float pmf{};
+					const bool isSampled{ bounce == 0 ? SampleTileLight(tileLights, u, lightIndex, pmf) : lightBVH.Sample(closestHit.origin, sampleNormal, u, lightIndex, pmf) };
+					if (isSampled)
 					{
-					case dae::Renderer::LightingMode::ObservedArea:
-						finalColor += ColorRGB({ 1.f, 1.f, 1.f }) * lambertCosine;
-						break;
-					case dae::Renderer::LightingMode::Radiance:
-						finalColor += radiance;
-						break;
-					case dae::Renderer::LightingMode::BRDF:
-						finalColor += brdf;
-						break;
-					case dae::Renderer::LightingMode::Combined:
-						if(bounce > 0)
-						{
-							finalColor += radiance
-								* brdf
-								* lambertCosine
-								* reflectivity
-								* lambda;
-						}
-						else
-						{
-							finalColor += radiance
-								* brdf
-								* lambertCosine;
-						}
-						break;
+						finalColor += ShadeLight(pScene, lights[lightIndex], closestHit, rayDirection, materials) * (sampleWeight / pmf);
 					}
 				}
 			}
 
-			if (m_ReflectionsEnabled)
+			if (!m_ReflectionsEnabled)
 			{
-				reflectivity = materials[closestHit.materialIndex]->GetReflectivity();
-				lambda *= 0.7f;
-				viewRay.origin = closestHit.origin + closestHit.normal * 0.01f;
-				viewRay.direction = Vector3::Reflect(viewRay.direction, closestHit.normal);
+				break;
 			}
-			if (!m_ReflectionsEnabled || reflectivity < FLT_EPSILON)
+
+			throughput *= materials[closestHit.materialIndex]->GetReflectivity(closestHit) * m_ReflectionFalloff;
+			if (!ContinuePath(throughput, bounce, sampler.NextFloat()))
 			{
 				break;
 			}
 
-
+			const Vector3 reflectedDirection{ Vector3::Reflect(viewRay.GetDirection(), closestHit.normal) };
+			viewRay = Ray{ GeometryUtils::OffsetRayOrigin(closestHit, reflectedDirection), reflectedDirection };
+			GeometryUtils::ReflectRayDifferential(rayDifferential, closestHit);
+		}
+		else
+		{
+			//Escaped the scene
+			break;
 		}
 	}
+	m_ColorBuffer[pixelIndex] = finalColor;
+}
+
+void dae::Renderer::Present(const std::vector<ColorRGB>& colorBuffer)
+{
 	//Update Color in Buffer
+	concurrency::parallel_for(0, m_Height, [this, &colorBuffer](int py)
+		{
+			if (m_RenderWidth == m_Width && m_RenderHeight == m_Height)
+			{
+				for (int px = 0; px < m_Width; ++px)
+				{
+					const uint32_t pixelIndex{ static_cast<uint32_t>(px + (py * m_Width)) };
+					WritePixel(pixelIndex, colorBuffer[pixelIndex]);
+				}
+				return;
+			}
+
+			//Bilinear upscale, window pixel centers mapped onto the render resolution
+			const float scaleX{ static_cast<float>(m_RenderWidth) / static_cast<float>(m_Width) };
+			const float scaleY{ static_cast<float>(m_RenderHeight) / static_cast<float>(m_Height) };
+
+			const float sy{ std::clamp((py + 0.5f) * scaleY - 0.5f, 0.f, static_cast<float>(m_RenderHeight - 1)) };
+			const int y0{ static_cast<int>(sy) };
+			const int y1{ std::min(y0 + 1, m_RenderHeight - 1) };
+			const float fy{ sy - static_cast<float>(y0) };
+
+			for (int px = 0; px < m_Width; ++px)
+			{
+				const float sx{ std::clamp((px + 0.5f) * scaleX - 0.5f, 0.f, static_cast<float>(m_RenderWidth - 1)) };
+				const int x0{ static_cast<int>(sx) };
+				const int x1{ std::min(x0 + 1, m_RenderWidth - 1) };
+				const float fx{ sx - static_cast<float>(x0) };
+
+				const ColorRGB top{ ColorRGB::Lerp(colorBuffer[x0 + y0 * m_RenderWidth], colorBuffer[x1 + y0 * m_RenderWidth], fx) };
+				const ColorRGB bottom{ ColorRGB::Lerp(colorBuffer[x0 + y1 * m_RenderWidth], colorBuffer[x1 + y1 * m_RenderWidth], fx) };
+				WritePixel(static_cast<uint32_t>(px + (py * m_Width)), ColorRGB::Lerp(top, bottom, fy));
+			}
+		});
+}
+
+void dae::Renderer::WritePixel(uint32_t pixelIndex, ColorRGB finalColor) const
+{
 	finalColor.MaxToOne();
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
+	m_pBufferPixels[pixelIndex] = SDL_MapRGB(m_pBuffer->format,
 		static_cast<uint8_t>(finalColor.r * 255),
 		static_cast<uint8_t>(finalColor.g * 255),
 		static_cast<uint8_t>(finalColor.b * 255));
+}
+
+void dae::Renderer::UpdateResolutionScale(float frameTime)
+{
+	if (!m_DynamicResolutionEnabled)
+	{
+		if (m_RenderWidth != m_Width || m_RenderHeight != m_Height)
+		{
+			m_ResolutionScale = 1.f;
+			SetRenderResolution(m_Width, m_Height);
+		}
+		return;
+	}
+
+	//Smoothed, single frames spike
+	m_AverageFrameTime = m_AverageFrameTime > 0.f ? Lerpf(m_AverageFrameTime, frameTime, 0.25f) : frameTime;
+
+	//Rate limited, the average has to settle at the new resolution first (its first frames have no history to reuse)
+	if (++m_ResolutionFrames < m_MinResolutionFrames)
+	{
+		return;
+	}
+
+	//Hysteresis, close enough to the target is left alone
+	if (std::abs(m_AverageFrameTime - m_TargetFrameTime) < m_ResolutionTolerance * m_TargetFrameTime)
+	{
+		return;
+	}
+
+	//Cost scales with the pixel count, so with the square of the scale
+	const float idealScale{ m_ResolutionScale * sqrtf(m_TargetFrameTime / m_AverageFrameTime) };
+	const float scale{ std::clamp(idealScale, m_MinResolutionScale, 1.f) };
+	if (std::abs(scale - m_ResolutionScale) < 0.05f * m_ResolutionScale)
+	{
+		return;
+	}
 
+	m_ResolutionScale = scale;
+	m_AverageFrameTime = 0.f;
+	m_ResolutionFrames = 0;
+	SetRenderResolution(std::max(static_cast<int>(m_Width * scale + 0.5f), 1), std::max(static_cast<int>(m_Height * scale + 0.5f), 1));
 }
 
+bool Renderer::SampleTileLight(const TileLightList& tileLights, float u, uint32_t& lightIndex, float& pmf)
+{
+	const std::vector<float>& cdf = tileLights.cdf;
+	if (cdf.empty() || cdf.back() <= 0.f)
+	{
+		return false;
+	}
+
+	//First light whose running sum passes u, the ones with zero weight are never picked
+	const float total{ cdf.back() };
+	const size_t pick{ std::min(static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u * total) - cdf.begin()), cdf.size() - 1) };
+	const float previous{ pick > 0 ? cdf[pick - 1] : 0.f };
+
+	lightIndex = tileLights.indices[tileLights.numInfinite + pick];
+	pmf = (cdf[pick] - previous) / total;
+	return pmf > 0.f;
+}
+
+bool Renderer::ContinuePath(float& throughput, int bounce, float u) const
+{
+	//Whatever the path still gathers can't change the 8-bit pixel. Not for the path tracer, a dim path can still reach an emitter
+	//much brighter than 1 and dropping it would bias the estimate, there only Russian roulette ends paths early
+	if (!m_PathTracingEnabled && throughput < m_MinContribution)
+	{
+		return false;
+	}
+
+	//Russian roulette on dim paths, survivors are boosted so the estimate stays unbiased. Only the path tracer averages it out,
+	//the deterministic modes would get a noise pattern instead
+	if (m_PathTracingEnabled && bounce + 1 >= m_RouletteStartBounce && throughput < m_RouletteThreshold)
+	{
+		const float survivalProbability{ throughput / m_RouletteThreshold };
+		if (u >= survivalProbability)
+		{
+			return false;
+		}
+		throughput /= survivalProbability;
+	}
+
+	return true;
+}
+
+ColorRGB Renderer::TracePath(const Scene* pScene, const Ray& primaryRay, const HitRecord& primaryHit, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+	LowDiscrepancySampler& sequence) const
+{
+	ColorRGB radiance{};
+	ColorRGB throughput{ 1.f, 1.f, 1.f };
+
+	Ray ray{ primaryRay };
+	HitRecord hitRecord{ primaryHit };
+
+	//Previous vertex and the density its material sampled the current ray with, to weight light hits
+	Vector3 previousOrigin{};
+	Vector3 previousNormal{};
+	float materialPdf{};
+
+	for (int bounce = 0; bounce < m_MaxPathLength; ++bounce)
+	{
+		if (bounce > 0)
+		{
+			hitRecord = {};
+			pScene->GetClosestHit(ray, hitRecord);
+
+			//Sphere lights found by material sampling, camera rays don't see lights (like the other modes)
+			float lightDistance{ hitRecord.didHit ? hitRecord.t : FLT_MAX };
+			uint32_t lightIndex{};
+			if (!pScene->GetSphereLightIndices().empty() && HitSphereLights(pScene, lights, ray, lightDistance, lightIndex))
+			{
+				const float lightPdf{ GetLightSelectionDensity(pScene, lights, lightIndex, previousOrigin, previousNormal)
+					* LightUtils::GetSphereLightPdf(lights[lightIndex], previousOrigin) };
+				const ColorRGB emitted{ LightUtils::GetSphereLightRadiance(lights[lightIndex]) };
+				radiance += ClampIndirect(emitted * throughput * PowerHeuristic(materialPdf, lightPdf));
+				break;
+			}
+		}
+
+		if (!hitRecord.didHit)
+		{
+			break;
+		}
+
+		//Shade the side the ray arrives on
+		if (Vector3::Dot(hitRecord.normal, ray.GetDirection()) > 0.f)
+		{
+			hitRecord.normal = -hitRecord.normal;
+		}
+
+		Material* pMaterial{ materials[hitRecord.materialIndex] };
+		const Vector3 viewDirection{ ray.GetDirection() };
+
+		//Next event estimation
+		const ColorRGB direct{ SampleDirectLight(pScene, lights, hitRecord, viewDirection, pMaterial, sequence) };
+		radiance += bounce > 0 ? ClampIndirect(direct * throughput) : direct;
+
+		//Continue the path in a direction picked by the material
+		const Vector2 uDirection{ sequence.Next2D() };
+		const Vector2 uLobe{ sequence.Next2D() };
+
+		Vector3 lightDirection{};
+		if (!pMaterial->SampleDirection(hitRecord, viewDirection, uDirection, uLobe.x, lightDirection, materialPdf))
+		{
+			break;
+		}
+
+		const float cosTheta{ Vector3::Dot(hitRecord.normal, lightDirection) };
+		if (cosTheta <= 0.f)
+		{
+			break;
+		}
+
+		const ColorRGB brdf{ pMaterial->Shade(hitRecord, lightDirection, viewDirection) };
+		throughput *= brdf * (cosTheta / materialPdf);
+
+		//Roulette on the brightest channel
+		const float maxThroughput{ std::max(throughput.r, std::max(throughput.g, throughput.b)) };
+		float survivingThroughput{ maxThroughput };
+		if (!ContinuePath(survivingThroughput, bounce, uLobe.y))
+		{
+			break;
+		}
+		throughput *= survivingThroughput / maxThroughput;
+
+		previousOrigin = hitRecord.origin;
+		previousNormal = hitRecord.normal;
+		ray = Ray{ GeometryUtils::OffsetRayOrigin(hitRecord, lightDirection), lightDirection };
+	}
+
+	return radiance;
+}
+
+ColorRGB Renderer::SampleDirectLight(const Scene* pScene, const std::vector<Light>& lights, const HitRecord& hitRecord, const Vector3& viewDirection, Material* pMaterial,
+	LowDiscrepancySampler& sequence) const
+{
+	ColorRGB direct{};
+
+	const LightBVH& lightBVH = pScene->GetLightBVH();
+	if (lightBVH.GetNumBoundedLights() <= m_NumLightSamples)
+	{
+		for (const Light& light : lights)
+		{
+			direct += SampleLight(pScene, light, 1.f, hitRecord, viewDirection, pMaterial, sequence.Next2D());
+		}
+		return direct;
+	}
+
+	for (const uint32_t lightIndex : lightBVH.GetInfiniteLights())
+	{
+		direct += SampleLight(pScene, lights[lightIndex], 1.f, hitRecord, viewDirection, pMaterial, sequence.Next2D());
+	}
+
+	//Stratified picks through the light hierarchy, every pick counts as 1 / (N * pmf) lights
+	const float numSamples{ static_cast<float>(m_NumLightSamples) };
+	for (uint32_t sample = 0; sample < m_NumLightSamples; ++sample)
+	{
+		const Vector2 uSelect{ sequence.Next2D() };
+		const float u{ (static_cast<float>(sample) + uSelect.x) / numSamples };
+
+		uint32_t lightIndex{};
+		float pmf{};
+		if (lightBVH.Sample(hitRecord.origin, hitRecord.normal, u, lightIndex, pmf))
+		{
+			direct += SampleLight(pScene, lights[lightIndex], numSamples * pmf, hitRecord, viewDirection, pMaterial, sequence.Next2D());
+		}
+	}
+	return direct;
+}
+
+ColorRGB Renderer::SampleLight(const Scene* pScene, const Light& light, float selectionDensity, const HitRecord& hitRecord, const Vector3& viewDirection, Material* pMaterial,
+	const Vector2& u) const
+{
+	Vector3 lightDirection{};
+	float distance{ FLT_MAX };
+	float lightPdf{}; //Stays zero for delta lights, material sampling can't find those
+	ColorRGB lightRadiance{};
+
+	if (light.type == LightType::Directional)
+	{
+		lightDirection = -light.direction.Normalized();
+		lightRadiance = light.color * light.intensity;
+	}
+	else
+	{
+		const Vector3 toLight{ light.origin - hitRecord.origin };
+		const float distanceSqr{ toLight.SqrMagnitude() };
+		if (distanceSqr > light.range * light.range)
+		{
+			return {};
+		}
+
+		if (light.radius > 0.f)
+		{
+			if (!LightUtils::SampleSphereLight(light, hitRecord.origin, u, lightDirection, distance, lightPdf))
+			{
+				return {};
+			}
+			lightRadiance = LightUtils::GetSphereLightRadiance(light);
+		}
+		else
+		{
+			distance = sqrtf(distanceSqr);
+			lightDirection = toLight / distance;
+			lightRadiance = light.color * (light.intensity / distanceSqr);
+		}
+	}
+
+	const float cosTheta{ Vector3::Dot(hitRecord.normal, lightDirection) };
+	if (cosTheta <= 0.f)
+	{
+		return {};
+	}
+
+	if (m_ShadowsEnabled)
+	{
+		Ray shadowRay{ GeometryUtils::OffsetRayOrigin(hitRecord, lightDirection), lightDirection };
+		shadowRay.max = distance - 0.01f;
+		if (pScene->DoesHit(shadowRay))
+		{
+			return {};
+		}
+	}
+
+	const ColorRGB brdf{ pMaterial->Shade(hitRecord, lightDirection, viewDirection) };
+	if (lightPdf <= 0.f)
+	{
+		return brdf * lightRadiance * (cosTheta / selectionDensity);
+	}
+
+	const float samplePdf{ selectionDensity * lightPdf };
+	const float weight{ PowerHeuristic(samplePdf, pMaterial->GetPdf(hitRecord, lightDirection, viewDirection)) };
+	return brdf * lightRadiance * (cosTheta * weight / samplePdf);
+}
+
+float Renderer::GetLightSelectionDensity(const Scene* pScene, const std::vector<Light>& lights, uint32_t lightIndex, const Vector3& origin, const Vector3& normal) const
+{
+	const Light& light = lights[lightIndex];
+	if ((light.origin - origin).SqrMagnitude() > light.range * light.range)
+	{
+		return 0.f;
+	}
+
+	const LightBVH& lightBVH = pScene->GetLightBVH();
+	if (lightBVH.GetNumBoundedLights() <= m_NumLightSamples)
+	{
+		return 1.f;
+	}
+	return static_cast<float>(m_NumLightSamples) * lightBVH.Pmf(origin, normal, lightIndex);
+}
+
+bool Renderer::HitSphereLights(const Scene* pScene, const std::vector<Light>& lights, const Ray& ray, float& distance, uint32_t& lightIndex)
+{
+	//Only the lights with a radius, through their own hierarchy, the closer hits shrink distance as they are found
+	const std::vector<uint32_t>& sphereLightIndices = pScene->GetSphereLightIndices();
+	bool didHit{ false };
+	const auto hitSphereLight = [&](uint32_t sphereLightIndex)
+		{
+			const uint32_t i{ sphereLightIndices[sphereLightIndex] };
+			const Light& light = lights[i];
+
+			const Vector3 toCenter{ light.origin - ray.origin };
+			const float projection{ Vector3::Dot(toCenter, ray.GetDirection()) };
+			const float distanceSqr{ toCenter.SqrMagnitude() - projection * projection };
+			const float radiusSqr{ light.radius * light.radius };
+			if (distanceSqr > radiusSqr)
+			{
+				return false;
+			}
+
+			const float t{ projection - sqrtf(radiusSqr - distanceSqr) };
+			if (t > ray.min && t < distance)
+			{
+				distance = t;
+				lightIndex = i;
+				didHit = true;
+			}
+			return false;
+		};
+	pScene->GetSphereLightBVH().Intersect(ray, distance, hitSphereLight);
+	return didHit;
+}
+
+ColorRGB Renderer::ClampIndirect(const ColorRGB& contribution) const
+{
+	const float maxComponent{ std::max(contribution.r, std::max(contribution.g, contribution.b)) };
+	if (m_IndirectClamp <= 0.f || maxComponent <= m_IndirectClamp)
+	{
+		return contribution;
+	}
+	return contribution * (m_IndirectClamp / maxComponent);
+}
+
+float Renderer::PowerHeuristic(float pdf, float otherPdf)
+{
+	const float pdfSqr{ pdf * pdf };
+	const float sum{ pdfSqr + otherPdf * otherPdf };
+	return sum > 0.f ? pdfSqr / sum : 0.f;
+}
+
+ColorRGB Renderer::ShadeLight(const Scene* pScene, const Light& light, const HitRecord& hitRecord, const Vector3& viewDirection, const std::vector<Material*>& materials) const
+{
+	//Out of range, the contribution is below the cutoff
+	if (light.type == LightType::Point && (light.origin - hitRecord.origin).SqrMagnitude() > light.range * light.range)
+	{
+		return {};
+	}
+
+	if (m_ShadowsEnabled)
+	{
+		const Vector3 startPoint{ GeometryUtils::OffsetRayOrigin(hitRecord, LightUtils::GetDirectionToLight(light, hitRecord.origin)) };
+		const Vector3 direction{ LightUtils::GetDirectionToLight(light, startPoint) };
+		Ray lightRay{ startPoint, direction.Normalized() };
+		lightRay.min = 0.0001f;
+		lightRay.max = direction.Magnitude();
+
+		if (pScene->DoesHit(lightRay))
+		{
+			return {};
+		}
+	}
+
+	const Vector3 lightDirection{ LightUtils::GetDirectionToLight(light, hitRecord.origin).Normalized() };
+
+	switch (m_CurrentLightingMode)
+	{
+	case dae::Renderer::LightingMode::ObservedArea:
+		return ColorRGB({ 1.f, 1.f, 1.f }) * GetLambertCosine(hitRecord.normal, lightDirection);
+	case dae::Renderer::LightingMode::Radiance:
+		return LightUtils::GetRadiance(light, hitRecord.origin);
+	case dae::Renderer::LightingMode::BRDF:
+		return materials[hitRecord.materialIndex]->Shade(hitRecord, lightDirection, viewDirection);
+	case dae::Renderer::LightingMode::Combined:
+	default:
+		return LightUtils::GetRadiance(light, hitRecord.origin)
+			* materials[hitRecord.materialIndex]->Shade(hitRecord, lightDirection, viewDirection)
+			* GetLambertCosine(hitRecord.normal, lightDirection);
+	}
+}
 
 bool Renderer::SaveBufferToImage() const
 {
@@ -218,6 +1272,8 @@ void dae::Renderer::CycleLightingMode()
 	}
 	LightingMode castEnum = static_cast<LightingMode>(count);
 	m_CurrentLightingMode = castEnum;
+	m_HistoryValid = false;
+	m_IsPreviousFrameComplete = false;
 }
 
 
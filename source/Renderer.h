@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include "Math.h"
+#include "DataTypes.h"
+#include "Denoiser.h"
+#include "Rasterizer.h"
 #include <vector>
 
 
@@ -11,33 +14,112 @@ struct SDL_Surface;
 namespace dae
 {
 	struct Camera;
-	struct Light;
+	class LowDiscrepancySampler;
 	class Material;
 	class Scene;
+	class WorkerPool;
 
 	class Renderer final
 	{
 	public:
+		//Lights whose range reaches the primary hits of a screen tile, directional ones first
+		struct TileLightList
+		{
+			std::vector<uint32_t> indices{};
+			uint32_t numInfinite{};
+			std::vector<float> cdf{}; //Running sum of the estimated contribution of the point lights, only built when there are too many to shade all
+		};
+
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		void Render(Scene* pScene);
+		void RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials);
+		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+			const HitRecord& primaryHit, const TileLightList& tileLights);
 		bool SaveBufferToImage() const;
 
 		void CycleLightingMode();
 		void ToggleShadows()
 		{
 			m_ShadowsEnabled = !m_ShadowsEnabled;
+			m_HistoryValid = false;
+			m_IsPreviousFrameComplete = false;
 		}
 		void ToggleReflections()
 		{
 			m_ReflectionsEnabled = !m_ReflectionsEnabled;
+			m_HistoryValid = false;
+			m_IsPreviousFrameComplete = false;
+		}
+		void TogglePathTracing()
+		{
+			m_PathTracingEnabled = !m_PathTracingEnabled;
+			m_HistoryValid = false;
+			m_IsPreviousFrameComplete = false;
+		}
+		void ToggleDenoiser()
+		{
+			m_DenoiserEnabled = !m_DenoiserEnabled;
+		}
+		void ToggleTemporalReuse()
+		{
+			m_TemporalReuseEnabled = !m_TemporalReuseEnabled;
+			m_HistoryValid = false;
+			m_IsPreviousFrameComplete = false;
+		}
+		//Primary hits from the rasterizer instead of ray tracing, the G-buffer is filled again either way
+		void ToggleRasterization()
+		{
+			m_RasterizationEnabled = !m_RasterizationEnabled;
+			++m_GBufferVersion;
+		}
+		//After switching scenes, a new scene can be at the old one's address and starts its versions over
+		void ResetHistory()
+		{
+			m_HistoryValid = false;
+			m_IsPreviousFrameComplete = false;
+			++m_GBufferVersion;
+			m_pGBufferScene = nullptr;
+		}
+		void ToggleIncrementalRendering()
+		{
+			m_IncrementalRenderingEnabled = !m_IncrementalRenderingEnabled;
+		}
+		void ToggleDynamicResolution()
+		{
+			m_DynamicResolutionEnabled = !m_DynamicResolutionEnabled;
+			m_AverageFrameTime = 0.f;
+			m_ResolutionFrames = 0;
+		}
+		//Cycles between shading every pixel, half of them (checkerboard) and a quarter of them per frame
+		void CycleInterleaving()
+		{
+			m_InterleaveFactor = m_InterleaveFactor >= 4 ? 1 : m_InterleaveFactor * 2;
+		}
+		//Tiles still waiting when the budget (in seconds, 0 for none) runs out keep the last frame and are rendered first next frame
+		void SetFrameBudget(float frameBudget)
+		{
+			m_FrameBudget = frameBudget;
+		}
+		void ToggleFrameBudget()
+		{
+			m_FrameBudget = m_FrameBudget > 0.f ? 0.f : m_TargetFrameTime;
+		}
+		//Largest contribution a single bounced path can add, 0 (the default) keeps the path tracer unbiased
+		void SetIndirectClamp(float indirectClamp)
+		{
+			m_IndirectClamp = indirectClamp;
+		}
+		//Frame time the dynamic resolution aims for, in seconds
+		void SetTargetFrameTime(float targetFrameTime)
+		{
+			m_TargetFrameTime = targetFrameTime;
 		}
 
 	private:
@@ -46,11 +128,62 @@ namespace dae
 		SDL_Surface* m_pBuffer{};
 		uint32_t* m_pBufferPixels{};
 
+		//Window size
 		int m_Width{};
 		int m_Height{};
-		int m_NumBounces{10};
+
+		//Internal resolution, scaled to hold the target frame time and upscaled when presenting
+		int m_RenderWidth{};
+		int m_RenderHeight{};
+		bool m_DynamicResolutionEnabled{ false };
+		float m_ResolutionScale{ 1.f };
+		float m_MinResolutionScale{ 0.25f };
+		float m_TargetFrameTime{ 1.f / 30.f };
+		float m_AverageFrameTime{};
+		float m_ResolutionTolerance{ 0.15f }; //Frame times this close to the target (relative) keep the resolution
+		uint32_t m_MinResolutionFrames{ 30 }; //Frames between resolution changes, every change drops the history
+		uint32_t m_ResolutionFrames{}; //Frames since the last change
+
+		//Interleaved rendering, only 1 in m_InterleaveFactor pixels is shaded per frame, the others are reprojected or filled in
+		uint32_t m_InterleaveFactor{ 1 }; //1 (off), 2 (checkerboard) or 4
+		float m_InterleaveDepthTolerance{ 0.05f }; //Relative depth difference of neighbours used to fill in a pixel
+
+		int m_NumBounces{10}; //Hard cap, paths normally stop on throughput first
+
+		//Path termination
+		float m_ReflectionFalloff{ 0.7f }; //Energy kept per reflection bounce, on top of the material reflectivity
+		float m_MinContribution{ 1.f / 255.f }; //Paths with less throughput are dropped, in the Whitted modes only
+		float m_RouletteThreshold{ 0.05f }; //Path traced paths with less throughput survive with probability throughput / threshold
+		int m_RouletteStartBounce{ 2 };
+
+		//Path tracing
+		uint32_t m_PathSamplesPerPixel{ 2 };
+		int m_MaxPathLength{ 8 };
+		float m_IndirectClamp{}; //Caps what a single bounced path adds (diffuse >> glossy >> light caustics), trades a little energy for no fireflies. 0 is off
+		uint32_t m_NumLightSamples{ 4 }; //Shadow rays per hit once there are too many lights to shade all of them
+		uint32_t m_MaxShadedLights{ 16 }; //The deterministic modes shade every light up to this many, beyond that they take m_NumLightSamples samples
+		uint32_t m_FrameIndex{};
 		float m_AspectRatio{};
 
+		//Screen tiles, every tile shades with the lights that can reach its primary hits
+		static constexpr int TileSize{ 16 };
+		static_assert(TileSize <= Rasterizer::MaxTileSize && TileSize % 8 == 0, "The rasterizer works on whole tiles, 8 pixels at a time");
+		int m_NumTilesX{};
+		int m_NumTilesY{};
+		std::vector<TileLightList> m_TileLights{};
+
+		//Tile scheduling, rendered in priority order within the frame budget
+		static constexpr uint32_t TileNeverRendered{ 0xFFFF };
+		float m_FrameBudget{}; //Seconds, 0 renders every tile
+		float m_TileChangeWeight{ 8.f }; //Priority per unit of mean luminance change (motion, lighting changes, noise)
+		float m_TileCenterWeight{ 0.5f }; //Priority of the screen center over the corners
+		std::vector<uint32_t> m_TileOrder{};
+		std::vector<float> m_TileChange{};
+		std::vector<uint32_t> m_TileAge{}; //Frames since the tile was last rendered
+		std::vector<char> m_TileRendered{}; //Written concurrently, so no vector<bool>
+		static constexpr char TileUnchanged{ 2 }; //m_TileRendered of tiles the moving meshes don't reach, last frame is still right
+		std::vector<uint32_t> m_AllLightIndices{};
+
 		enum class LightingMode
 		{
 			ObservedArea, // Lambert Cosine Law
@@ -62,10 +195,108 @@ namespace dae
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 		bool m_ShadowsEnabled{ true };
 		bool m_ReflectionsEnabled{ true };
+		bool m_PathTracingEnabled{ false };
+		bool m_DenoiserEnabled{ true }; //Path tracing only
+
+		//Linear frame and the primary hit guides (AOVs) the denoiser filters with
+		std::vector<ColorRGB> m_ColorBuffer{};
+		std::vector<ColorRGB> m_AlbedoBuffer{};
+		std::vector<Vector3> m_NormalBuffer{};
+		std::vector<float> m_DepthBuffer{};
+		Denoiser m_Denoiser{};
+		std::vector<ColorRGB> m_DenoisedBuffer{}; //Shown instead of the color buffer, which keeps the raw radiance for the history
+
+		//First hits of the primary rays, tile by tile (TileSize * TileSize each). Tiles reuse theirs instead of tracing while
+		//the camera and the geometry hold still, so changing lights, materials or the lighting mode only costs the shading
+		std::vector<HitRecord> m_GBuffer{};
+		std::vector<uint32_t> m_TileGBufferVersion{}; //Valid when equal to m_GBufferVersion
+		uint32_t m_GBufferVersion{ 1 }; //Bumped whenever visibility may have changed
+		const Scene* m_pGBufferScene{ nullptr };
+		Matrix m_GBufferCameraToWorld{};
+		float m_GBufferFov{};
+		uint32_t m_GBufferGeometryVersion{};
+
+		//Threads of the ASYNC path, started with its first frame
+		WorkerPool* m_pWorkerPool{ nullptr };
+
+		//Hybrid mode, primary visibility is rasterized and everything after the first hit is ray traced
+		Rasterizer m_Rasterizer{};
+		bool m_RasterizationEnabled{ false };
+
+		//Incremental frames, when only known meshes moved (Scene::MarkMeshChanged) under a still camera, just the tiles that see them
+		//(directly or in a shadow or reflection) are rendered again
+		bool m_IncrementalRenderingEnabled{ true };
+		bool m_IsIncrementalFrame{ false };
+		bool m_IsPreviousFrameComplete{ false }; //Last frame was rendered, and no mode was toggled since. Independent of temporal reuse
+		std::vector<Bounds> m_ChangedBounds{}; //Old and new bounds of the meshes that moved this frame
+
+		//Temporal reuse, the previous frame is reprojected into the current one
+		struct HistoryPixel
+		{
+			ColorRGB color{}; //Before denoising
+			Vector3 position{};
+			Vector3 normal{};
+			uint16_t age{}; //Frames the shading has been reused (or accumulated) for
+			unsigned char materialIndex{};
+			bool isValid{ false };
+		};
+
+		std::vector<HistoryPixel> m_History[2]{};
+		int m_CurrentHistory{};
+		Matrix m_PreviousCameraToWorld{};
+		float m_PreviousFov{};
+		bool m_HistoryValid{ false };
+		bool m_ReuseShading{ false };
+		uint32_t m_PreviousGeometryVersion{};
+		uint32_t m_PreviousShadingVersion{};
+		bool m_TemporalReuseEnabled{ false };
+		uint32_t m_MaxHistoryAge{ 8 }; //Reused shading is refreshed after 4 to 8 frames
+		float m_HistoryPositionTolerance{ 0.01f }; //Relative to the hit distance
+		float m_HistoryViewCosine{ 0.9995f }; //View direction change tolerated by the deterministic modes (~1.8 degrees)
+		float m_MinHistoryBlend{ 0.1f }; //Weight of the new path traced frame once the history is long
 
 		//
 
 		float GetLambertCosine(const dae::Vector3& normal, const dae::Vector3& lightDirection) const;
+		Ray GetPrimaryRay(int px, int py, float fov, float aspectRatio, const Camera& camera, RayDifferential& rayDifferential) const;
+		void SetRenderResolution(int width, int height);
+		void UpdateResolutionScale(float frameTime);
+		//Converts (and upscales) the color buffer into the window surface
+		void Present(const std::vector<ColorRGB>& colorBuffer);
+		void WritePixel(uint32_t pixelIndex, ColorRGB finalColor) const;
+		//Bilinear fetch of the previous frame where it shows the same surface, false for disocclusions
+		bool ReprojectHistory(const HitRecord& hitRecord, const Camera& camera, ColorRGB& color, uint16_t& age) const;
+		uint16_t GetHistoryRefreshAge(uint32_t pixelIndex) const;
+		//Starts a new G-buffer version when the camera, the geometry or the scene differ from the cached hits
+		void UpdateGBufferVersion(const Scene* pScene, const Camera& camera);
+		//Whether the moved meshes can change the tile, through its primary hits, their shadow rays or their reflections
+		bool IsTileAffected(uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		void SortTilesByPriority();
+		void CopyTileHistory(uint32_t tileIndex);
+		//Fills in the disoccluded pixels the interleave pattern skipped
+		void ReconstructTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+			const HitRecord* primaryHits, const bool* isReconstructed, const TileLightList& tileLights);
+		//Whether the interleave pattern shades the pixel this frame
+		bool IsPixelTraced(int px, int py) const;
+		//Picks one point light of the tile proportional to its estimated contribution, false if the tile has none
+		static bool SampleTileLight(const TileLightList& tileLights, float u, uint32_t& lightIndex, float& pmf);
+		//Applies the termination policy to the throughput of the next bounce, false if the path stops
+		bool ContinuePath(float& throughput, int bounce, float u) const;
+
+		//Path tracing, lights and materials are both sampled and combined with multiple importance sampling
+		ColorRGB TracePath(const Scene* pScene, const Ray& primaryRay, const HitRecord& primaryHit, const std::vector<Light>& lights, const std::vector<Material*>& materials,
+			LowDiscrepancySampler& sequence) const;
+		ColorRGB SampleDirectLight(const Scene* pScene, const std::vector<Light>& lights, const HitRecord& hitRecord, const Vector3& viewDirection, Material* pMaterial,
+			LowDiscrepancySampler& sequence) const;
+		//Light sample weighted against material sampling, selectionDensity is the expected number of times the light is picked
+		ColorRGB SampleLight(const Scene* pScene, const Light& light, float selectionDensity, const HitRecord& hitRecord, const Vector3& viewDirection, Material* pMaterial,
+			const Vector2& u) const;
+		float GetLightSelectionDensity(const Scene* pScene, const std::vector<Light>& lights, uint32_t lightIndex, const Vector3& origin, const Vector3& normal) const;
+		static bool HitSphereLights(const Scene* pScene, const std::vector<Light>& lights, const Ray& ray, float& distance, uint32_t& lightIndex);
+		ColorRGB ClampIndirect(const ColorRGB& contribution) const;
+		static float PowerHeuristic(float pdf, float otherPdf);
+		//Shadowed contribution of a single light for the current lighting mode
+		ColorRGB ShadeLight(const Scene* pScene, const Light& light, const HitRecord& hitRecord, const Vector3& viewDirection, const std::vector<Material*>& materials) const;
 
 
 	};
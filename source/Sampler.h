@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+
+#include "Vector2.h"
+
+namespace dae
+{
+	/**
+	 * \brief Small per-pixel random number generator (PCG32), seeded from the pixel and frame so every pixel gets its own sequence
+	 */
+	class Sampler final
+	{
+	public:
+		Sampler(uint32_t pixelIndex, uint32_t frameIndex)
+		{
+			m_State = 0u;
+			m_Increment = (static_cast<uint64_t>(Hash(pixelIndex)) << 1u) | 1u;
+			NextUInt();
+			m_State += Hash(frameIndex ^ 0x9E3779B9u);
+			NextUInt();
+		}
+
+		uint32_t NextUInt()
+		{
+			const uint64_t oldState{ m_State };
+			m_State = oldState * 6364136223846793005ull + m_Increment;
+			const uint32_t xorShifted{ static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u) };
+			const uint32_t rot{ static_cast<uint32_t>(oldState >> 59u) };
+			return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31u));
+		}
+
+		//Uniform in [0, 1)
+		float NextFloat()
+		{
+			return static_cast<float>(NextUInt() >> 8) * (1.f / 16777216.f);
+		}
+
+		static uint32_t Hash(uint32_t x)
+		{
+			x ^= x >> 16;
+			x *= 0x7FEB352Du;
+			x ^= x >> 15;
+			x *= 0x846CA68Bu;
+			x ^= x >> 16;
+			return x;
+		}
+
+	private:
+		uint64_t m_State{};
+		uint64_t m_Increment{};
+	};
+
+	/**
+	 * \brief Owen scrambled Sobol points (Burley 2020, hash based nested uniform scrambling).
+	 * Every pixel gets its own scramble so the error is decorrelated between pixels, consecutive sample indices of one pixel stay stratified.
+	 * Each Next2D call moves to a new, independently scrambled, pair of dimensions.
+	 */
+	class LowDiscrepancySampler final
+	{
+	public:
+		LowDiscrepancySampler(uint32_t pixelIndex, uint32_t sampleIndex) :
+			m_Seed(Sampler::Hash(pixelIndex ^ 0x68E31DA4u)),
+			m_SampleIndex(sampleIndex)
+		{
+		}
+
+		//Uniform in [0, 1)^2
+		Vector2 Next2D()
+		{
+			const uint32_t seed{ Sampler::Hash(m_Seed ^ Sampler::Hash(m_Dimension++)) };
+
+			//Shuffle the order of the points, then scramble their digits
+			const uint32_t index{ NestedUniformScramble(m_SampleIndex, seed) };
+			const uint32_t x{ NestedUniformScramble(Sobol0(index), Sampler::Hash(seed ^ 0xA511E9B3u)) };
+			const uint32_t y{ NestedUniformScramble(Sobol1(index), Sampler::Hash(seed ^ 0x63D83595u)) };
+
+			return { static_cast<float>(x >> 8) * (1.f / 16777216.f), static_cast<float>(y >> 8) * (1.f / 16777216.f) };
+		}
+
+	private:
+		uint32_t m_Seed{};
+		uint32_t m_SampleIndex{};
+		uint32_t m_Dimension{};
+
+		static uint32_t ReverseBits(uint32_t x)
+		{
+			x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+			x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+			x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+			x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+			return (x >> 16) | (x << 16);
+		}
+
+		//First Sobol dimension, van der Corput
+		static uint32_t Sobol0(uint32_t index)
+		{
+			return ReverseBits(index);
+		}
+
+		//Second Sobol dimension
+		static uint32_t Sobol1(uint32_t index)
+		{
+			uint32_t result{};
+			for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+			{
+				if (index & 1u)
+					result ^= v;
+			}
+			return result;
+		}
+
+		//Laine-Karras style hash, every bit only depends on the bits below it
+		static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed)
+		{
+			x += seed;
+			x ^= x * 0x6C50B47Cu;
+			x ^= x * 0xB82F1E52u;
+			x ^= x * 0xC7AFE638u;
+			x ^= x * 0x8D22F6E6u;
+			return x;
+		}
+
+		static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+		{
+			return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+		}
+	};
+}
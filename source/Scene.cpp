@@ -2,93 +2,232 @@
 #include "Utils.h"
 #include "Material.h"
 
+#include <algorithm>
+#include <numeric>
+#include <ppl.h> // parallel_for
+#include <random>
+
 namespace dae {
 
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
-	Scene::Scene():
-		m_Materials({ new Material_SolidColor({1,0,0})})
+	Scene::Scene()
 	{
+		AddMaterial<Material_SolidColor>(ColorRGB{ 1, 0, 0 });
+
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
+		m_InstancedMeshes.reserve(32);
 		m_Lights.reserve(32);
 	}
 
 	Scene::~Scene()
 	{
+		//The storage goes with m_MaterialBlocks
 		for(auto& pMaterial : m_Materials)
 		{
-			delete pMaterial;
+			pMaterial->~Material();
 			pMaterial = nullptr;
 		}
 
 		m_Materials.clear();
+
+		for (auto& pTexture : m_Textures)
+		{
+			delete pTexture;
+			pTexture = nullptr;
+		}
+
+		m_Textures.clear();
 	}
 
 	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
 	{
-		HitRecord hit{};
-		for (const auto& i : m_PlaneGeometries)
+		//Only the nearest distance and which primitive it belongs to are tracked, the attributes are computed once at the end
+		float t{};
+		for (uint32_t i = 0; i < m_PlaneGeometries.size(); ++i)
 		{
-			if (GeometryUtils::HitTest_Plane(i, ray, hit))
+			if (GeometryUtils::HitDistance_Plane(m_PlaneGeometries[i], ray, t) && t < closestHit.t)
 			{
-				if (hit.t < closestHit.t)
-				{
-					closestHit = hit;
-				}
+				closestHit.t = t;
+				closestHit.primitiveIndex = i;
+				closestHit.geometry = HitGeometry::Plane;
 			}
 		}
 
 		//..
 
-		for (const auto &i : m_SphereGeometries)
-		{
-			// use the new hit for the intersection.
-			if (GeometryUtils::HitTest_Sphere(i, ray, hit))
+		const auto hitSphere = [&](uint32_t i)
 			{
-				if (hit.t < closestHit.t)
+				if (GeometryUtils::HitDistance_Sphere(m_SphereGeometries[i], ray, t) && t < closestHit.t)
 				{
-					closestHit = hit;
+					closestHit.t = t;
+					closestHit.primitiveIndex = i;
+					closestHit.geometry = HitGeometry::Sphere;
 				}
-			}	
+				return false;
+			};
+		if (m_ObjectBVHsDirty)
+		{
+			for (uint32_t i = 0; i < m_SphereGeometries.size(); ++i)
+			{
+				hitSphere(i);
+			}
+		}
+		else
+		{
+			m_SphereBVH.Intersect(ray, closestHit.t, hitSphere);
 		}
 
 		//..
 
 		//}
 
-		for (const auto& i : m_TriangleMeshGeometries)
+		//Both only overwrite closestHit when closer
+		const bool useBVHs{ m_TriangleMeshBVHs.size() == m_TriangleMeshGeometries.size() };
+		for (size_t i = 0; i < m_TriangleMeshGeometries.size(); ++i)
 		{
-			// use the new hit for the intersection.
-			if (GeometryUtils::HitTest_TriangleMesh(i, ray, hit))
+			if (useBVHs)
 			{
-				if (hit.t < closestHit.t)
-				{
-					closestHit = hit;
-				}
+				m_TriangleMeshBVHs[i].Intersect(m_TriangleMeshGeometries[i], ray, closestHit, false, m_TriangleKernel);
+			}
+			else
+			{
+				GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, closestHit, false, m_TriangleKernel);
 			}
 		}
-		
+
+		//Last, a later hit of a plain mesh would leave pInstance set
+		const auto hitInstance = [&](uint32_t i)
+			{
+				IntersectInstance(i, ray, closestHit, false);
+				return false;
+			};
+		if (m_ObjectBVHsDirty)
+		{
+			for (uint32_t i = 0; i < m_MeshInstances.size(); ++i)
+			{
+				hitInstance(i);
+			}
+		}
+		else
+		{
+			m_InstanceBVH.Intersect(ray, closestHit.t, hitInstance);
+		}
+
+		FinalizeHit(ray, closestHit);
+	}
+
+	bool Scene::IntersectInstance(uint32_t instanceIndex, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord) const
+	{
+		const MeshInstance& instance = m_MeshInstances[instanceIndex];
+		const TriangleMesh& mesh = m_InstancedMeshes[instance.meshIndex];
+
+		//The direction isn't renormalized, so distances along the local ray are the same as along the world ray
+		Ray localRay{ instance.worldToObject.TransformPoint(ray.origin), instance.worldToObject.TransformVector(ray.GetDirection()) };
+		localRay.min = ray.min;
+		localRay.max = ray.max;
+
+		const bool didHit{ instance.meshIndex < m_InstancedMeshBVHs.size()
+			? m_InstancedMeshBVHs[instance.meshIndex].Intersect(mesh, localRay, hitRecord, ignoreHitRecord, m_TriangleKernel)
+			: GeometryUtils::HitTest_TriangleMesh(mesh, localRay, hitRecord, ignoreHitRecord, m_TriangleKernel) };
+		if (didHit && !ignoreHitRecord)
+		{
+			hitRecord.pInstance = &instance;
+		}
+		return didHit;
+	}
+
+	void Scene::FinalizeHit(const Ray& ray, HitRecord& hitRecord) const
+	{
+		hitRecord.didHit = hitRecord.geometry != HitGeometry::None;
+		if (!hitRecord.didHit)
+			return;
+
+		hitRecord.origin = ray.origin + hitRecord.t * ray.GetDirection();
+		switch (hitRecord.geometry)
+		{
+		case HitGeometry::Plane:
+		{
+			const Plane& plane = m_PlaneGeometries[hitRecord.primitiveIndex];
+			hitRecord.normal = plane.normal;
+			hitRecord.geometricNormal = plane.normal;
+			hitRecord.materialIndex = plane.materialIndex;
+			break;
+		}
+		case HitGeometry::Sphere:
+		{
+			const Sphere& sphere = m_SphereGeometries[hitRecord.primitiveIndex];
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+			hitRecord.geometricNormal = hitRecord.normal;
+			hitRecord.materialIndex = sphere.materialIndex;
+			break;
+		}
+		case HitGeometry::Triangle:
+			hitRecord.materialIndex = hitRecord.pMesh->materialIndex;
+			hitRecord.geometricNormal = hitRecord.pMesh->GetTransformedNormal(hitRecord.primitiveIndex);
+			//Smooth shading normal and uv
+			GeometryUtils::InterpolateHitAttributes(hitRecord);
+			//Instanced meshes are in object space
+			if (hitRecord.pInstance)
+			{
+				const MeshInstance& instance = *hitRecord.pInstance;
+				hitRecord.materialIndex = instance.materialIndex;
+				hitRecord.geometricNormal = instance.normalToWorld.TransformVector(hitRecord.geometricNormal).Normalized();
+				hitRecord.normal = instance.normalToWorld.TransformVector(hitRecord.normal).Normalized();
+			}
+			break;
+		case HitGeometry::None:
+			break;
+		}
 	}
 
 	bool Scene::DoesHit(const Ray& ray) const
 	{
 		HitRecord tempHitRecord{};
 
-		for (const auto& i : m_SphereGeometries)
+		const auto hitSphere = [&](uint32_t i)
+			{
+				return GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray, tempHitRecord, true);
+			};
+		const auto hitInstance = [&](uint32_t i)
+			{
+				return IntersectInstance(i, ray, tempHitRecord, true);
+			};
+		if (!m_ObjectBVHsDirty)
 		{
-			if (GeometryUtils::HitTest_Sphere(i, ray, tempHitRecord, true))
+			if (m_SphereBVH.Intersect(ray, ray.max, hitSphere) || m_InstanceBVH.Intersect(ray, ray.max, hitInstance))
 			{
 				return true;
 			}
 		}
+		else
+		{
+			for (uint32_t i = 0; i < m_SphereGeometries.size(); ++i)
+			{
+				if (hitSphere(i))
+				{
+					return true;
+				}
+			}
+			for (uint32_t i = 0; i < m_MeshInstances.size(); ++i)
+			{
+				if (hitInstance(i))
+				{
+					return true;
+				}
+			}
+		}
 
 		//..
 
-		for (const auto& i : m_TriangleMeshGeometries)
+		const bool useBVHs{ m_TriangleMeshBVHs.size() == m_TriangleMeshGeometries.size() };
+		for (size_t i = 0; i < m_TriangleMeshGeometries.size(); ++i)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(i, ray, tempHitRecord, true))
+			const bool didHit{ useBVHs ? m_TriangleMeshBVHs[i].Intersect(m_TriangleMeshGeometries[i], ray, tempHitRecord, true, m_TriangleKernel)
+				: GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, tempHitRecord, true, m_TriangleKernel) };
+			if (didHit)
 			{
 				return true;
 			}
@@ -98,6 +237,119 @@ namespace dae {
 
 	}
 
+	void Scene::UpdateLightBVH()
+	{
+		if (!m_LightBVHDirty)
+			return;
+
+		m_LightBVH.Build(m_Lights);
+
+		std::vector<Bounds> sphereLightBounds{};
+		m_SphereLightIndices.clear();
+		for (uint32_t i = 0; i < m_Lights.size(); ++i)
+		{
+			const Light& light = m_Lights[i];
+			if (light.type == LightType::Point && light.radius > 0.f)
+			{
+				const Vector3 radius{ light.radius, light.radius, light.radius };
+				sphereLightBounds.push_back({ light.origin - radius, light.origin + radius });
+				m_SphereLightIndices.push_back(i);
+			}
+		}
+		m_SphereLightBVH.Build(sphereLightBounds);
+		m_LightBVHDirty = false;
+	}
+
+	void Scene::UpdateAccelerationStructures()
+	{
+		//Instanced meshes never move, only new ones are built
+		const uint32_t numInstancedBuilt{ static_cast<uint32_t>(m_InstancedMeshBVHs.size()) };
+		const uint32_t numInstancedMeshes{ static_cast<uint32_t>(m_InstancedMeshes.size()) };
+		if (numInstancedBuilt < numInstancedMeshes)
+		{
+			m_InstancedMeshBVHs.resize(numInstancedMeshes);
+			concurrency::parallel_for(numInstancedBuilt, numInstancedMeshes, [this](uint32_t i)
+				{
+					m_InstancedMeshBVHs[i].Build(m_InstancedMeshes[i], m_StaticBVHBuildMethod);
+				});
+		}
+
+		if (m_ObjectBVHsDirty)
+		{
+			std::vector<Bounds> objectBounds(m_SphereGeometries.size());
+			for (size_t i = 0; i < m_SphereGeometries.size(); ++i)
+			{
+				const Vector3 radius{ m_SphereGeometries[i].radius, m_SphereGeometries[i].radius, m_SphereGeometries[i].radius };
+				objectBounds[i] = { m_SphereGeometries[i].origin - radius, m_SphereGeometries[i].origin + radius };
+			}
+			m_SphereBVH.Build(objectBounds);
+
+			objectBounds.resize(m_MeshInstances.size());
+			for (size_t i = 0; i < m_MeshInstances.size(); ++i)
+			{
+				objectBounds[i] = { m_MeshInstances[i].boundsMin, m_MeshInstances[i].boundsMax };
+			}
+			m_InstanceBVH.Build(objectBounds);
+			m_ObjectBVHsDirty = false;
+		}
+
+		//Unknown changes, every tree may be stale
+		const uint32_t numBuilt{ static_cast<uint32_t>(m_TriangleMeshBVHs.size()) };
+		const uint32_t numMeshes{ static_cast<uint32_t>(m_TriangleMeshGeometries.size()) };
+		if (m_AllMeshBVHsStale)
+		{
+			m_StaleMeshBVHs.resize(numBuilt);
+			std::iota(m_StaleMeshBVHs.begin(), m_StaleMeshBVHs.end(), 0u);
+			m_AllMeshBVHsStale = false;
+		}
+
+		const uint32_t numStale{ static_cast<uint32_t>(m_StaleMeshBVHs.size()) };
+		if (numStale == 0 && numBuilt == numMeshes)
+			return;
+
+		//New meshes get the tighter SAH tree (or spatial splits when the scene asks for them), the others keep theirs.
+		//Only the meshes that moved are rebuilt, that can happen every frame so those use the Morton build
+		m_TriangleMeshBVHs.resize(numMeshes);
+		concurrency::parallel_for(0u, numStale + numMeshes - numBuilt, [this, numBuilt, numStale](uint32_t i)
+			{
+				if (i >= numStale)
+				{
+					const uint32_t meshIndex{ numBuilt + i - numStale };
+					m_TriangleMeshBVHs[meshIndex].Build(m_TriangleMeshGeometries[meshIndex], m_StaticBVHBuildMethod);
+				}
+				else if (m_StaleMeshBVHs[i] < numBuilt)
+				{
+					m_TriangleMeshBVHs[m_StaleMeshBVHs[i]].Build(m_TriangleMeshGeometries[m_StaleMeshBVHs[i]], BVHBuildMethod::MortonLBVH);
+				}
+			});
+		m_StaleMeshBVHs.clear();
+	}
+
+	bool Scene::TakeChangedBounds(std::vector<Bounds>& changedBounds)
+	{
+		changedBounds.clear();
+		const bool isLocalized{ !m_HasUnknownChanges && m_MeshBounds.size() == m_TriangleMeshGeometries.size() };
+		if (isLocalized)
+		{
+			for (const uint32_t meshIndex : m_ChangedMeshes)
+			{
+				const TriangleMesh& mesh = m_TriangleMeshGeometries[meshIndex];
+				changedBounds.push_back(m_MeshBounds[meshIndex]);
+				changedBounds.push_back({ mesh.transformedMinAABB, mesh.transformedMaxAABB });
+			}
+		}
+
+		m_MeshBounds.resize(m_TriangleMeshGeometries.size());
+		for (size_t i = 0; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			m_MeshBounds[i] = { m_TriangleMeshGeometries[i].transformedMinAABB, m_TriangleMeshGeometries[i].transformedMaxAABB };
+		}
+		m_ChangedMeshes.clear();
+		m_HasUnknownChanges = false;
+
+		return isLocalized;
+	}
+
 #pragma region Scene Helpers
 	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
 	{
@@ -107,6 +359,7 @@ namespace dae {
 		s.materialIndex = materialIndex;
 
 		m_SphereGeometries.emplace_back(s);
+		m_ObjectBVHsDirty = true;
 		return &m_SphereGeometries.back();
 	}
 
@@ -131,15 +384,83 @@ namespace dae {
 		return &m_TriangleMeshGeometries.back();
 	}
 
-	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
+	TriangleMesh* Scene::AddInstancedMesh(TriangleCullMode cullMode)
+	{
+		TriangleMesh m{};
+		m.cullMode = cullMode;
+
+		m_InstancedMeshes.emplace_back(m);
+		return &m_InstancedMeshes.back();
+	}
+
+	void Scene::AddMeshInstance(const TriangleMesh* pMesh, const Matrix& objectToWorld, unsigned char materialIndex)
+	{
+		MeshInstance instance{};
+		instance.meshIndex = static_cast<uint32_t>(pMesh - m_InstancedMeshes.data());
+		instance.materialIndex = materialIndex;
+		instance.objectToWorld = objectToWorld;
+		instance.worldToObject = Matrix::InverseAffine(objectToWorld);
+		instance.normalToWorld = Matrix::Transpose(instance.worldToObject);
+
+		//Box around the transformed corners of the mesh box
+		instance.boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+		instance.boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const Vector3 point{ objectToWorld.TransformPoint(
+				(corner & 1) ? pMesh->maxAABB.x : pMesh->minAABB.x,
+				(corner & 2) ? pMesh->maxAABB.y : pMesh->minAABB.y,
+				(corner & 4) ? pMesh->maxAABB.z : pMesh->minAABB.z) };
+			instance.boundsMin = Vector3::Min(instance.boundsMin, point);
+			instance.boundsMax = Vector3::Max(instance.boundsMax, point);
+		}
+
+		m_MeshInstances.emplace_back(instance);
+		m_ObjectBVHsDirty = true;
+	}
+
+	void Scene::MarkMeshChanged(const TriangleMesh* pMesh)
+	{
+		++m_GeometryVersion;
+
+		const uint32_t meshIndex{ static_cast<uint32_t>(pMesh - m_TriangleMeshGeometries.data()) };
+		if (std::find(m_ChangedMeshes.begin(), m_ChangedMeshes.end(), meshIndex) == m_ChangedMeshes.end())
+		{
+			m_ChangedMeshes.push_back(meshIndex);
+		}
+		if (std::find(m_StaleMeshBVHs.begin(), m_StaleMeshBVHs.end(), meshIndex) == m_StaleMeshBVHs.end())
+		{
+			m_StaleMeshBVHs.push_back(meshIndex);
+		}
+	}
+
+	void Scene::MarkLightsChanged()
+	{
+		++m_ShadingVersion;
+		m_LightBVHDirty = true;
+
+		for (Light& light : m_Lights)
+		{
+			if (light.type == LightType::Point)
+			{
+				light.range = LightUtils::GetLightRange(light);
+			}
+		}
+	}
+
+	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color, float radius)
 	{
 		Light l;
 		l.origin = origin;
 		l.intensity = intensity;
 		l.color = color;
+		l.radius = radius;
 		l.type = LightType::Point;
+		l.range = LightUtils::GetLightRange(l);
 
 		m_Lights.emplace_back(l);
+		m_LightBVHDirty = true;
+		++m_ShadingVersion;
 		return &m_Lights.back();
 	}
 
@@ -152,14 +473,51 @@ namespace dae {
 		l.type = LightType::Directional;
 
 		m_Lights.emplace_back(l);
+		m_LightBVHDirty = true;
+		++m_ShadingVersion;
 		return &m_Lights.back();
 	}
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	void* Scene::AllocateMaterial(size_t size, size_t alignment)
+	{
+		assert(size <= MaterialBlockSize && alignment <= alignof(std::max_align_t));
+
+		m_MaterialBlockOffset = (m_MaterialBlockOffset + alignment - 1) & ~(alignment - 1);
+		if (m_MaterialBlockOffset + size > MaterialBlockSize)
+		{
+			m_MaterialBlocks.push_back(std::make_unique<std::byte[]>(MaterialBlockSize));
+			m_MaterialBlockOffset = 0;
+		}
+
+		void* pStorage{ m_MaterialBlocks.back().get() + m_MaterialBlockOffset };
+		m_MaterialBlockOffset += size;
+		return pStorage;
+	}
+
+	unsigned char Scene::RegisterMaterial(Material* pMaterial)
 	{
 		m_Materials.push_back(pMaterial);
+		++m_ShadingVersion;
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
+
+	const Texture* Scene::AddTexture(const std::string& path, bool isSRGB)
+	{
+		Texture* pTexture{ Texture::LoadFromFile(path, isSRGB, &m_TextureCache) };
+		if (!pTexture)
+		{
+			return nullptr;
+		}
+
+		m_Textures.push_back(pTexture);
+		return pTexture;
+	}
+
+	const Texture* Scene::AddTexture(uint32_t width, uint32_t height, const std::vector<uint32_t>& texels, bool isSRGB)
+	{
+		m_Textures.push_back(new Texture(width, height, texels, isSRGB, &m_TextureCache));
+		return m_Textures.back();
+	}
 #pragma endregion
 #pragma endregion
 
@@ -168,11 +526,11 @@ namespace dae {
 	{
 				//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Blue = AddMaterial<Material_SolidColor>(colors::Blue);
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Yellow = AddMaterial<Material_SolidColor>(colors::Yellow);
+		const unsigned char matId_Solid_Green = AddMaterial<Material_SolidColor>(colors::Green);
+		const unsigned char matId_Solid_Magenta = AddMaterial<Material_SolidColor>(colors::Magenta);
 
 		//Spheres
 		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
@@ -195,11 +553,11 @@ namespace dae {
 
 		//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Blue = AddMaterial<Material_SolidColor>(colors::Blue);
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Yellow = AddMaterial<Material_SolidColor>(colors::Yellow);
+		const unsigned char matId_Solid_Green = AddMaterial<Material_SolidColor>(colors::Green);
+		const unsigned char matId_Solid_Magenta = AddMaterial<Material_SolidColor>(colors::Magenta);
 
 		//Spheres
 		AddSphere({ -1.75f, 1.f, 0.f }, 0.75f, matId_Solid_Red);
@@ -228,14 +586,14 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.updateFovAngle(45.f);
 
-		const auto matCT_GreyRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
-		const auto matCT_GreyMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, .6f));
-		const auto matCT_GreySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, .1f));
-		const auto matCT_GreyRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f}, 0.0f, 1.f));
-		const auto matCT_GreyMediumPlastic = AddMaterial(new Material_CookTorrence({0.75f, 0.75f, 0.75f },0.0f, .6f));
-		const auto matCT_GreySmoothPlastic = AddMaterial(new Material_CookTorrence({0.75f, 0.75f, 0.75f },0.0f, .1f));
+		const auto matCT_GreyRoughMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, 1.f);
+		const auto matCT_GreyMediumMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, .6f);
+		const auto matCT_GreySmoothMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, .1f);
+		const auto matCT_GreyRoughPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f}, 0.0f, 1.f);
+		const auto matCT_GreyMediumPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f },0.0f, .6f);
+		const auto matCT_GreySmoothPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f },0.0f, .1f);
 
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
 
 		//Spheres
 		AddSphere({ -1.75f, 1.f, 0.f }, 0.75f, matCT_GreyRoughMetal);
@@ -268,8 +626,8 @@ namespace dae {
 		m_Camera.updateFovAngle(45.f);
 
 		//Materials
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_White = AddMaterial<Material_Lambert>(colors::White, 1.f);
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
@@ -304,6 +662,7 @@ namespace dae {
 
 		pMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
 		pMesh->UpdateTransforms();
+		MarkMeshChanged(pMesh);
 	}
 #pragma endregion
 
@@ -314,16 +673,19 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.updateFovAngle(45.f);
 
+		//New meshes are built with spatial splits, long thin triangles like these are where those pay off
+		m_StaticBVHBuildMethod = BVHBuildMethod::SpatialSplitSAH;
+
 		//Materials
-		const auto matCT_GreyRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
-		const auto matCT_GreyMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, .6f));
-		const auto matCT_GreySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, .1f));
-		const auto matCT_GreyRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.0f, 1.f));
-		const auto matCT_GreyMediumPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.0f, .6f));
-		const auto matCT_GreySmoothPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.0f, .1f));
+		const auto matCT_GreyRoughMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, 1.f);
+		const auto matCT_GreyMediumMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, .6f);
+		const auto matCT_GreySmoothMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, .1f);
+		const auto matCT_GreyRoughPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.0f, 1.f);
+		const auto matCT_GreyMediumPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.0f, .6f);
+		const auto matCT_GreySmoothPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.0f, .1f);
 
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_White = AddMaterial<Material_Lambert>(colors::White, 1.f);
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
@@ -364,10 +726,10 @@ namespace dae {
 		m_Meshes[2]->UpdateAABB();
 		m_Meshes[2]->UpdateTransforms();
 
-		//Light
-		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
-		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
-		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+		//Light (the radius only matters for path tracing)
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f }, 0.5f);
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f }, 0.5f);
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f }, 0.5f);
 
 	}
 	void Scene_W4_ReferenceScene::Update(Timer* pTimer)
@@ -378,6 +740,7 @@ namespace dae {
 		{
 			i->RotateY(PI_DIV_2 * pTimer->GetTotal());
 			i->UpdateTransforms();
+			MarkMeshChanged(i);
 		}
 
 		
@@ -392,8 +755,8 @@ namespace dae {
 
 		//Materials
 
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_White = AddMaterial<Material_Lambert>(colors::White, 1.f);
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
@@ -402,12 +765,21 @@ namespace dae {
 		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, matLambert_GreyBlue);
 		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matLambert_GreyBlue);
 		
-		//Mesh
+		//Mesh, closed, so no pixels should see through its shared edges
+		m_TriangleKernel = TriangleKernel::Watertight;
 		pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 		Utils::ParseOBJ("Resources/Lowpoly_bunny.obj",
 			pMesh->positions,
 			pMesh->normals,
-			pMesh->indices);
+			pMesh->indices,
+			pMesh->vertexNormals,
+			pMesh->uvs);
+
+		//Smooth shading
+		if (pMesh->vertexNormals.empty())
+		{
+			pMesh->CalculateVertexNormals();
+		}
 
 		pMesh->Scale({ 2.f, 2.f, 2.f });
 
@@ -426,8 +798,282 @@ namespace dae {
 
 		pMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
 		pMesh->UpdateTransforms();
+		MarkMeshChanged(pMesh);
 
 	}
 #pragma endregion
 
+
+#pragma region TEXTURE SCENE
+	namespace
+	{
+		uint32_t PackRGBA8(uint32_t r, uint32_t g, uint32_t b)
+		{
+			return std::min(r, 255u) | (std::min(g, 255u) << 8) | (std::min(b, 255u) << 16) | 0xFF000000;
+		}
+
+		//Checkerboard with some per texel noise, so the mip levels aren't just flat averages
+		std::vector<uint32_t> CreateCheckerTexels(uint32_t size, uint32_t numChecks, const ColorRGB& colorA, const ColorRGB& colorB, uint32_t seed)
+		{
+			std::mt19937 random{ seed };
+			std::uniform_int_distribution<int> noise{ -12, 12 };
+
+			std::vector<uint32_t> texels(size_t(size) * size);
+			const uint32_t checkSize{ std::max(size / numChecks, 1u) };
+			for (uint32_t y = 0; y < size; ++y)
+			{
+				for (uint32_t x = 0; x < size; ++x)
+				{
+					const ColorRGB& color = ((x / checkSize + y / checkSize) % 2 == 0) ? colorA : colorB;
+					const int n{ noise(random) };
+					texels[x + size_t(y) * size] = PackRGBA8(static_cast<uint32_t>(std::max(color.r * 255.f + n, 0.f)),
+						static_cast<uint32_t>(std::max(color.g * 255.f + n, 0.f)), static_cast<uint32_t>(std::max(color.b * 255.f + n, 0.f)));
+				}
+			}
+			return texels;
+		}
+
+		//Bands from smooth to rough, linear data in the red channel
+		std::vector<uint32_t> CreateRoughnessTexels(uint32_t size, uint32_t numBands)
+		{
+			std::vector<uint32_t> texels(size_t(size) * size);
+			for (uint32_t y = 0; y < size; ++y)
+			{
+				const float roughness{ 0.1f + 0.8f * static_cast<float>(y * numBands / size) / static_cast<float>(std::max(numBands - 1, 1u)) };
+				const uint32_t value{ static_cast<uint32_t>(roughness * 255.f) };
+				std::fill_n(texels.begin() + size_t(y) * size, size, PackRGBA8(value, value, value));
+			}
+			return texels;
+		}
+	}
+
+	void Scene_Textures::Initialize()
+	{
+		sceneName = "Texture Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.updateFovAngle(45.f);
+
+		//Textures, decoded the floor (and its mip levels) takes more than the cache keeps, tiles are streamed in as the view needs them
+		const Texture* pFloorMap{ AddTexture(1024, 1024, CreateCheckerTexels(1024, 32, { 0.8f, 0.78f, 0.72f }, { 0.25f, 0.27f, 0.3f }, 1)) };
+		const Texture* pPanelMap{ AddTexture(512, 512, CreateCheckerTexels(512, 8, { 0.9f, 0.45f, 0.2f }, { 0.2f, 0.4f, 0.8f }, 2)) };
+		const Texture* pRoughnessMap{ AddTexture(256, 256, CreateRoughnessTexels(256, 4), false) };
+
+		//Materials
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_Floor = AddMaterial<Material_Lambert>(colors::White, 1.f, pFloorMap);
+		const auto matCT_Panel = AddMaterial<Material_CookTorrence>(colors::White, 0.f, 1.f, pPanelMap, nullptr, pRoughnessMap);
+
+		//Walls, the floor is a mesh (planes have no texture coordinates)
+		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
+		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f, 0.f }, matLambert_GreyBlue);
+		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, matLambert_GreyBlue);
+		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matLambert_GreyBlue);
+
+		//Quad through four corners (counterclockwise seen from the front), the texture repeats uvScale times over it
+		const auto addQuad = [this](unsigned char materialIndex, const std::vector<Vector3>& corners, float uvScale)
+			{
+				TriangleMesh* pQuad = AddTriangleMesh(TriangleCullMode::NoCulling, materialIndex);
+				pQuad->positions = corners;
+				pQuad->uvs = { { 0.f, uvScale }, { uvScale, uvScale }, { uvScale, 0.f }, { 0.f, 0.f } };
+				pQuad->indices = { 0, 2, 1, 0, 3, 2 };
+				pQuad->CalculateNormals();
+				return pQuad;
+			};
+
+		TriangleMesh* pFloor = addQuad(matLambert_Floor, { { -1.f, 0.f, -1.f }, { 1.f, 0.f, -1.f }, { 1.f, 0.f, 1.f }, { -1.f, 0.f, 1.f } }, 2.f);
+		pFloor->Scale({ 5.f, 1.f, 20.f });
+		pFloor->Translate({ 0.f, 0.f, -5.f });
+		pFloor->UpdateAABB();
+		pFloor->UpdateTransforms();
+
+		//Upright, spins like the meshes of the other scenes
+		m_pPanel = addQuad(matCT_Panel, { { -1.f, -1.f, 0.f }, { 1.f, -1.f, 0.f }, { 1.f, 1.f, 0.f }, { -1.f, 1.f, 0.f } }, 1.f);
+		m_pPanel->Scale({ 1.5f, 1.5f, 1.f });
+		m_pPanel->Translate({ 0.f, 2.5f, 1.f });
+		m_pPanel->UpdateAABB();
+		m_pPanel->UpdateTransforms();
+
+		//Light
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+	}
+
+	void Scene_Textures::Update(Timer* pTimer)
+	{
+		Scene::Update(pTimer);
+
+		m_pPanel->RotateY(PI_DIV_4 * pTimer->GetTotal());
+		m_pPanel->UpdateTransforms();
+		MarkMeshChanged(m_pPanel);
+	}
+#pragma endregion
+
+#pragma region STRESS SCENE
+	namespace
+	{
+		//Subdivided icosahedron on the unit sphere, triangles wound so the normals point outwards
+		void CreateIcosphere(uint32_t subdivisions, std::vector<Vector3>& positions, std::vector<int>& indices)
+		{
+			const float t{ (1.f + sqrtf(5.f)) * 0.5f };
+			positions = {
+				{ -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+				{ 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+				{ t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+			indices = {
+				0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+				1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+				3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+				4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1 };
+
+			for (Vector3& p : positions)
+			{
+				p.Normalize();
+			}
+
+			for (uint32_t level = 0; level < subdivisions; ++level)
+			{
+				//Every edge gets one midpoint, shared by both triangles on it
+				std::unordered_map<uint64_t, int> midpoints{};
+				const auto getMidpoint = [&](int a, int b)
+					{
+						const uint64_t key{ (static_cast<uint64_t>(std::min(a, b)) << 32) | static_cast<uint32_t>(std::max(a, b)) };
+						const auto it{ midpoints.find(key) };
+						if (it != midpoints.end())
+						{
+							return it->second;
+						}
+
+						positions.push_back(((positions[a] + positions[b]) * 0.5f).Normalized());
+						const int index{ static_cast<int>(positions.size()) - 1 };
+						midpoints.emplace(key, index);
+						return index;
+					};
+
+				std::vector<int> subdivided{};
+				subdivided.reserve(indices.size() * 4);
+				for (size_t i = 0; i < indices.size(); i += 3)
+				{
+					const int v0{ indices[i] };
+					const int v1{ indices[i + 1] };
+					const int v2{ indices[i + 2] };
+					const int m01{ getMidpoint(v0, v1) };
+					const int m12{ getMidpoint(v1, v2) };
+					const int m20{ getMidpoint(v2, v0) };
+
+					subdivided.insert(subdivided.end(), { v0, m01, m20, v1, m12, m01, v2, m20, m12, m01, m12, m20 });
+				}
+				indices = std::move(subdivided);
+			}
+
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				const Vector3& v0 = positions[indices[i]];
+				const Vector3& v1 = positions[indices[i + 1]];
+				const Vector3& v2 = positions[indices[i + 2]];
+				if (Vector3::Dot(Vector3::Cross(v1 - v0, v2 - v0), v0 + v1 + v2) < 0.f)
+				{
+					std::swap(indices[i + 1], indices[i + 2]);
+				}
+			}
+		}
+	}
+
+	void Scene_Stress::Initialize()
+	{
+		sceneName = "Stress Scene";
+
+		const float extent{ m_Desc.extent };
+		m_Camera.origin = { 0.f, extent * 0.75f, -extent * 2.f };
+		m_Camera.updateFovAngle(60.f);
+
+		std::mt19937 random{ m_Desc.seed };
+		std::uniform_real_distribution<float> unit{ 0.f, 1.f };
+		std::normal_distribution<float> gaussian{ 0.f, 1.f };
+
+		//Materials
+		std::vector<unsigned char> materials{};
+		materials.push_back(AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f));
+		materials.push_back(AddMaterial<Material_Lambert>(ColorRGB{ 0.8f, 0.3f, 0.25f }, 1.f));
+		materials.push_back(AddMaterial<Material_Lambert>(ColorRGB{ 0.3f, 0.7f, 0.35f }, 1.f));
+		materials.push_back(AddMaterial<Material_LambertPhong>(ColorRGB{ 0.3f, 0.35f, 0.8f }, 0.8f, 0.4f, 40.f));
+		materials.push_back(AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f, 0.3f));
+		materials.push_back(AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f, 0.2f));
+		materials.push_back(AddMaterial<Material_CookTorrence>(ColorRGB{ 1.f, 0.782f, 0.344f }, 1.f, 0.5f));
+		const auto randomMaterial = [&]()
+			{
+				return materials[static_cast<size_t>(unit(random) * static_cast<float>(materials.size())) % materials.size()];
+			};
+
+		//Clustered scenes pick a center first, then scatter around it
+		std::vector<Vector3> clusterCenters(std::max(m_Desc.numClusters, 1u));
+		for (Vector3& center : clusterCenters)
+		{
+			center = { (unit(random) * 2.f - 1.f) * extent, unit(random) * extent, (unit(random) * 2.f - 1.f) * extent };
+		}
+		const float clusterSpread{ extent * 0.1f };
+
+		const auto randomPosition = [&]()
+			{
+				if (m_Desc.distribution == StressDistribution::Clustered)
+				{
+					const Vector3& center = clusterCenters[static_cast<size_t>(unit(random) * static_cast<float>(clusterCenters.size())) % clusterCenters.size()];
+					const Vector3 offset{ gaussian(random), gaussian(random), gaussian(random) };
+					Vector3 position{ center + offset * clusterSpread };
+					position.y = std::max(position.y, 0.f);
+					return position;
+				}
+				return Vector3{ (unit(random) * 2.f - 1.f) * extent, unit(random) * extent, (unit(random) * 2.f - 1.f) * extent };
+			};
+
+		//Ground
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, materials[0]);
+
+		//Spheres, sized so the volume stays about equally full for every count
+		const uint32_t numObjects{ std::max(m_Desc.numSpheres + m_Desc.numMeshes, 1u) };
+		const float baseRadius{ extent * 0.5f / cbrtf(static_cast<float>(numObjects)) };
+
+		m_SphereGeometries.reserve(m_Desc.numSpheres);
+		for (uint32_t i = 0; i < m_Desc.numSpheres; ++i)
+		{
+			const float radius{ baseRadius * (0.25f + 0.75f * unit(random)) };
+			Vector3 origin{ randomPosition() };
+			origin.y = std::max(origin.y, radius);
+			AddSphere(origin, radius, randomMaterial());
+		}
+
+		//Meshes, instances of one icosphere, each with its own transform and material
+		TriangleMesh* pIcosphere = AddInstancedMesh(TriangleCullMode::BackFaceCulling);
+		CreateIcosphere(m_Desc.meshSubdivisions, pIcosphere->positions, pIcosphere->indices);
+		pIcosphere->CalculateNormals();
+		pIcosphere->UpdateAABB();
+		pIcosphere->UpdateTransforms();
+		if (m_Desc.compressMeshes)
+		{
+			pIcosphere->Compress();
+		}
+
+		m_MeshInstances.reserve(m_Desc.numMeshes);
+		for (uint32_t i = 0; i < m_Desc.numMeshes; ++i)
+		{
+			const float scale{ baseRadius * (0.5f + 1.5f * unit(random)) };
+			Vector3 origin{ randomPosition() };
+			origin.y = std::max(origin.y, scale);
+
+			const unsigned char materialIndex{ randomMaterial() };
+			AddMeshInstance(pIcosphere, Matrix::CreateScale(scale, scale, scale) * Matrix::CreateRotationY(unit(random) * PI_2) * Matrix::CreateTranslation(origin), materialIndex);
+		}
+
+		//Lights, dimmer the more there are so the total stays about the same
+		const float intensity{ extent * extent * 0.5f / sqrtf(static_cast<float>(std::max(m_Desc.numLights, 1u))) };
+		m_Lights.reserve(m_Desc.numLights);
+		for (uint32_t i = 0; i < m_Desc.numLights; ++i)
+		{
+			Vector3 origin{ randomPosition() };
+			origin.y = std::max(origin.y, baseRadius * 2.f);
+			const ColorRGB color{ 0.75f + 0.25f * unit(random), 0.6f + 0.4f * unit(random), 0.45f + 0.55f * unit(random) };
+			AddPointLight(origin, intensity * (0.5f + unit(random)), color, baseRadius * 0.25f);
+		}
+	}
+#pragma endregion
 }
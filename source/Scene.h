@@ -1,10 +1,19 @@
 #pragma once
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "LightBVH.h"
+#include "ObjectBVH.h"
+#include "TriangleBVH.h"
+#include "Texture.h"
 
 namespace dae
 {
@@ -35,31 +44,115 @@ namespace dae
 
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		//Position, normal and material of the closest hit, from the primitive the traversal (or the rasterizer) recorded
+		void FinalizeHit(const Ray& ray, HitRecord& hitRecord) const;
 		bool DoesHit(const Ray& ray) const;
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
+		const std::vector<TriangleMesh>& GetTriangleMeshGeometries() const { return m_TriangleMeshGeometries; }
+		const std::vector<MeshInstance>& GetMeshInstances() const { return m_MeshInstances; }
+		//Closest hit with one instance (or any hit), the ray is moved into the instance's object space
+		bool IntersectInstance(uint32_t instanceIndex, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord) const;
+		TriangleKernel GetTriangleKernel() const { return m_TriangleKernel; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const LightBVH& GetLightBVH() const { return m_LightBVH; }
+		//Point lights with a radius, the spheres the path tracer's bounces can hit, and a hierarchy over them (objects index the list)
+		const std::vector<uint32_t>& GetSphereLightIndices() const { return m_SphereLightIndices; }
+		const ObjectBVH& GetSphereLightBVH() const { return m_SphereLightBVH; }
+		//Rebuilds the light hierarchies when lights were added or edited since the last call
+		void UpdateLightBVH();
+		//Builds the triangle hierarchy of new meshes (SAH), rebuilds the ones of meshes that moved since the last call (Morton).
+		//Rebuilds the sphere and instance hierarchies when spheres or instances were added or moved
+		void UpdateAccelerationStructures();
+		const std::vector<Material*>& GetMaterials() const { return m_Materials; }
+		//Changes whenever geometry moved, shading reused from earlier frames is stale then
+		uint32_t GetGeometryVersion() const { return m_GeometryVersion; }
+		//Changes whenever lights or materials were added or edited, same for the shading
+		uint32_t GetShadingVersion() const { return m_ShadingVersion; }
+
+		//World bounds of the meshes marked with MarkMeshChanged since the last call, where they were then and where they are now.
+		//False when the change can't be narrowed down (MarkGeometryChanged, new meshes), everything may look different then
+		bool TakeChangedBounds(std::vector<Bounds>& changedBounds);
 
 	protected:
+		//Materials are placed back to back in blocks of this size instead of one heap allocation each
+		static constexpr size_t MaterialBlockSize{ 4096 };
+
 		std::string	sceneName;
 
 		std::vector<Plane> m_PlaneGeometries{};
 		std::vector<Sphere> m_SphereGeometries{};
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		LightBVH m_LightBVH{};
+		std::vector<uint32_t> m_SphereLightIndices{};
+		ObjectBVH m_SphereLightBVH{};
+		bool m_LightBVHDirty{ true };
+		std::vector<TriangleBVH> m_TriangleMeshBVHs{}; //Same order as m_TriangleMeshGeometries
+		std::vector<uint32_t> m_StaleMeshBVHs{}; //Meshes marked with MarkMeshChanged since the last UpdateAccelerationStructures
+		bool m_AllMeshBVHsStale{ false }; //MarkGeometryChanged, every existing tree is rebuilt
+		BVHBuildMethod m_StaticBVHBuildMethod{ BVHBuildMethod::BinnedSAH }; //For new meshes, SpatialSplitSAH pays off on long thin triangles
+		std::vector<TriangleMesh> m_InstancedMeshes{}; //Object space, only drawn through m_MeshInstances
+		std::vector<TriangleBVH> m_InstancedMeshBVHs{}; //Same order as m_InstancedMeshes, shared by all instances
+		std::vector<MeshInstance> m_MeshInstances{};
+		ObjectBVH m_SphereBVH{};
+		ObjectBVH m_InstanceBVH{};
+		bool m_ObjectBVHsDirty{ true }; //Spheres or instances changed, both lists are brute forced until the next rebuild
+		TriangleKernel m_TriangleKernel{ TriangleKernel::MollerTrumbore }; //Watertight for closed meshes rays must not slip through
+		std::vector<Material*> m_Materials{}; //In m_MaterialBlocks, destroyed but not deleted
+		std::vector<std::unique_ptr<std::byte[]>> m_MaterialBlocks{};
+		size_t m_MaterialBlockOffset{ MaterialBlockSize };
+		std::vector<Texture*> m_Textures{};
+		TextureCache m_TextureCache{};
 
 		Camera m_Camera{};
+		uint32_t m_GeometryVersion{};
+		uint32_t m_ShadingVersion{};
+		std::vector<Bounds> m_MeshBounds{}; //Per mesh, as of the last TakeChangedBounds
+		std::vector<uint32_t> m_ChangedMeshes{};
+		bool m_HasUnknownChanges{ true };
+
+		void MarkGeometryChanged()
+		{
+			++m_GeometryVersion;
+			m_HasUnknownChanges = true;
+			m_ObjectBVHsDirty = true;
+			m_AllMeshBVHsStale = true;
+		}
+		//Only this mesh moved (after its UpdateTransforms), the renderer can keep the parts of the screen it doesn't reach
+		void MarkMeshChanged(const TriangleMesh* pMesh);
+		//Lights were edited through the pointers AddPointLight and AddDirectionalLight returned, recomputes their ranges
+		void MarkLightsChanged();
+		void MarkMaterialsChanged()
+		{
+			++m_ShadingVersion;
+		}
 
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		//Mesh that is only drawn through instances, filled in object space (identity transforms, UpdateAABB and UpdateTransforms) before instancing it
+		TriangleMesh* AddInstancedMesh(TriangleCullMode cullMode);
+		void AddMeshInstance(const TriangleMesh* pMesh, const Matrix& objectToWorld, unsigned char materialIndex = 0);
 
-		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
+		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color, float radius = 0.f);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		//Constructs the material in the scene's material storage, args are passed to its constructor
+		template<typename MaterialType, typename... Args>
+		unsigned char AddMaterial(Args&&... args)
+		{
+			void* pStorage{ AllocateMaterial(sizeof(MaterialType), alignof(MaterialType)) };
+			return RegisterMaterial(new(pStorage) MaterialType(std::forward<Args>(args)...));
+		}
+		//Nullptr when the file can't be loaded, materials fall back to their constant then
+		const Texture* AddTexture(const std::string& path, bool isSRGB = true);
+		//Generated texels, RGBA8 (R in the lowest byte), row-major
+		const Texture* AddTexture(uint32_t width, uint32_t height, const std::vector<uint32_t>& texels, bool isSRGB = true);
+
+	private:
+		void* AllocateMaterial(size_t size, size_t alignment);
+		unsigned char RegisterMaterial(Material* pMaterial);
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -166,4 +259,60 @@ namespace dae
 	private:
 		TriangleMesh* pMesh{ nullptr };
 	};
+
+	//+++++++++++++++++++++++++++++++++++++++++
+	//TEXTURE Scene, generated textures on a floor and a spinning panel
+	class Scene_Textures final : public Scene
+	{
+	public:
+		Scene_Textures() = default;
+		~Scene_Textures() override = default;
+
+		Scene_Textures(const Scene_Textures&) = delete;
+		Scene_Textures(Scene_Textures&&) noexcept = delete;
+		Scene_Textures& operator=(const Scene_Textures&) = delete;
+		Scene_Textures& operator=(Scene_Textures&&) noexcept = delete;
+
+		void Initialize() override;
+		void Update(Timer* pTimer) override;
+	private:
+		TriangleMesh* m_pPanel{ nullptr };
+	};
+
+	//+++++++++++++++++++++++++++++++++++++++++
+	//STRESS Scene, procedurally generated for scaling tests
+	enum class StressDistribution
+	{
+		Uniform, //Spread over the whole volume
+		Clustered //Gaussian blobs around random centers, like props grouped in rooms
+	};
+
+	struct StressSceneDesc
+	{
+		uint32_t numSpheres{ 1000 };
+		uint32_t numMeshes{ 16 };
+		uint32_t numLights{ 16 };
+		uint32_t meshSubdivisions{ 2 }; //Meshes are icospheres of 20 * 4^n triangles
+		StressDistribution distribution{ StressDistribution::Uniform };
+		uint32_t numClusters{ 8 };
+		float extent{ 20.f }; //Half size of the volume everything is placed in
+		uint32_t seed{ 1 }; //Same seed, same scene
+		bool compressMeshes{ false }; //Quantized meshes (TriangleMesh::Compress), several times less memory, slightly slower to intersect
+	};
+
+	class Scene_Stress final : public Scene
+	{
+	public:
+		explicit Scene_Stress(const StressSceneDesc& desc = {}) : m_Desc{ desc } {}
+		~Scene_Stress() override = default;
+
+		Scene_Stress(const Scene_Stress&) = delete;
+		Scene_Stress(Scene_Stress&&) noexcept = delete;
+		Scene_Stress& operator=(const Scene_Stress&) = delete;
+		Scene_Stress& operator=(Scene_Stress&&) noexcept = delete;
+
+		void Initialize() override;
+	private:
+		StressSceneDesc m_Desc{};
+	};
 }
@@ -0,0 +1,422 @@
+#include "Texture.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "SDL.h"
+#include "SDL_surface.h"
+
+namespace dae
+{
+	namespace
+	{
+		float SRGBToLinear(float c)
+		{
+			return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+
+		float LinearToSRGB(float c)
+		{
+			return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.f / 2.4f) - 0.055f;
+		}
+
+		uint8_t ToByte(float c)
+		{
+			return static_cast<uint8_t>(std::clamp(c, 0.f, 1.f) * 255.f + 0.5f);
+		}
+
+		uint32_t WrapCoordinate(int c, uint32_t size)
+		{
+			const int wrapped{ c % static_cast<int>(size) };
+			return static_cast<uint32_t>(wrapped < 0 ? wrapped + static_cast<int>(size) : wrapped);
+		}
+
+		std::atomic<uint32_t> g_NextCacheSerial{ 1 };
+
+		//Copies of the tiles a render thread used last, direct mapped. Serial 0 is never handed out, so empty entries never match
+		struct ThreadTile
+		{
+			uint32_t cacheSerial{};
+			uint64_t key{};
+			ColorRGB texels[Texture::TileTexelCount]{};
+		};
+		thread_local ThreadTile t_ThreadTiles[TextureCache::NumThreadTiles]{};
+	}
+
+#pragma region Texture
+	Texture::Texture(uint32_t width, uint32_t height, const std::vector<uint32_t>& texels, bool isSRGB, TextureCache* pCache) :
+		m_pCache(pCache),
+		m_IsSRGB(isSRGB)
+	{
+		assert(width > 0 && height > 0 && texels.size() >= size_t(width) * height);
+
+		//Decode the base level, the pyramid is filtered in linear space
+		std::vector<ColorRGB> level(size_t(width) * height);
+		for (size_t i = 0; i < level.size(); ++i)
+		{
+			ColorRGB& c = level[i];
+			c.r = (texels[i] & 0xFF) / 255.f;
+			c.g = ((texels[i] >> 8) & 0xFF) / 255.f;
+			c.b = ((texels[i] >> 16) & 0xFF) / 255.f;
+			if (m_IsSRGB)
+			{
+				c = { SRGBToLinear(c.r), SRGBToLinear(c.g), SRGBToLinear(c.b) };
+			}
+		}
+
+		uint32_t levelWidth{ width };
+		uint32_t levelHeight{ height };
+		while (true)
+		{
+			//Store the level as 8x8 tiles
+			MipLevel mip{};
+			mip.width = levelWidth;
+			mip.height = levelHeight;
+			mip.tilesX = (levelWidth + TileSize - 1) / TileSize;
+			mip.tilesY = (levelHeight + TileSize - 1) / TileSize;
+			mip.firstTexel = m_TiledTexels.size();
+			m_TiledTexels.resize(m_TiledTexels.size() + size_t(mip.tilesX) * mip.tilesY * TileTexelCount);
+
+			for (uint32_t y = 0; y < levelHeight; ++y)
+			{
+				for (uint32_t x = 0; x < levelWidth; ++x)
+				{
+					ColorRGB c = level[x + size_t(y) * levelWidth];
+					if (m_IsSRGB)
+					{
+						c = { LinearToSRGB(c.r), LinearToSRGB(c.g), LinearToSRGB(c.b) };
+					}
+
+					const size_t tileIndex{ (y / TileSize) * mip.tilesX + (x / TileSize) };
+					const size_t texelInTile{ (y % TileSize) * TileSize + (x % TileSize) };
+					m_TiledTexels[mip.firstTexel + tileIndex * TileTexelCount + texelInTile] =
+						ToByte(c.r) | (ToByte(c.g) << 8) | (ToByte(c.b) << 16) | 0xFF000000;
+				}
+			}
+			m_MipLevels.push_back(mip);
+
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+
+			//Box filter down to the next level
+			const uint32_t nextWidth{ std::max(levelWidth / 2, 1u) };
+			const uint32_t nextHeight{ std::max(levelHeight / 2, 1u) };
+			std::vector<ColorRGB> next(size_t(nextWidth) * nextHeight);
+			for (uint32_t y = 0; y < nextHeight; ++y)
+			{
+				for (uint32_t x = 0; x < nextWidth; ++x)
+				{
+					const uint32_t x0{ std::min(x * 2, levelWidth - 1) };
+					const uint32_t x1{ std::min(x * 2 + 1, levelWidth - 1) };
+					const uint32_t y0{ std::min(y * 2, levelHeight - 1) };
+					const uint32_t y1{ std::min(y * 2 + 1, levelHeight - 1) };
+
+					ColorRGB sum{};
+					sum += level[x0 + size_t(y0) * levelWidth];
+					sum += level[x1 + size_t(y0) * levelWidth];
+					sum += level[x0 + size_t(y1) * levelWidth];
+					sum += level[x1 + size_t(y1) * levelWidth];
+					next[x + size_t(y) * nextWidth] = sum * 0.25f;
+				}
+			}
+
+			level = std::move(next);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+
+		m_Id = m_pCache->RegisterTexture(GetPyramidBytes());
+	}
+
+	Texture::~Texture()
+	{
+		m_pCache->UnregisterTexture(GetPyramidBytes());
+	}
+
+	Texture* Texture::LoadFromFile(const std::string& path, bool isSRGB, TextureCache* pCache)
+	{
+		SDL_Surface* pLoaded{ SDL_LoadBMP(path.c_str()) };
+		if (!pLoaded)
+			return nullptr;
+
+		SDL_Surface* pSurface{ SDL_ConvertSurfaceFormat(pLoaded, SDL_PIXELFORMAT_RGBA32, 0) };
+		SDL_FreeSurface(pLoaded);
+		if (!pSurface)
+			return nullptr;
+
+		const uint32_t width{ static_cast<uint32_t>(pSurface->w) };
+		const uint32_t height{ static_cast<uint32_t>(pSurface->h) };
+		std::vector<uint32_t> texels(size_t(width) * height);
+
+		SDL_LockSurface(pSurface);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const uint8_t* pRow{ static_cast<const uint8_t*>(pSurface->pixels) + size_t(y) * pSurface->pitch };
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const uint8_t* pTexel{ pRow + size_t(x) * 4 };
+				texels[x + size_t(y) * width] = pTexel[0] | (pTexel[1] << 8) | (pTexel[2] << 16) | (pTexel[3] << 24);
+			}
+		}
+		SDL_UnlockSurface(pSurface);
+		SDL_FreeSurface(pSurface);
+
+		return new Texture(width, height, texels, isSRGB, pCache);
+	}
+
+	ColorRGB Texture::Sample(const Vector2& uv, const Vector2& dUVdx, const Vector2& dUVdy) const
+	{
+		const Vector2 size{ static_cast<float>(GetWidth()), static_cast<float>(GetHeight()) };
+		const float footprintX{ Vector2{ dUVdx.x * size.x, dUVdx.y * size.y }.Magnitude() };
+		const float footprintY{ Vector2{ dUVdy.x * size.x, dUVdy.y * size.y }.Magnitude() };
+		const float footprint{ std::max(footprintX, footprintY) };
+
+		const float maxLevel{ static_cast<float>(m_MipLevels.size() - 1) };
+		const float lod{ footprint > 1.f ? std::min(log2f(footprint), maxLevel) : 0.f };
+
+		const uint32_t level{ static_cast<uint32_t>(lod) };
+		const float factor{ lod - static_cast<float>(level) };
+
+		if (factor <= 0.f || level + 1 >= m_MipLevels.size())
+		{
+			return SampleBilinear(level, uv);
+		}
+		return ColorRGB::Lerp(SampleBilinear(level, uv), SampleBilinear(level + 1, uv), factor);
+	}
+
+	ColorRGB Texture::SampleBilinear(uint32_t level, const Vector2& uv) const
+	{
+		const MipLevel& mip = m_MipLevels[level];
+
+		const float x{ uv.x * mip.width - 0.5f };
+		const float y{ uv.y * mip.height - 0.5f };
+		const float floorX{ floorf(x) };
+		const float floorY{ floorf(y) };
+		const float fx{ x - floorX };
+		const float fy{ y - floorY };
+
+		const uint32_t x0{ WrapCoordinate(static_cast<int>(floorX), mip.width) };
+		const uint32_t y0{ WrapCoordinate(static_cast<int>(floorY), mip.height) };
+		const uint32_t x1{ x0 + 1 < mip.width ? x0 + 1 : 0 };
+		const uint32_t y1{ y0 + 1 < mip.height ? y0 + 1 : 0 };
+
+		//The four texels are in the same tile most of the time, every tile is only looked up once
+		uint32_t currentTile{ UINT32_MAX };
+		const ColorRGB* pTile{ nullptr };
+		const auto fetch = [&](uint32_t tx, uint32_t ty)
+		{
+			const uint32_t tileIndex{ (ty / TileSize) * mip.tilesX + (tx / TileSize) };
+			if (tileIndex != currentTile)
+			{
+				pTile = m_pCache->GetTile(*this, level, tileIndex);
+				currentTile = tileIndex;
+			}
+			return pTile[(ty % TileSize) * TileSize + (tx % TileSize)];
+		};
+
+		const ColorRGB top{ ColorRGB::Lerp(fetch(x0, y0), fetch(x1, y0), fx) };
+		const ColorRGB bottom{ ColorRGB::Lerp(fetch(x0, y1), fetch(x1, y1), fx) };
+		return ColorRGB::Lerp(top, bottom, fy);
+	}
+
+	void Texture::DecodeTile(uint32_t level, uint32_t tileIndex, ColorRGB* pTexels) const
+	{
+		//sRGB decode table, shared by all textures
+		static const auto srgbTable = []()
+		{
+			std::vector<float> table(256);
+			for (int i = 0; i < 256; ++i)
+			{
+				table[i] = SRGBToLinear(i / 255.f);
+			}
+			return table;
+		}();
+
+		const uint32_t* pTile{ &m_TiledTexels[m_MipLevels[level].firstTexel + size_t(tileIndex) * TileTexelCount] };
+		for (uint32_t i = 0; i < TileTexelCount; ++i)
+		{
+			const uint32_t texel{ pTile[i] };
+			const uint32_t r{ texel & 0xFF };
+			const uint32_t g{ (texel >> 8) & 0xFF };
+			const uint32_t b{ (texel >> 16) & 0xFF };
+
+			if (m_IsSRGB)
+			{
+				pTexels[i] = { srgbTable[r], srgbTable[g], srgbTable[b] };
+			}
+			else
+			{
+				pTexels[i] = { r / 255.f, g / 255.f, b / 255.f };
+			}
+		}
+	}
+#pragma endregion
+
+#pragma region Texture Cache
+	TextureCache::TextureCache(size_t budgetInBytes) :
+		m_Budget(budgetInBytes),
+		m_Serial(g_NextCacheSerial++)
+	{
+	}
+
+	uint32_t TextureCache::RegisterTexture(size_t pyramidBytes)
+	{
+		m_PyramidBytes += pyramidBytes;
+		return m_NextTextureId++;
+	}
+
+	const ColorRGB* TextureCache::GetTile(const Texture& texture, uint32_t level, uint32_t tileIndex)
+	{
+		//texture id (24 bits) | mip level (8 bits) | tile index (32 bits)
+		const uint64_t key{ (static_cast<uint64_t>(texture.GetId()) << 40) | (static_cast<uint64_t>(level) << 32) | tileIndex };
+		const uint64_t hash{ key ^ (key >> 17) ^ (key >> 40) };
+
+		//Copy of this thread, no lock
+		ThreadTile& threadTile = t_ThreadTiles[hash % NumThreadTiles];
+		if (threadTile.key != key || threadTile.cacheSerial != m_Serial)
+		{
+			CopySharedTile(texture, level, tileIndex, key, threadTile.texels);
+			threadTile.key = key;
+			threadTile.cacheSerial = m_Serial;
+		}
+		return threadTile.texels;
+	}
+
+	void TextureCache::CopySharedTile(const Texture& texture, uint32_t level, uint32_t tileIndex, uint64_t key, ColorRGB* pTexels)
+	{
+		Shard& shard = m_Shards[(key ^ (key >> 17) ^ (key >> 40)) % NumShards];
+		std::lock_guard<std::mutex> lock{ shard.mutex };
+
+		uint32_t slot{ shard.Find(key) };
+		if (slot != NoTile)
+		{
+			//Hit, mark as most recently used
+			shard.Unlink(slot);
+			shard.Link(slot);
+			std::memcpy(pTexels, shard.tiles[slot].texels, sizeof(Tile::texels));
+			return;
+		}
+
+		//Miss, the decoded tiles get what the pyramids leave of the budget (at least one per shard).
+		//Evict the least recently used tiles while over it, the last one is reused for the new tile
+		const size_t pyramidBytes{ m_PyramidBytes.load(std::memory_order_relaxed) };
+		const uint32_t maxTiles{ static_cast<uint32_t>(std::max<size_t>((m_Budget > pyramidBytes ? m_Budget - pyramidBytes : 0) / NumShards / sizeof(Tile), 1)) };
+		shard.Grow(maxTiles);
+		while (shard.numUsed > maxTiles)
+		{
+			const uint32_t evicted{ shard.oldest };
+			shard.Unlink(evicted);
+			shard.tiles[evicted].nextInBucket = shard.firstFree;
+			shard.firstFree = evicted;
+			--shard.numUsed;
+		}
+
+		if (shard.numUsed == maxTiles)
+		{
+			slot = shard.oldest;
+			shard.Unlink(slot);
+		}
+		else
+		{
+			slot = shard.firstFree;
+			shard.firstFree = shard.tiles[slot].nextInBucket;
+			++shard.numUsed;
+		}
+
+		Tile& tile = shard.tiles[slot];
+		tile.key = key;
+		texture.DecodeTile(level, tileIndex, tile.texels);
+		shard.Link(slot);
+
+		std::memcpy(pTexels, tile.texels, sizeof(Tile::texels));
+	}
+
+	uint32_t TextureCache::Shard::Find(uint64_t key) const
+	{
+		if (buckets.empty())
+		{
+			return NoTile;
+		}
+
+		uint32_t tileIndex{ buckets[GetBucketIndex(key)] };
+		while (tileIndex != NoTile && tiles[tileIndex].key != key)
+		{
+			tileIndex = tiles[tileIndex].nextInBucket;
+		}
+		return tileIndex;
+	}
+
+	void TextureCache::Shard::Grow(uint32_t maxTiles)
+	{
+		const uint32_t numTiles{ static_cast<uint32_t>(tiles.size()) };
+		if (numTiles >= maxTiles)
+		{
+			return;
+		}
+
+		tiles.resize(maxTiles);
+		for (uint32_t tileIndex = maxTiles; tileIndex-- > numTiles;)
+		{
+			tiles[tileIndex].nextInBucket = firstFree;
+			firstFree = tileIndex;
+		}
+
+		//More buckets, the tiles in use are chained again
+		buckets.assign(std::bit_ceil(maxTiles), NoTile);
+		for (uint32_t tileIndex = oldest; tileIndex != NoTile; tileIndex = tiles[tileIndex].newer)
+		{
+			uint32_t& bucket = buckets[GetBucketIndex(tiles[tileIndex].key)];
+			tiles[tileIndex].nextInBucket = bucket;
+			bucket = tileIndex;
+		}
+	}
+
+	void TextureCache::Shard::Link(uint32_t tileIndex)
+	{
+		Tile& tile = tiles[tileIndex];
+		tile.older = newest;
+		tile.newer = NoTile;
+		(newest != NoTile ? tiles[newest].newer : oldest) = tileIndex;
+		newest = tileIndex;
+
+		uint32_t& bucket = buckets[GetBucketIndex(tile.key)];
+		tile.nextInBucket = bucket;
+		bucket = tileIndex;
+	}
+
+	void TextureCache::Shard::Unlink(uint32_t tileIndex)
+	{
+		Tile& tile = tiles[tileIndex];
+		(tile.older != NoTile ? tiles[tile.older].newer : oldest) = tile.newer;
+		(tile.newer != NoTile ? tiles[tile.newer].older : newest) = tile.older;
+
+		uint32_t* pLink{ &buckets[GetBucketIndex(tile.key)] };
+		while (*pLink != tileIndex)
+		{
+			pLink = &tiles[*pLink].nextInBucket;
+		}
+		*pLink = tile.nextInBucket;
+		tile.nextInBucket = NoTile;
+	}
+
+	uint32_t TextureCache::Shard::GetBucketIndex(uint64_t key) const
+	{
+		//The shard was picked by the low bits of another hash, the bucket comes from the high bits of a multiplicative one
+		return static_cast<uint32_t>(((key * 0x9E3779B97F4A7C15ull) >> 32) & (buckets.size() - 1));
+	}
+
+	size_t TextureCache::GetResidentBytes() const
+	{
+		size_t numTiles{};
+		for (const Shard& shard : m_Shards)
+		{
+			std::lock_guard<std::mutex> lock{ shard.mutex };
+			numTiles += shard.numUsed;
+		}
+		return m_PyramidBytes.load() + numTiles * sizeof(Tile);
+	}
+#pragma endregion
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	class TextureCache;
+
+#pragma region TEXTURE
+	/**
+	 * \brief Mipmapped texture, every mip level is stored in 8x8 texel tiles (8-bit RGBA).
+	 * Texels are never read directly, sampling goes through the TextureCache which decodes tiles to linear float on demand.
+	 */
+	class Texture final
+	{
+	public:
+		static constexpr uint32_t TileSize{ 8 };
+		static constexpr uint32_t TileTexelCount{ TileSize * TileSize };
+
+		/**
+		 * \param width Width of the base level
+		 * \param height Height of the base level
+		 * \param texels Base level texels, RGBA8 (R in the lowest byte), row-major
+		 * \param isSRGB Color data (albedo) is sRGB encoded, data maps (roughness, metalness) are linear
+		 * \param pCache Cache used for sampling, has to outlive the texture
+		 */
+		Texture(uint32_t width, uint32_t height, const std::vector<uint32_t>& texels, bool isSRGB, TextureCache* pCache);
+		~Texture();
+
+		Texture(const Texture&) = delete;
+		Texture(Texture&&) noexcept = delete;
+		Texture& operator=(const Texture&) = delete;
+		Texture& operator=(Texture&&) noexcept = delete;
+
+		//Only BMP, no image library in the project
+		static Texture* LoadFromFile(const std::string& path, bool isSRGB, TextureCache* pCache);
+
+		/**
+		 * \brief Trilinear sample, mip level selected from the screen-space uv derivatives (ray differentials)
+		 * \param uv Texture coordinate (repeat addressing)
+		 * \param dUVdx Change of uv to the neighbouring pixel in x (zero >> base level)
+		 * \param dUVdy Change of uv to the neighbouring pixel in y (zero >> base level)
+		 * \return Linear color
+		 */
+		ColorRGB Sample(const Vector2& uv, const Vector2& dUVdx, const Vector2& dUVdy) const;
+
+		//Decodes a complete tile to linear color, called by the cache on a miss
+		void DecodeTile(uint32_t level, uint32_t tileIndex, ColorRGB* pTexels) const;
+
+		uint32_t GetId() const { return m_Id; }
+		uint32_t GetWidth() const { return m_MipLevels[0].width; }
+		uint32_t GetHeight() const { return m_MipLevels[0].height; }
+		uint32_t GetNumMipLevels() const { return static_cast<uint32_t>(m_MipLevels.size()); }
+		//The 8-bit tiles of all levels, always resident
+		size_t GetPyramidBytes() const { return m_TiledTexels.size() * sizeof(uint32_t); }
+
+	private:
+		struct MipLevel
+		{
+			uint32_t width{};
+			uint32_t height{};
+			uint32_t tilesX{};
+			uint32_t tilesY{};
+			size_t firstTexel{}; //Offset of the first tile in m_TiledTexels
+		};
+
+		std::vector<MipLevel> m_MipLevels{};
+		std::vector<uint32_t> m_TiledTexels{};
+
+		TextureCache* m_pCache{ nullptr };
+		uint32_t m_Id{};
+		bool m_IsSRGB{ true };
+
+		ColorRGB SampleBilinear(uint32_t level, const Vector2& uv) const;
+	};
+#pragma endregion
+
+#pragma region TEXTURE CACHE
+	/**
+	 * \brief Keeps decoded texture tiles resident, least recently used tiles are evicted.
+	 * The 8-bit pyramids of the registered textures can't be evicted, they count against the budget and the decoded tiles get the rest.
+	 * Split in shards with their own lock so the render threads don't serialize on a single mutex, and every thread keeps
+	 * copies of the last few tiles it used, so most samples don't lock at all.
+	 * A shard allocates the slots for its share of the budget on its first miss, misses after that reuse them and don't allocate.
+	 */
+	class TextureCache final
+	{
+	public:
+		TextureCache(size_t budgetInBytes = 16 * 1024 * 1024);
+		~TextureCache() = default;
+
+		TextureCache(const TextureCache&) = delete;
+		TextureCache(TextureCache&&) noexcept = delete;
+		TextureCache& operator=(const TextureCache&) = delete;
+		TextureCache& operator=(TextureCache&&) noexcept = delete;
+
+		//Returns the id of the texture, its pyramid is resident until UnregisterTexture
+		uint32_t RegisterTexture(size_t pyramidBytes);
+		void UnregisterTexture(size_t pyramidBytes) { m_PyramidBytes -= pyramidBytes; }
+
+		//Decoded texels of a tile, row-major. Valid until the next GetTile on the same thread
+		const ColorRGB* GetTile(const Texture& texture, uint32_t level, uint32_t tileIndex);
+
+		//Pyramids and decoded tiles, the per thread copies are not included (NumThreadTiles tiles per render thread)
+		size_t GetResidentBytes() const;
+		size_t GetBudget() const { return m_Budget; }
+
+		static constexpr uint32_t NumThreadTiles{ 64 };
+
+	private:
+		static constexpr uint32_t NumShards{ 16 };
+		static constexpr uint32_t NoTile{ 0xFFFFFFFF };
+
+		//Slot of a shard, linked by index so the slots can be reallocated when the budget grows
+		struct Tile
+		{
+			uint64_t key{};
+			uint32_t newer{ NoTile }; //Recency list
+			uint32_t older{ NoTile };
+			uint32_t nextInBucket{ NoTile }; //Hash chain while in use, free list otherwise
+			ColorRGB texels[Texture::TileTexelCount]{};
+		};
+
+		struct Shard
+		{
+			mutable std::mutex mutex{};
+			std::vector<Tile> tiles{}; //Only grows, up to the shard's share of the budget
+			std::vector<uint32_t> buckets{}; //First tile of every hash chain, a power of two at least as many as tiles
+			uint32_t numUsed{};
+			uint32_t newest{ NoTile };
+			uint32_t oldest{ NoTile };
+			uint32_t firstFree{ NoTile };
+
+			uint32_t Find(uint64_t key) const;
+			//Makes room for maxTiles, the new slots go on the free list
+			void Grow(uint32_t maxTiles);
+			void Link(uint32_t tileIndex); //As the newest, and into its hash chain
+			void Unlink(uint32_t tileIndex);
+			uint32_t GetBucketIndex(uint64_t key) const;
+		};
+
+		Shard m_Shards[NumShards]{};
+		size_t m_Budget{};
+		std::atomic<size_t> m_PyramidBytes{};
+		uint32_t m_NextTextureId{};
+		uint32_t m_Serial{}; //Unique for every cache, the per thread copies can't be confused between caches
+
+		//Tile from the shared shards, decoded on a miss
+		void CopySharedTile(const Texture& texture, uint32_t level, uint32_t tileIndex, uint64_t key, ColorRGB* pTexels);
+	};
+#pragma endregion
+}
@@ -0,0 +1,1197 @@
+#include "TriangleBVH.h"
+#include "Utils.h" //WatertightRay
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <immintrin.h> //AVX
+#include <ppl.h> //parallel_for, parallel_invoke, parallel_sort
+
+namespace dae
+{
+	namespace
+	{
+		float SurfaceArea(const Vector3& boundsMin, const Vector3& boundsMax)
+		{
+			const Vector3 extent{ boundsMax - boundsMin };
+			return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+
+		//SAH cost of one triangle relative to one node visit
+		constexpr float TriangleCost{ 0.25f };
+
+		struct Bin
+		{
+			Vector3 boundsMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 boundsMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			uint32_t count{};
+
+			void Grow(const Vector3& otherMin, const Vector3& otherMax, uint32_t otherCount)
+			{
+				boundsMin = Vector3::Min(boundsMin, otherMin);
+				boundsMax = Vector3::Max(boundsMax, otherMax);
+				count += otherCount;
+			}
+
+			//Empty bins have inverted bounds
+			float GetArea() const { return boundsMin.x <= boundsMax.x ? SurfaceArea(boundsMin, boundsMax) : 0.f; }
+		};
+
+		struct MortonPrimitive
+		{
+			uint64_t code;
+			uint32_t triangle;
+		};
+
+		//Spreads the bits out so two zeros follow each, interleaving three of them gives the Morton code
+		uint64_t ExpandBits10(uint32_t v)
+		{
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		}
+
+		uint64_t ExpandBits21(uint32_t value)
+		{
+			uint64_t v{ value & 0x1FFFFFu };
+			v = (v | v << 32) & 0x1F00000000FFFFull;
+			v = (v | v << 16) & 0x1F0000FF0000FFull;
+			v = (v | v << 8) & 0x100F00F00F00F00Full;
+			v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+			v = (v | v << 2) & 0x1249249249249249ull;
+			return v;
+		}
+
+		//Optimal 19 comparator network for 8 keys
+		void CompareExchange(uint32_t& a, uint32_t& b)
+		{
+			const uint32_t low{ std::min(a, b) };
+			b = std::max(a, b);
+			a = low;
+		}
+
+		void SortNetwork8(uint32_t keys[8])
+		{
+			CompareExchange(keys[0], keys[2]); CompareExchange(keys[1], keys[3]); CompareExchange(keys[4], keys[6]); CompareExchange(keys[5], keys[7]);
+			CompareExchange(keys[0], keys[4]); CompareExchange(keys[1], keys[5]); CompareExchange(keys[2], keys[6]); CompareExchange(keys[3], keys[7]);
+			CompareExchange(keys[0], keys[1]); CompareExchange(keys[2], keys[3]); CompareExchange(keys[4], keys[5]); CompareExchange(keys[6], keys[7]);
+			CompareExchange(keys[2], keys[4]); CompareExchange(keys[3], keys[5]);
+			CompareExchange(keys[1], keys[4]); CompareExchange(keys[3], keys[6]);
+			CompareExchange(keys[1], keys[2]); CompareExchange(keys[3], keys[4]); CompareExchange(keys[5], keys[6]);
+		}
+
+		__m256 Dot(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+		{
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+		}
+
+		//Component wise a * b - c * d
+		__m256 MulSub(__m256 a, __m256 b, __m256 c, __m256 d)
+		{
+			return _mm256_sub_ps(_mm256_mul_ps(a, b), _mm256_mul_ps(c, d));
+		}
+	}
+
+	void TriangleBVH::Build(const TriangleMesh& mesh, BVHBuildMethod method, float spatialSplitBudget)
+	{
+		const auto buildStart{ std::chrono::steady_clock::now() };
+
+		m_Nodes.clear();
+		m_Packets.clear();
+		m_ReferencePackets.clear();
+		m_IsCompressed = mesh.isCompressed;
+		m_BuildStats = {};
+
+		const uint32_t numTriangles{ mesh.GetNumTriangles() };
+		if (numTriangles == 0)
+			return;
+
+		//Rebuilds of moving meshes run every frame, their scratch memory is reused instead of allocated
+		const FrameArena::Scope arenaScope{};
+		BuildState state{};
+		state.triangles.resize(numTriangles);
+		concurrency::parallel_for(0u, numTriangles, [&](uint32_t i)
+			{
+				const Vector3 p0{ mesh.GetTransformedPosition(i, 0) };
+				const Vector3 p1{ mesh.GetTransformedPosition(i, 1) };
+				const Vector3 p2{ mesh.GetTransformedPosition(i, 2) };
+
+				BuildTriangle& triangle = state.triangles[i];
+				triangle.boundsMin = Vector3::Min(p0, Vector3::Min(p1, p2));
+				triangle.boundsMax = Vector3::Max(p0, Vector3::Max(p1, p2));
+				triangle.centroid = (triangle.boundsMin + triangle.boundsMax) * 0.5f;
+				triangle.triangleIndex = i;
+			});
+
+		BuildNode root{ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, 0, numTriangles };
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const BuildTriangle& triangle : state.triangles)
+		{
+			root.boundsMin = Vector3::Min(root.boundsMin, triangle.boundsMin);
+			root.boundsMax = Vector3::Max(root.boundsMax, triangle.boundsMax);
+			centroidMin = Vector3::Min(centroidMin, triangle.centroid);
+			centroidMax = Vector3::Max(centroidMax, triangle.centroid);
+		}
+
+		//A binary tree over n triangles never has more than 2n - 1 nodes, so the storage never moves while tasks write to it
+		state.nodes.resize(numTriangles * 2);
+		state.nodes[0] = root;
+		state.numNodes = 1;
+
+		switch (method)
+		{
+		case BVHBuildMethod::BinnedSAH:
+			BuildBinned(state, 0);
+			break;
+		case BVHBuildMethod::SpatialSplitSAH:
+		{
+			state.pMesh = &mesh;
+			state.rootArea = SurfaceArea(root.boundsMin, root.boundsMax);
+			state.numReferences = numTriangles;
+			state.maxReferences = numTriangles + static_cast<uint32_t>(numTriangles * std::max(spatialSplitBudget, 0.f));
+			state.nodes.resize(state.maxReferences * 2);
+
+			std::vector<BuildTriangle> references{ state.triangles.begin(), state.triangles.end() };
+			state.triangles.clear();
+			state.triangles.reserve(state.maxReferences);
+			BuildSpatial(state, 0, references, 0);
+			break;
+		}
+		case BVHBuildMethod::MortonLBVH:
+			SortMorton(state, centroidMin, centroidMax);
+			BuildMorton(state, 0);
+			break;
+		}
+
+		const float rootArea{ std::max(SurfaceArea(root.boundsMin, root.boundsMax), FLT_MIN) };
+		m_Nodes.reserve(state.numNodes / 4 + 1);
+		if (m_IsCompressed)
+			m_ReferencePackets.reserve(state.numNodes / 2 + 1);
+		else
+			m_Packets.reserve(state.numNodes / 2 + 1);
+		if (state.nodes[0].count > 0)
+		{
+			//Single leaf, still needs a node to hold its bounds
+			const uint32_t packetIndex{ CreatePacket(state.nodes[0], state, mesh) };
+			Node& node = AddNode();
+			node.minX[0] = root.boundsMin.x;
+			node.minY[0] = root.boundsMin.y;
+			node.minZ[0] = root.boundsMin.z;
+			node.maxX[0] = root.boundsMax.x;
+			node.maxY[0] = root.boundsMax.y;
+			node.maxZ[0] = root.boundsMax.z;
+			node.children[0] = LeafFlag | packetIndex;
+			m_BuildStats.sahCost = 2.f;
+		}
+		else
+		{
+			Collapse(state, mesh, 0, rootArea);
+		}
+
+		m_BuildStats.numNodes = static_cast<uint32_t>(m_Nodes.size());
+		m_BuildStats.numPackets = static_cast<uint32_t>(m_Packets.size() + m_ReferencePackets.size());
+		m_BuildStats.numReferences = static_cast<uint32_t>(state.triangles.size());
+		m_BuildStats.buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	}
+
+	void TriangleBVH::BuildBinned(BuildState& state, uint32_t nodeIndex) const
+	{
+		const BuildNode node{ state.nodes[nodeIndex] };
+		const uint32_t first{ node.first };
+		const uint32_t last{ node.first + node.count };
+
+		ObjectSplit split{ FindObjectSplit(state.triangles.data() + first, node.count, node) };
+		uint32_t middle{};
+		if (split.axis >= 0 && split.cost < node.count * TriangleCost)
+		{
+			const auto it = std::partition(state.triangles.begin() + first, state.triangles.begin() + last, [&](const BuildTriangle& triangle)
+				{
+					return split.IsLeft(triangle);
+				});
+			middle = static_cast<uint32_t>(it - state.triangles.begin());
+		}
+		else if (node.count > MaxLeafSize)
+		{
+			//No split pays off (or all centroids coincide), but the triangles don't fit a single packet
+			middle = first + node.count / 2;
+			Bin left{};
+			Bin right{};
+			for (uint32_t i = first; i < last; ++i)
+			{
+				(i < middle ? left : right).Grow(state.triangles[i].boundsMin, state.triangles[i].boundsMax, 1);
+			}
+			split.leftMin = left.boundsMin;
+			split.leftMax = left.boundsMax;
+			split.rightMin = right.boundsMin;
+			split.rightMax = right.boundsMax;
+		}
+		else
+		{
+			return;
+		}
+
+		const uint32_t leftIndex{ state.numNodes.fetch_add(2) };
+		state.nodes[nodeIndex].first = leftIndex;
+		state.nodes[nodeIndex].count = 0;
+		state.nodes[leftIndex] = { split.leftMin, split.leftMax, first, middle - first };
+		state.nodes[leftIndex + 1] = { split.rightMin, split.rightMax, middle, last - middle };
+
+		if (node.count >= ParallelBuildThreshold)
+		{
+			concurrency::parallel_invoke(
+				[&] { BuildBinned(state, leftIndex); },
+				[&] { BuildBinned(state, leftIndex + 1); });
+		}
+		else
+		{
+			BuildBinned(state, leftIndex);
+			BuildBinned(state, leftIndex + 1);
+		}
+	}
+
+	void TriangleBVH::BuildSpatial(BuildState& state, uint32_t nodeIndex, std::vector<BuildTriangle>& references, int depth) const
+	{
+		const BuildNode node{ state.nodes[nodeIndex] };
+		const uint32_t count{ static_cast<uint32_t>(references.size()) };
+		const float leafCost{ count * TriangleCost };
+
+		const ObjectSplit objectSplit{ FindObjectSplit(references.data(), count, node) };
+
+		//Spatial splits only pay off where the object split children overlap, skip the binning everywhere else
+		SpatialSplit spatialSplit{};
+		if (depth < MaxSpatialSplitDepth && state.numReferences < state.maxReferences)
+		{
+			const Vector3 overlapMin{ Vector3::Max(objectSplit.leftMin, objectSplit.rightMin) };
+			const Vector3 overlapMax{ Vector3::Min(objectSplit.leftMax, objectSplit.rightMax) };
+			const bool doesOverlap{ overlapMin.x <= overlapMax.x && overlapMin.y <= overlapMax.y && overlapMin.z <= overlapMax.z };
+			if (objectSplit.axis < 0 || (doesOverlap && SurfaceArea(overlapMin, overlapMax) > SpatialSplitOverlap * state.rootArea))
+			{
+				spatialSplit = FindSpatialSplit(references, node, *state.pMesh);
+			}
+		}
+
+		if (count <= MaxLeafSize && leafCost <= objectSplit.cost && leafCost <= spatialSplit.cost)
+		{
+			const std::lock_guard lock{ state.leafMutex };
+			state.nodes[nodeIndex].first = static_cast<uint32_t>(state.triangles.size());
+			state.nodes[nodeIndex].count = count;
+			state.triangles.insert(state.triangles.end(), references.begin(), references.end());
+			return;
+		}
+
+		std::vector<BuildTriangle> left{};
+		std::vector<BuildTriangle> right{};
+		Bin leftBounds{};
+		Bin rightBounds{};
+
+		uint32_t numDuplicated{};
+		if (spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost)
+		{
+			const int axis{ spatialSplit.axis };
+			const float position{ spatialSplit.position };
+
+			//Split every straddling reference first, the children as the spatial split binned them
+			struct Straddling
+			{
+				const BuildTriangle* pWhole;
+				BuildTriangle leftPart;
+				BuildTriangle rightPart;
+			};
+			std::vector<Straddling> straddling{};
+			for (const BuildTriangle& reference : references)
+			{
+				Straddling parts{ &reference, {}, {} };
+				if (reference.boundsMax[axis] > position && reference.boundsMin[axis] < position)
+				{
+					SplitReference(reference, *state.pMesh, axis, position, parts.leftPart, parts.rightPart);
+				}
+
+				if (reference.boundsMax[axis] <= position || parts.rightPart.IsEmpty())
+				{
+					left.push_back(reference);
+					leftBounds.Grow(reference.boundsMin, reference.boundsMax, 1);
+				}
+				else if (reference.boundsMin[axis] >= position || parts.leftPart.IsEmpty())
+				{
+					right.push_back(reference);
+					rightBounds.Grow(reference.boundsMin, reference.boundsMax, 1);
+				}
+				else
+				{
+					leftBounds.Grow(parts.leftPart.boundsMin, parts.leftPart.boundsMax, 1);
+					rightBounds.Grow(parts.rightPart.boundsMin, parts.rightPart.boundsMax, 1);
+					straddling.push_back(parts);
+				}
+			}
+
+			//Then move a reference whole to one side when that is cheaper than duplicating it (or the budget ran out).
+			//The bounds only grow here, they are recomputed exactly below
+			for (const Straddling& parts : straddling)
+			{
+				Bin leftWithWhole{ leftBounds };
+				Bin rightWithWhole{ rightBounds };
+				leftWithWhole.Grow(parts.pWhole->boundsMin, parts.pWhole->boundsMax, 0);
+				rightWithWhole.Grow(parts.pWhole->boundsMin, parts.pWhole->boundsMax, 0);
+
+				const float splitCost{ leftBounds.GetArea() * leftBounds.count + rightBounds.GetArea() * rightBounds.count };
+				const float leftCost{ leftWithWhole.GetArea() * leftBounds.count + rightBounds.GetArea() * (rightBounds.count - 1) };
+				const float rightCost{ leftBounds.GetArea() * (leftBounds.count - 1) + rightWithWhole.GetArea() * rightBounds.count };
+
+				bool isSplit{ splitCost < leftCost && splitCost < rightCost };
+				if (isSplit && state.numReferences.fetch_add(1) >= state.maxReferences)
+				{
+					--state.numReferences;
+					isSplit = false;
+				}
+
+				if (isSplit)
+				{
+					left.push_back(parts.leftPart);
+					right.push_back(parts.rightPart);
+					++numDuplicated;
+				}
+				else if (leftCost <= rightCost)
+				{
+					left.push_back(*parts.pWhole);
+					leftBounds = leftWithWhole;
+					--rightBounds.count;
+				}
+				else
+				{
+					right.push_back(*parts.pWhole);
+					rightBounds = rightWithWhole;
+					--leftBounds.count;
+				}
+			}
+
+			if (!straddling.empty())
+			{
+				leftBounds = {};
+				rightBounds = {};
+				for (const BuildTriangle& reference : left)
+				{
+					leftBounds.Grow(reference.boundsMin, reference.boundsMax, 1);
+				}
+				for (const BuildTriangle& reference : right)
+				{
+					rightBounds.Grow(reference.boundsMin, reference.boundsMax, 1);
+				}
+			}
+		}
+
+		//Every straddling reference went to the same side, nothing was separated
+		if (left.empty() != right.empty())
+		{
+			state.numReferences -= numDuplicated;
+			left.clear();
+			right.clear();
+			leftBounds = {};
+			rightBounds = {};
+		}
+
+		if (left.empty() && right.empty())
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				//Middle split by index when no plane separates the centroids
+				const bool isLeft{ objectSplit.axis >= 0 ? objectSplit.IsLeft(references[i]) : i < count / 2 };
+				(isLeft ? left : right).push_back(references[i]);
+				(isLeft ? leftBounds : rightBounds).Grow(references[i].boundsMin, references[i].boundsMax, 1);
+			}
+		}
+
+		//The parent's references are spread over the children now
+		std::vector<BuildTriangle>().swap(references);
+
+		const uint32_t leftIndex{ state.numNodes.fetch_add(2) };
+		state.nodes[nodeIndex].first = leftIndex;
+		state.nodes[nodeIndex].count = 0;
+		state.nodes[leftIndex] = { leftBounds.boundsMin, leftBounds.boundsMax, 0, 0 };
+		state.nodes[leftIndex + 1] = { rightBounds.boundsMin, rightBounds.boundsMax, 0, 0 };
+
+		if (count >= ParallelBuildThreshold)
+		{
+			concurrency::parallel_invoke(
+				[&] { BuildSpatial(state, leftIndex, left, depth + 1); },
+				[&] { BuildSpatial(state, leftIndex + 1, right, depth + 1); });
+		}
+		else
+		{
+			BuildSpatial(state, leftIndex, left, depth + 1);
+			BuildSpatial(state, leftIndex + 1, right, depth + 1);
+		}
+	}
+
+	TriangleBVH::ObjectSplit TriangleBVH::FindObjectSplit(const BuildTriangle* pTriangles, uint32_t count, const BuildNode& node)
+	{
+		//Binned SAH, a packet tests 8 triangles in about the time of 2 node tests, so a triangle costs a quarter of a node.
+		//Big nodes (the top of the tree, before there are enough subtrees to go around) bin in parallel chunks
+		struct Chunk
+		{
+			Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			Bin bins[3][NumBins]{};
+		};
+
+		const uint32_t numChunks{ (count + BinningChunkSize - 1) / BinningChunkSize };
+		Chunk singleChunk{};
+		std::vector<Chunk> chunks{};
+		if (numChunks > 1)
+		{
+			chunks.resize(numChunks);
+		}
+		Chunk* pChunks{ numChunks > 1 ? chunks.data() : &singleChunk };
+
+		const auto forEachChunk = [&](const auto& function)
+			{
+				if (numChunks > 1)
+				{
+					concurrency::parallel_for(0u, numChunks, function);
+				}
+				else
+				{
+					function(0u);
+				}
+			};
+
+		forEachChunk([&](uint32_t c)
+			{
+				Chunk& chunk = pChunks[c];
+				const uint32_t chunkLast{ std::min((c + 1) * BinningChunkSize, count) };
+				for (uint32_t i = c * BinningChunkSize; i < chunkLast; ++i)
+				{
+					chunk.centroidMin = Vector3::Min(chunk.centroidMin, pTriangles[i].centroid);
+					chunk.centroidMax = Vector3::Max(chunk.centroidMax, pTriangles[i].centroid);
+				}
+			});
+
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t c = 0; c < numChunks; ++c)
+		{
+			centroidMin = Vector3::Min(centroidMin, pChunks[c].centroidMin);
+			centroidMax = Vector3::Max(centroidMax, pChunks[c].centroidMax);
+		}
+
+		float scales[3]{};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent{ centroidMax[axis] - centroidMin[axis] };
+			scales[axis] = extent > 0.f ? NumBins / extent : 0.f;
+		}
+
+		forEachChunk([&](uint32_t c)
+			{
+				Chunk& chunk = pChunks[c];
+				const uint32_t chunkLast{ std::min((c + 1) * BinningChunkSize, count) };
+				for (uint32_t i = c * BinningChunkSize; i < chunkLast; ++i)
+				{
+					const BuildTriangle& triangle = pTriangles[i];
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						const int bin{ std::min(static_cast<int>((triangle.centroid[axis] - centroidMin[axis]) * scales[axis]), NumBins - 1) };
+						chunk.bins[axis][bin].Grow(triangle.boundsMin, triangle.boundsMax, 1);
+					}
+				}
+			});
+
+		const float parentArea{ SurfaceArea(node.boundsMin, node.boundsMax) };
+		ObjectSplit best{};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (scales[axis] == 0.f)
+				continue;
+
+			Bin bins[NumBins]{};
+			for (uint32_t c = 0; c < numChunks; ++c)
+			{
+				for (int b = 0; b < NumBins; ++b)
+				{
+					bins[b].Grow(pChunks[c].bins[axis][b].boundsMin, pChunks[c].bins[axis][b].boundsMax, pChunks[c].bins[axis][b].count);
+				}
+			}
+
+			//Sweep from the right first, then evaluate every split plane from the left
+			Bin rights[NumBins]{};
+			Bin right{};
+			for (int b = NumBins - 1; b > 0; --b)
+			{
+				right.Grow(bins[b].boundsMin, bins[b].boundsMax, bins[b].count);
+				rights[b] = right;
+			}
+
+			Bin left{};
+			for (int b = 0; b < NumBins - 1; ++b)
+			{
+				left.Grow(bins[b].boundsMin, bins[b].boundsMax, bins[b].count);
+				if (left.count == 0 || rights[b + 1].count == 0)
+					continue;
+
+				const float cost{ 1.f + TriangleCost * (left.GetArea() * left.count + rights[b + 1].GetArea() * rights[b + 1].count) / parentArea };
+				if (cost < best.cost)
+				{
+					best = { cost, axis, b, centroidMin[axis], scales[axis], left.boundsMin, left.boundsMax, rights[b + 1].boundsMin, rights[b + 1].boundsMax };
+				}
+			}
+		}
+
+		return best;
+	}
+
+	bool TriangleBVH::ObjectSplit::IsLeft(const BuildTriangle& triangle) const
+	{
+		return std::min(static_cast<int>((triangle.centroid[axis] - binOrigin) * binScale), NumBins - 1) <= bin;
+	}
+
+	TriangleBVH::SpatialSplit TriangleBVH::FindSpatialSplit(const std::vector<BuildTriangle>& references, const BuildNode& node, const TriangleMesh& mesh)
+	{
+		//Bins over the node bounds instead of the centroids. A reference is chopped at every bin plane it crosses,
+		//each bin grows by the part inside it, the entry and exit bins count the reference
+		const float parentArea{ SurfaceArea(node.boundsMin, node.boundsMax) };
+		SpatialSplit best{};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float origin{ node.boundsMin[axis] };
+			const float extent{ node.boundsMax[axis] - origin };
+			if (extent <= 0.f)
+				continue;
+
+			const float binWidth{ extent / NumBins };
+			Bin bins[NumBins]{};
+			uint32_t entries[NumBins]{};
+			uint32_t exits[NumBins]{};
+			for (const BuildTriangle& reference : references)
+			{
+				const int firstBin{ std::clamp(static_cast<int>((reference.boundsMin[axis] - origin) / binWidth), 0, NumBins - 1) };
+				const int lastBin{ std::clamp(static_cast<int>((reference.boundsMax[axis] - origin) / binWidth), firstBin, NumBins - 1) };
+
+				BuildTriangle remaining{ reference };
+				int exitBin{ firstBin };
+				for (int b = firstBin; b < lastBin; ++b)
+				{
+					BuildTriangle part{};
+					SplitReference(remaining, mesh, axis, origin + binWidth * (b + 1), part, remaining);
+					if (!part.IsEmpty())
+					{
+						bins[b].Grow(part.boundsMin, part.boundsMax, 0);
+						exitBin = b;
+					}
+					if (remaining.IsEmpty())
+						break;
+				}
+				if (!remaining.IsEmpty())
+				{
+					bins[lastBin].Grow(remaining.boundsMin, remaining.boundsMax, 0);
+					exitBin = lastBin;
+				}
+
+				++entries[firstBin];
+				++exits[exitBin];
+			}
+
+			Bin rights[NumBins]{};
+			uint32_t rightCounts[NumBins]{};
+			Bin right{};
+			uint32_t rightCount{};
+			for (int b = NumBins - 1; b > 0; --b)
+			{
+				right.Grow(bins[b].boundsMin, bins[b].boundsMax, 0);
+				rightCount += exits[b];
+				rights[b] = right;
+				rightCounts[b] = rightCount;
+			}
+
+			Bin left{};
+			uint32_t leftCount{};
+			for (int b = 0; b < NumBins - 1; ++b)
+			{
+				left.Grow(bins[b].boundsMin, bins[b].boundsMax, 0);
+				leftCount += entries[b];
+				if (leftCount == 0 || rightCounts[b + 1] == 0)
+					continue;
+
+				const float cost{ 1.f + TriangleCost * (left.GetArea() * leftCount + rights[b + 1].GetArea() * rightCounts[b + 1]) / parentArea };
+				if (cost < best.cost)
+				{
+					best = { cost, axis, origin + binWidth * (b + 1) };
+				}
+			}
+		}
+
+		return best;
+	}
+
+	void TriangleBVH::SplitReference(const BuildTriangle& reference, const TriangleMesh& mesh, int axis, float position, BuildTriangle& left, BuildTriangle& right)
+	{
+		//Bounds of the triangle corners and edge crossings on each side of the plane,
+		//clipped to the reference since earlier splits may have cut the triangle already
+		Bin leftBounds{};
+		Bin rightBounds{};
+		const uint32_t triangleIndex{ reference.triangleIndex };
+		for (int i = 0; i < 3; ++i)
+		{
+			const Vector3 v0{ mesh.GetTransformedPosition(triangleIndex, i) };
+			const Vector3 v1{ mesh.GetTransformedPosition(triangleIndex, (i + 1) % 3) };
+			const float p0{ v0[axis] };
+			const float p1{ v1[axis] };
+
+			if (p0 <= position)
+			{
+				leftBounds.Grow(v0, v0, 0);
+			}
+			if (p0 >= position)
+			{
+				rightBounds.Grow(v0, v0, 0);
+			}
+			if ((p0 < position && position < p1) || (p1 < position && position < p0))
+			{
+				Vector3 crossing{ v0 + (v1 - v0) * std::clamp((position - p0) / (p1 - p0), 0.f, 1.f) };
+				crossing[axis] = position;
+				leftBounds.Grow(crossing, crossing, 0);
+				rightBounds.Grow(crossing, crossing, 0);
+			}
+		}
+
+		left.boundsMin = Vector3::Max(leftBounds.boundsMin, reference.boundsMin);
+		left.boundsMax = Vector3::Min(leftBounds.boundsMax, reference.boundsMax);
+		left.boundsMax[axis] = std::min(left.boundsMax[axis], position);
+		right.boundsMin = Vector3::Max(rightBounds.boundsMin, reference.boundsMin);
+		right.boundsMax = Vector3::Min(rightBounds.boundsMax, reference.boundsMax);
+		right.boundsMin[axis] = std::max(right.boundsMin[axis], position);
+
+		left.centroid = (left.boundsMin + left.boundsMax) * 0.5f;
+		right.centroid = (right.boundsMin + right.boundsMax) * 0.5f;
+		left.triangleIndex = triangleIndex;
+		right.triangleIndex = triangleIndex;
+	}
+
+	void TriangleBVH::SortMorton(BuildState& state, const Vector3& centroidMin, const Vector3& centroidMax) const
+	{
+		const uint32_t numTriangles{ static_cast<uint32_t>(state.triangles.size()) };
+		const bool useWideCodes{ numTriangles > WideMortonThreshold };
+		const float gridMax{ useWideCodes ? static_cast<float>((1 << 21) - 1) : static_cast<float>((1 << 10) - 1) };
+
+		const Vector3 extent{ centroidMax - centroidMin };
+		const Vector3 scale{ extent.x > 0.f ? gridMax / extent.x : 0.f, extent.y > 0.f ? gridMax / extent.y : 0.f, extent.z > 0.f ? gridMax / extent.z : 0.f };
+
+		FrameVector<MortonPrimitive> primitives(numTriangles);
+		concurrency::parallel_for(0u, numTriangles, [&](uint32_t i)
+			{
+				const Vector3 offset{ state.triangles[i].centroid - centroidMin };
+				const uint32_t x{ static_cast<uint32_t>(std::clamp(offset.x * scale.x, 0.f, gridMax)) };
+				const uint32_t y{ static_cast<uint32_t>(std::clamp(offset.y * scale.y, 0.f, gridMax)) };
+				const uint32_t z{ static_cast<uint32_t>(std::clamp(offset.z * scale.z, 0.f, gridMax)) };
+
+				const uint64_t code{ useWideCodes
+					? (ExpandBits21(x) << 2) | (ExpandBits21(y) << 1) | ExpandBits21(z)
+					: (ExpandBits10(x) << 2) | (ExpandBits10(y) << 1) | ExpandBits10(z) };
+				primitives[i] = { code, i };
+			});
+
+		concurrency::parallel_sort(primitives.begin(), primitives.end(), [](const MortonPrimitive& a, const MortonPrimitive& b)
+			{
+				return a.code < b.code;
+			});
+
+		FrameVector<BuildTriangle> sortedTriangles(numTriangles);
+		state.mortonCodes.resize(numTriangles);
+		concurrency::parallel_for(0u, numTriangles, [&](uint32_t i)
+			{
+				sortedTriangles[i] = state.triangles[primitives[i].triangle];
+				state.mortonCodes[i] = primitives[i].code;
+			});
+		state.triangles = std::move(sortedTriangles);
+	}
+
+	void TriangleBVH::BuildMorton(BuildState& state, uint32_t nodeIndex) const
+	{
+		//Storage doesn't move during the build, sibling tasks only touch their own nodes
+		BuildNode& node = state.nodes[nodeIndex];
+		const uint32_t first{ node.first };
+		const uint32_t count{ node.count };
+		const uint32_t last{ first + count };
+
+		if (count <= MaxLeafSize)
+		{
+			Bin bounds{};
+			for (uint32_t i = first; i < last; ++i)
+			{
+				bounds.Grow(state.triangles[i].boundsMin, state.triangles[i].boundsMax, 1);
+			}
+			node.boundsMin = bounds.boundsMin;
+			node.boundsMax = bounds.boundsMax;
+			return;
+		}
+
+		//Split where the highest differing bit of the range flips, the codes share everything above it.
+		//All codes equal (coinciding centroids), split in the middle
+		const uint64_t firstCode{ state.mortonCodes[first] };
+		const uint64_t lastCode{ state.mortonCodes[last - 1] };
+		uint32_t middle{ first + count / 2 };
+		if (firstCode != lastCode)
+		{
+			const uint64_t splitBit{ uint64_t{ 1 } << (63 - std::countl_zero(firstCode ^ lastCode)) };
+			const auto it = std::partition_point(state.mortonCodes.begin() + first, state.mortonCodes.begin() + last, [=](uint64_t code)
+				{
+					return (code & splitBit) == 0;
+				});
+			middle = static_cast<uint32_t>(it - state.mortonCodes.begin());
+		}
+
+		const uint32_t leftIndex{ state.numNodes.fetch_add(2) };
+		node.first = leftIndex;
+		node.count = 0;
+		state.nodes[leftIndex] = { {}, {}, first, middle - first };
+		state.nodes[leftIndex + 1] = { {}, {}, middle, last - middle };
+
+		if (count >= ParallelBuildThreshold)
+		{
+			concurrency::parallel_invoke(
+				[&] { BuildMorton(state, leftIndex); },
+				[&] { BuildMorton(state, leftIndex + 1); });
+		}
+		else
+		{
+			BuildMorton(state, leftIndex);
+			BuildMorton(state, leftIndex + 1);
+		}
+
+		//Bottom up, unlike the SAH build there were no bins to take the bounds from
+		node.boundsMin = Vector3::Min(state.nodes[leftIndex].boundsMin, state.nodes[leftIndex + 1].boundsMin);
+		node.boundsMax = Vector3::Max(state.nodes[leftIndex].boundsMax, state.nodes[leftIndex + 1].boundsMax);
+	}
+
+	uint32_t TriangleBVH::Collapse(const BuildState& state, const TriangleMesh& mesh, uint32_t buildNodeIndex, float rootArea)
+	{
+		const BuildNode& buildNode = state.nodes[buildNodeIndex];
+		m_BuildStats.sahCost += SurfaceArea(buildNode.boundsMin, buildNode.boundsMax) / rootArea;
+
+		//Pull grandchildren up until the node is full, largest (most likely hit) interior children first
+		uint32_t children[Width]{ buildNode.first, buildNode.first + 1 };
+		int numChildren{ 2 };
+		while (numChildren < Width)
+		{
+			int largest{ -1 };
+			float largestArea{ -1.f };
+			for (int i = 0; i < numChildren; ++i)
+			{
+				const BuildNode& child = state.nodes[children[i]];
+				const float area{ SurfaceArea(child.boundsMin, child.boundsMax) };
+				if (child.count == 0 && area > largestArea)
+				{
+					largest = i;
+					largestArea = area;
+				}
+			}
+
+			if (largest < 0)
+				break;
+
+			const uint32_t grandchild{ state.nodes[children[largest]].first };
+			children[largest] = grandchild;
+			children[numChildren++] = grandchild + 1;
+		}
+
+		const uint32_t nodeIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+		AddNode();
+
+		for (int i = 0; i < numChildren; ++i)
+		{
+			const BuildNode& child = state.nodes[children[i]];
+			uint32_t reference{};
+			if (child.count > 0)
+			{
+				reference = LeafFlag | CreatePacket(child, state, mesh);
+				m_BuildStats.sahCost += SurfaceArea(child.boundsMin, child.boundsMax) / rootArea;
+			}
+			else
+			{
+				reference = Collapse(state, mesh, children[i], rootArea);
+			}
+
+			//The recursion grows m_Nodes, look the node up again
+			Node& node = m_Nodes[nodeIndex];
+			node.minX[i] = child.boundsMin.x;
+			node.minY[i] = child.boundsMin.y;
+			node.minZ[i] = child.boundsMin.z;
+			node.maxX[i] = child.boundsMax.x;
+			node.maxY[i] = child.boundsMax.y;
+			node.maxZ[i] = child.boundsMax.z;
+			node.children[i] = reference;
+		}
+
+		return nodeIndex;
+	}
+
+	uint32_t TriangleBVH::CreatePacket(const BuildNode& leaf, const BuildState& state, const TriangleMesh& mesh)
+	{
+		assert(leaf.count <= MaxLeafSize);
+
+		if (m_IsCompressed)
+		{
+			ReferencePacket& references = m_ReferencePackets.emplace_back();
+			std::fill(std::begin(references.triangleIndices), std::end(references.triangleIndices), EmptyChild);
+			for (uint32_t lane = 0; lane < leaf.count; ++lane)
+			{
+				references.triangleIndices[lane] = state.triangles[leaf.first + lane].triangleIndex;
+			}
+			return static_cast<uint32_t>(m_ReferencePackets.size() - 1);
+		}
+
+		TrianglePacket& packet = m_Packets.emplace_back();
+		std::memset(&packet, 0, sizeof(TrianglePacket));
+
+		for (uint32_t lane = 0; lane < leaf.count; ++lane)
+		{
+			const uint32_t triangleIndex{ state.triangles[leaf.first + lane].triangleIndex };
+			const Vector3 v0{ mesh.GetTransformedPosition(triangleIndex, 0) };
+			const Vector3 v1{ mesh.GetTransformedPosition(triangleIndex, 1) };
+			const Vector3 v2{ mesh.GetTransformedPosition(triangleIndex, 2) };
+			const Vector3 normal{ mesh.GetTransformedNormal(triangleIndex) };
+
+			packet.v0X[lane] = v0.x;
+			packet.v0Y[lane] = v0.y;
+			packet.v0Z[lane] = v0.z;
+			packet.v1X[lane] = v1.x;
+			packet.v1Y[lane] = v1.y;
+			packet.v1Z[lane] = v1.z;
+			packet.v2X[lane] = v2.x;
+			packet.v2Y[lane] = v2.y;
+			packet.v2Z[lane] = v2.z;
+			packet.normalX[lane] = normal.x;
+			packet.normalY[lane] = normal.y;
+			packet.normalZ[lane] = normal.z;
+			packet.triangleIndices[lane] = triangleIndex;
+		}
+
+		return static_cast<uint32_t>(m_Packets.size() - 1);
+	}
+
+	const TriangleBVH::TrianglePacket& TriangleBVH::DecodePacket(const TriangleMesh& mesh, const ReferencePacket& references, TrianglePacket& packet)
+	{
+		for (int lane = 0; lane < Width; ++lane)
+		{
+			const uint32_t triangleIndex{ references.triangleIndices[lane] };
+			packet.triangleIndices[lane] = triangleIndex;
+			if (triangleIndex == EmptyChild)
+			{
+				//Zero normal, the lane is never valid
+				packet.v0X[lane] = packet.v0Y[lane] = packet.v0Z[lane] = 0.f;
+				packet.v1X[lane] = packet.v1Y[lane] = packet.v1Z[lane] = 0.f;
+				packet.v2X[lane] = packet.v2Y[lane] = packet.v2Z[lane] = 0.f;
+				packet.normalX[lane] = packet.normalY[lane] = packet.normalZ[lane] = 0.f;
+				continue;
+			}
+
+			const Vector3 v0{ mesh.GetTransformedPosition(triangleIndex, 0) };
+			const Vector3 v1{ mesh.GetTransformedPosition(triangleIndex, 1) };
+			const Vector3 v2{ mesh.GetTransformedPosition(triangleIndex, 2) };
+			const Vector3 normal{ mesh.GetTransformedNormal(triangleIndex) };
+			packet.v0X[lane] = v0.x;
+			packet.v0Y[lane] = v0.y;
+			packet.v0Z[lane] = v0.z;
+			packet.v1X[lane] = v1.x;
+			packet.v1Y[lane] = v1.y;
+			packet.v1Z[lane] = v1.z;
+			packet.v2X[lane] = v2.x;
+			packet.v2Y[lane] = v2.y;
+			packet.v2Z[lane] = v2.z;
+			packet.normalX[lane] = normal.x;
+			packet.normalY[lane] = normal.y;
+			packet.normalZ[lane] = normal.z;
+		}
+		return packet;
+	}
+
+	size_t TriangleBVH::GetNumBytes() const
+	{
+		return m_Nodes.capacity() * sizeof(Node) + m_Packets.capacity() * sizeof(TrianglePacket) + m_ReferencePackets.capacity() * sizeof(ReferencePacket);
+	}
+
+	TriangleBVH::Node& TriangleBVH::AddNode()
+	{
+		Node& node = m_Nodes.emplace_back();
+		std::fill(std::begin(node.minX), std::end(node.minX), FLT_MAX);
+		std::fill(std::begin(node.minY), std::end(node.minY), FLT_MAX);
+		std::fill(std::begin(node.minZ), std::end(node.minZ), FLT_MAX);
+		std::fill(std::begin(node.maxX), std::end(node.maxX), -FLT_MAX);
+		std::fill(std::begin(node.maxY), std::end(node.maxY), -FLT_MAX);
+		std::fill(std::begin(node.maxZ), std::end(node.maxZ), -FLT_MAX);
+		std::fill(std::begin(node.children), std::end(node.children), EmptyChild);
+		return node;
+	}
+
+	template<TriangleKernel Kernel>
+	bool TriangleBVH::IntersectWith(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord) const
+	{
+		if (m_Nodes.empty())
+			return false;
+
+		const __m256 originX{ _mm256_set1_ps(ray.origin.x) };
+		const __m256 originY{ _mm256_set1_ps(ray.origin.y) };
+		const __m256 originZ{ _mm256_set1_ps(ray.origin.z) };
+		const __m256 directionX{ _mm256_set1_ps(ray.GetDirection().x) };
+		const __m256 directionY{ _mm256_set1_ps(ray.GetDirection().y) };
+		const __m256 directionZ{ _mm256_set1_ps(ray.GetDirection().z) };
+		const __m256 inverseX{ _mm256_set1_ps(ray.inverseDirection.x) };
+		const __m256 inverseY{ _mm256_set1_ps(ray.inverseDirection.y) };
+		const __m256 inverseZ{ _mm256_set1_ps(ray.inverseDirection.z) };
+		//Far plane distances are widened by the rounding error bound so rounding never culls a box the ray grazes
+		const __m256 farInverseX{ _mm256_set1_ps(ray.inverseDirection.x * SLAB_FAR_SCALE) };
+		const __m256 farInverseY{ _mm256_set1_ps(ray.inverseDirection.y * SLAB_FAR_SCALE) };
+		const __m256 farInverseZ{ _mm256_set1_ps(ray.inverseDirection.z * SLAB_FAR_SCALE) };
+		const __m256 rayMin{ _mm256_set1_ps(ray.min) };
+		const __m256 rayMax{ _mm256_set1_ps(ray.max) };
+
+		//The near plane of each slab depends on the direction sign, inverted (empty) boxes then never overlap
+		const bool isNegativeX{ ray.isDirectionNegative[0] };
+		const bool isNegativeY{ ray.isDirectionNegative[1] };
+		const bool isNegativeZ{ ray.isDirectionNegative[2] };
+
+		//Culling as in HitTest_Triangle, shadow rays (ignoreHitRecord) flip it
+		const __m256 zero{ _mm256_setzero_ps() };
+		const bool cullPositive{ (mesh.cullMode == TriangleCullMode::BackFaceCulling) != ignoreHitRecord };
+		const bool isCulling{ mesh.cullMode != TriangleCullMode::NoCulling };
+
+		//Watertight only, the vertex axes that become x, y and z of the sheared space
+		const GeometryUtils::WatertightRay watertightRay{ Kernel == TriangleKernel::Watertight ? GeometryUtils::MakeWatertightRay(ray) : GeometryUtils::WatertightRay{} };
+		const int kx{ watertightRay.kx };
+		const int ky{ watertightRay.ky };
+		const int kz{ watertightRay.kz };
+		const __m256 originKX{ _mm256_set1_ps(ray.origin[kx]) };
+		const __m256 originKY{ _mm256_set1_ps(ray.origin[ky]) };
+		const __m256 originKZ{ _mm256_set1_ps(ray.origin[kz]) };
+		const __m256 shearX{ _mm256_set1_ps(watertightRay.shearX) };
+		const __m256 shearY{ _mm256_set1_ps(watertightRay.shearY) };
+		const __m256 shearZ{ _mm256_set1_ps(watertightRay.shearZ) };
+
+		//Shadow rays only care about the ray extent, like the fresh record HitTest_TriangleMesh uses for them
+		float closestT{ ignoreHitRecord ? FLT_MAX : hitRecord.t };
+		uint32_t closestTriangle{ EmptyChild };
+		float closestU{};
+		float closestV{};
+
+		struct StackEntry
+		{
+			uint32_t reference;
+			float t;
+		};
+		constexpr int StackSize{ 256 };
+		StackEntry stack[StackSize];
+		int stackSize{ 0 };
+		stack[stackSize++] = { 0, ray.min };
+
+		//Compressed meshes, the leaf being tested
+		assert(m_IsCompressed == mesh.isCompressed);
+		TrianglePacket decodedPacket;
+
+		while (stackSize > 0)
+		{
+			const StackEntry entry{ stack[--stackSize] };
+			if (entry.t > closestT)
+				continue;
+
+			if (entry.reference & LeafFlag)
+			{
+				const uint32_t packetIndex{ entry.reference & ~LeafFlag };
+				const TrianglePacket& packet = m_IsCompressed ? DecodePacket(mesh, m_ReferencePackets[packetIndex], decodedPacket) : m_Packets[packetIndex];
+
+				const __m256 dotNV{ Dot(_mm256_load_ps(packet.normalX), _mm256_load_ps(packet.normalY), _mm256_load_ps(packet.normalZ), directionX, directionY, directionZ) };
+				__m256 valid{ _mm256_cmp_ps(dotNV, zero, _CMP_NEQ_OQ) };
+				if (isCulling)
+				{
+					valid = _mm256_and_ps(valid, cullPositive ? _mm256_cmp_ps(dotNV, zero, _CMP_LE_OQ) : _mm256_cmp_ps(dotNV, zero, _CMP_GE_OQ));
+				}
+
+				const __m256 one{ _mm256_set1_ps(1.f) };
+				__m256 t;
+				__m256 u;
+				__m256 v;
+				if constexpr (Kernel == TriangleKernel::Watertight)
+				{
+					//Same operation order as HitDistance_TriangleWatertight
+					const float* const v0[3]{ packet.v0X, packet.v0Y, packet.v0Z };
+					const float* const v1[3]{ packet.v1X, packet.v1Y, packet.v1Z };
+					const float* const v2[3]{ packet.v2X, packet.v2Y, packet.v2Z };
+					const __m256 az{ _mm256_sub_ps(_mm256_load_ps(v0[kz]), originKZ) };
+					const __m256 bz{ _mm256_sub_ps(_mm256_load_ps(v1[kz]), originKZ) };
+					const __m256 cz{ _mm256_sub_ps(_mm256_load_ps(v2[kz]), originKZ) };
+					const __m256 ax{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v0[kx]), originKX), _mm256_mul_ps(shearX, az)) };
+					const __m256 ay{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v0[ky]), originKY), _mm256_mul_ps(shearY, az)) };
+					const __m256 bx{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v1[kx]), originKX), _mm256_mul_ps(shearX, bz)) };
+					const __m256 by{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v1[ky]), originKY), _mm256_mul_ps(shearY, bz)) };
+					const __m256 cx{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v2[kx]), originKX), _mm256_mul_ps(shearX, cz)) };
+					const __m256 cy{ _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v2[ky]), originKY), _mm256_mul_ps(shearY, cz)) };
+
+					__m256 edgeU{ MulSub(cx, by, cy, bx) };
+					__m256 edgeV{ MulSub(ax, cy, ay, cx) };
+					__m256 edgeW{ MulSub(bx, ay, by, ax) };
+
+					//Rays exactly through an edge or vertex, redo those lanes in double precision
+					const __m256 anyZero{ _mm256_or_ps(_mm256_cmp_ps(edgeU, zero, _CMP_EQ_OQ), _mm256_or_ps(_mm256_cmp_ps(edgeV, zero, _CMP_EQ_OQ), _mm256_cmp_ps(edgeW, zero, _CMP_EQ_OQ))) };
+					int zeroMask{ _mm256_movemask_ps(_mm256_and_ps(anyZero, valid)) };
+					if (zeroMask != 0)
+					{
+						alignas(32) float values[9][Width];
+						_mm256_store_ps(values[0], ax);
+						_mm256_store_ps(values[1], ay);
+						_mm256_store_ps(values[2], bx);
+						_mm256_store_ps(values[3], by);
+						_mm256_store_ps(values[4], cx);
+						_mm256_store_ps(values[5], cy);
+						_mm256_store_ps(values[6], edgeU);
+						_mm256_store_ps(values[7], edgeV);
+						_mm256_store_ps(values[8], edgeW);
+						while (zeroMask != 0)
+						{
+							const int lane{ std::countr_zero(static_cast<uint32_t>(zeroMask)) };
+							zeroMask &= zeroMask - 1;
+							const double laneAX{ values[0][lane] };
+							const double laneAY{ values[1][lane] };
+							const double laneBX{ values[2][lane] };
+							const double laneBY{ values[3][lane] };
+							const double laneCX{ values[4][lane] };
+							const double laneCY{ values[5][lane] };
+							values[6][lane] = static_cast<float>(laneCX * laneBY - laneCY * laneBX);
+							values[7][lane] = static_cast<float>(laneAX * laneCY - laneAY * laneCX);
+							values[8][lane] = static_cast<float>(laneBX * laneAY - laneBY * laneAX);
+						}
+						edgeU = _mm256_load_ps(values[6]);
+						edgeV = _mm256_load_ps(values[7]);
+						edgeW = _mm256_load_ps(values[8]);
+					}
+
+					//Inside when the edge functions don't have mixed signs
+					const __m256 anyNegative{ _mm256_or_ps(_mm256_cmp_ps(edgeU, zero, _CMP_LT_OQ), _mm256_or_ps(_mm256_cmp_ps(edgeV, zero, _CMP_LT_OQ), _mm256_cmp_ps(edgeW, zero, _CMP_LT_OQ))) };
+					const __m256 anyPositive{ _mm256_or_ps(_mm256_cmp_ps(edgeU, zero, _CMP_GT_OQ), _mm256_or_ps(_mm256_cmp_ps(edgeV, zero, _CMP_GT_OQ), _mm256_cmp_ps(edgeW, zero, _CMP_GT_OQ))) };
+					valid = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), valid);
+
+					const __m256 det{ _mm256_add_ps(_mm256_add_ps(edgeU, edgeV), edgeW) };
+					valid = _mm256_and_ps(valid, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+					const __m256 inverseDet{ _mm256_div_ps(one, det) };
+					t = _mm256_mul_ps(_mm256_mul_ps(shearZ, Dot(edgeU, edgeV, edgeW, az, bz, cz)), inverseDet);
+					u = _mm256_mul_ps(edgeV, inverseDet);
+					v = _mm256_mul_ps(edgeW, inverseDet);
+				}
+				else
+				{
+					const __m256 v0X{ _mm256_load_ps(packet.v0X) };
+					const __m256 v0Y{ _mm256_load_ps(packet.v0Y) };
+					const __m256 v0Z{ _mm256_load_ps(packet.v0Z) };
+					const __m256 edge1X{ _mm256_sub_ps(_mm256_load_ps(packet.v1X), v0X) };
+					const __m256 edge1Y{ _mm256_sub_ps(_mm256_load_ps(packet.v1Y), v0Y) };
+					const __m256 edge1Z{ _mm256_sub_ps(_mm256_load_ps(packet.v1Z), v0Z) };
+					const __m256 edge2X{ _mm256_sub_ps(_mm256_load_ps(packet.v2X), v0X) };
+					const __m256 edge2Y{ _mm256_sub_ps(_mm256_load_ps(packet.v2Y), v0Y) };
+					const __m256 edge2Z{ _mm256_sub_ps(_mm256_load_ps(packet.v2Z), v0Z) };
+
+					//Moller-Trumbore, same operation order as HitDistance_Triangle
+					const __m256 pX{ MulSub(directionY, edge2Z, directionZ, edge2Y) };
+					const __m256 pY{ MulSub(directionZ, edge2X, directionX, edge2Z) };
+					const __m256 pZ{ MulSub(directionX, edge2Y, directionY, edge2X) };
+					const __m256 inverseDet{ _mm256_div_ps(one, Dot(edge1X, edge1Y, edge1Z, pX, pY, pZ)) };
+
+					const __m256 tX{ _mm256_sub_ps(originX, v0X) };
+					const __m256 tY{ _mm256_sub_ps(originY, v0Y) };
+					const __m256 tZ{ _mm256_sub_ps(originZ, v0Z) };
+					u = _mm256_mul_ps(inverseDet, Dot(tX, tY, tZ, pX, pY, pZ));
+					valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+					const __m256 qX{ MulSub(tY, edge1Z, tZ, edge1Y) };
+					const __m256 qY{ MulSub(tZ, edge1X, tX, edge1Z) };
+					const __m256 qZ{ MulSub(tX, edge1Y, tY, edge1X) };
+					v = _mm256_mul_ps(inverseDet, Dot(directionX, directionY, directionZ, qX, qY, qZ));
+					valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+					t = _mm256_mul_ps(inverseDet, Dot(edge2X, edge2Y, edge2Z, qX, qY, qZ));
+				}
+
+				valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, rayMin, _CMP_GE_OQ), _mm256_cmp_ps(t, rayMax, _CMP_LE_OQ)));
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ));
+
+				int hitMask{ _mm256_movemask_ps(valid) };
+				if (hitMask == 0)
+					continue;
+
+				if (ignoreHitRecord)
+					return true;
+
+				alignas(32) float tValues[Width];
+				alignas(32) float uValues[Width];
+				alignas(32) float vValues[Width];
+				_mm256_store_ps(tValues, t);
+				_mm256_store_ps(uValues, u);
+				_mm256_store_ps(vValues, v);
+				while (hitMask != 0)
+				{
+					const int lane{ std::countr_zero(static_cast<uint32_t>(hitMask)) };
+					hitMask &= hitMask - 1;
+					if (tValues[lane] < closestT)
+					{
+						closestT = tValues[lane];
+						closestU = uValues[lane];
+						closestV = vValues[lane];
+						closestTriangle = packet.triangleIndices[lane];
+					}
+				}
+				continue;
+			}
+
+			const Node& node = m_Nodes[entry.reference];
+			const __m256 nearX{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeX ? node.maxX : node.minX), originX), inverseX) };
+			const __m256 nearY{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeY ? node.maxY : node.minY), originY), inverseY) };
+			const __m256 nearZ{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeZ ? node.maxZ : node.minZ), originZ), inverseZ) };
+			const __m256 farX{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeX ? node.minX : node.maxX), originX), farInverseX) };
+			const __m256 farY{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeY ? node.minY : node.maxY), originY), farInverseY) };
+			const __m256 farZ{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(isNegativeZ ? node.minZ : node.maxZ), originZ), farInverseZ) };
+
+			//max/min return the second operand for NaN (0 * inf, origin on a slab plane), so the slab terms go first and get dropped
+			const __m256 tNear{ _mm256_max_ps(nearX, _mm256_max_ps(nearY, _mm256_max_ps(nearZ, rayMin))) };
+			const __m256 tFar{ _mm256_min_ps(farX, _mm256_min_ps(farY, _mm256_min_ps(farZ, _mm256_set1_ps(std::min(ray.max, closestT))))) };
+			const __m256 hitLanes{ _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ) };
+			const int hitMask{ _mm256_movemask_ps(hitLanes) };
+			if (hitMask == 0)
+				continue;
+
+			//Distance in the high bits (positive floats order like integers), lane in the low 3, misses sort last
+			alignas(32) float tNearValues[Width];
+			alignas(32) uint32_t keys[Width];
+			_mm256_store_ps(tNearValues, tNear);
+			const __m256 distanceKeys{ _mm256_or_ps(_mm256_and_ps(tNear, _mm256_castsi256_ps(_mm256_set1_epi32(~7))), _mm256_castsi256_ps(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))) };
+			_mm256_store_ps(reinterpret_cast<float*>(keys), _mm256_blendv_ps(_mm256_castsi256_ps(_mm256_set1_epi32(-1)), distanceKeys, hitLanes));
+			SortNetwork8(keys);
+
+			//Farthest first, so the nearest child is popped next
+			const int numHits{ std::popcount(static_cast<uint32_t>(hitMask)) };
+			assert(stackSize + numHits <= StackSize);
+			for (int i = numHits - 1; i >= 0; --i)
+			{
+				const uint32_t lane{ keys[i] & 7u };
+				stack[stackSize++] = { node.children[lane], tNearValues[lane] };
+			}
+		}
+
+		if (closestTriangle == EmptyChild)
+			return false;
+
+		hitRecord.t = closestT;
+		hitRecord.u = closestU;
+		hitRecord.v = closestV;
+		hitRecord.primitiveIndex = closestTriangle;
+		hitRecord.pMesh = &mesh;
+		hitRecord.geometry = HitGeometry::Triangle;
+		return true;
+	}
+
+	bool TriangleBVH::Intersect(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord, TriangleKernel kernel) const
+	{
+		//Resolved once per ray, the traversal loop is compiled for each kernel
+		return kernel == TriangleKernel::Watertight ? IntersectWith<TriangleKernel::Watertight>(mesh, ray, hitRecord, ignoreHitRecord)
+			: IntersectWith<TriangleKernel::MollerTrumbore>(mesh, ray, hitRecord, ignoreHitRecord);
+	}
+}
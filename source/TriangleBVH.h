@@ -0,0 +1,198 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Math.h"
+#include "DataTypes.h"
+#include "FrameArena.h"
+
+namespace dae
+{
+	enum class BVHBuildMethod
+	{
+		BinnedSAH, //High quality, for static geometry
+		SpatialSplitSAH, //Binned SAH that may also split triangles across planes, for long thin or overlapping triangles
+		MortonLBVH //Fast, for rebuilds every frame
+	};
+
+	/**
+	 * \brief 8-wide bounding volume hierarchy over the (transformed) triangles of a mesh.
+	 * Built as a binary tree first, then collapsed so every node holds up to 8 children, their bounds stored as
+	 * structure of arrays so one AVX pass slab-tests all of them. Hit children are visited nearest first, sorted with a
+	 * sorting network. Leaves are packets of up to 8 triangles, intersected together with the same culling rules as HitTest_Triangle.
+	 */
+	class TriangleBVH final
+	{
+	public:
+		struct BuildStats
+		{
+			double buildTime{}; //Seconds
+			float sahCost{}; //Expected node and packet tests for a ray hitting the root box, lower is better
+			uint32_t numNodes{};
+			uint32_t numPackets{};
+			uint32_t numReferences{}; //Triangles in the leaves, more than the mesh has when spatial splits duplicated some
+		};
+
+		/**
+		 * \brief Rebuilds the tree over the transformed positions of the mesh, call after UpdateTransforms
+		 * \param method BinnedSAH splits by surface area heuristic, task parallel over subtrees.
+		 * SpatialSplitSAH also considers planes that cut triangles in two, the parts are referenced from both sides.
+		 * MortonLBVH sorts the triangles along a Morton curve and splits on the code bits, several times faster but looser.
+		 * \param spatialSplitBudget Extra triangle references spatial splits may add, relative to the triangle count
+		 */
+		void Build(const TriangleMesh& mesh, BVHBuildMethod method = BVHBuildMethod::BinnedSAH, float spatialSplitBudget = 0.3f);
+
+		/**
+		 * \brief Same contract as GeometryUtils::HitTest_TriangleMesh, records which triangle was hit, not its attributes
+		 * \param hitRecord Only overwritten by hits closer than its current t
+		 * \param ignoreHitRecord Any hit (shadow rays), returns on the first one found with the culling flipped like HitTest_Triangle
+		 * \param kernel Triangle test of the leaves, the same results as the scalar one of GeometryUtils
+		 */
+		bool Intersect(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false,
+			TriangleKernel kernel = TriangleKernel::MollerTrumbore) const;
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		size_t GetNumNodes() const { return m_Nodes.size(); }
+		const BuildStats& GetBuildStats() const { return m_BuildStats; }
+		//Nodes and leaves, not the mesh itself
+		size_t GetNumBytes() const;
+
+	private:
+		static constexpr int Width{ 8 };
+		static constexpr uint32_t LeafFlag{ 0x80000000u };
+		static constexpr uint32_t EmptyChild{ 0xFFFFFFFFu };
+
+		//Children bounds, one lane per child, empty lanes have inverted bounds so they never hit
+		struct alignas(32) Node
+		{
+			float minX[Width];
+			float minY[Width];
+			float minZ[Width];
+			float maxX[Width];
+			float maxY[Width];
+			float maxZ[Width];
+			uint32_t children[Width]; //Node index, LeafFlag | packet index or EmptyChild
+		};
+
+		//Up to 8 triangles as structure of arrays, unused lanes are degenerate (zero normal) and never hit.
+		//The vertices are stored as is (not as edges), so triangles sharing an edge stay watertight
+		struct alignas(32) TrianglePacket
+		{
+			float v0X[Width];
+			float v0Y[Width];
+			float v0Z[Width];
+			float v1X[Width];
+			float v1Y[Width];
+			float v1Z[Width];
+			float v2X[Width];
+			float v2Y[Width];
+			float v2Z[Width];
+			float normalX[Width];
+			float normalY[Width];
+			float normalZ[Width];
+			uint32_t triangleIndices[Width];
+		};
+
+		//Leaves of compressed meshes only hold which triangles they contain (EmptyChild for unused lanes),
+		//the vertices are decoded from the mesh into a TrianglePacket when a ray reaches the leaf
+		struct alignas(32) ReferencePacket
+		{
+			uint32_t triangleIndices[Width];
+		};
+
+		//Intermediate binary tree
+		struct BuildNode
+		{
+			Vector3 boundsMin{};
+			Vector3 boundsMax{};
+			uint32_t first{}; //Leaf >> first build triangle, interior >> left child (right child is left + 1)
+			uint32_t count{}; //Triangles in the leaf, 0 for interior nodes
+		};
+
+		//A whole triangle, or with spatial splits the part of one inside the bounds
+		struct BuildTriangle
+		{
+			Vector3 boundsMin{};
+			Vector3 boundsMax{};
+			Vector3 centroid{};
+			uint32_t triangleIndex{};
+
+			//Spatial splits can leave nothing of the triangle on one side
+			bool IsEmpty() const { return boundsMin.x > boundsMax.x || boundsMin.y > boundsMax.y || boundsMin.z > boundsMax.z; }
+		};
+
+		struct ObjectSplit
+		{
+			float cost{ FLT_MAX };
+			int axis{ -1 }; //-1 when no plane separates the centroids
+			int bin{}; //Centroids in this bin or a lower one go left
+			float binOrigin{};
+			float binScale{};
+			Vector3 leftMin{};
+			Vector3 leftMax{};
+			Vector3 rightMin{};
+			Vector3 rightMax{};
+
+			bool IsLeft(const BuildTriangle& triangle) const;
+		};
+
+		struct SpatialSplit
+		{
+			float cost{ FLT_MAX };
+			int axis{ -1 };
+			float position{};
+		};
+
+		//Binary tree under construction, nodes are claimed in pairs so subtrees can be built concurrently
+		struct BuildState
+		{
+			//Scratch, from the building thread's frame arena
+			FrameVector<BuildNode> nodes{};
+			FrameVector<BuildTriangle> triangles{};
+			FrameVector<uint64_t> mortonCodes{}; //Same order as triangles, LBVH only
+			std::atomic<uint32_t> numNodes{};
+
+			//Spatial splits only, leaves append their references to triangles
+			const TriangleMesh* pMesh{ nullptr };
+			float rootArea{};
+			std::atomic<uint32_t> numReferences{};
+			uint32_t maxReferences{};
+			std::mutex leafMutex{};
+		};
+
+		static constexpr uint32_t MaxLeafSize{ Width };
+		static constexpr int NumBins{ 16 };
+		//Subtrees with fewer triangles are built on the calling task
+		static constexpr uint32_t ParallelBuildThreshold{ 4096 };
+		//Nodes with more triangles are binned in parallel chunks of this size
+		static constexpr uint32_t BinningChunkSize{ 16384 };
+		//Spatial splits are only tried where the object split children overlap by more than this part of the root area
+		static constexpr float SpatialSplitOverlap{ 1e-5f };
+		//Below this depth only object splits, they always make progress
+		static constexpr int MaxSpatialSplitDepth{ 48 };
+		//Above this, 30 bit Morton codes (10 per axis) give too many duplicates, use 63 bit
+		static constexpr uint32_t WideMortonThreshold{ 1u << 18 };
+
+		std::vector<Node> m_Nodes{};
+		std::vector<TrianglePacket> m_Packets{};
+		std::vector<ReferencePacket> m_ReferencePackets{}; //Instead of m_Packets when the mesh is compressed
+		bool m_IsCompressed{ false };
+		BuildStats m_BuildStats{};
+
+		template<TriangleKernel Kernel>
+		bool IntersectWith(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord) const;
+		void BuildBinned(BuildState& state, uint32_t nodeIndex) const;
+		void BuildSpatial(BuildState& state, uint32_t nodeIndex, std::vector<BuildTriangle>& references, int depth) const;
+		static ObjectSplit FindObjectSplit(const BuildTriangle* pTriangles, uint32_t count, const BuildNode& node);
+		static SpatialSplit FindSpatialSplit(const std::vector<BuildTriangle>& references, const BuildNode& node, const TriangleMesh& mesh);
+		static void SplitReference(const BuildTriangle& reference, const TriangleMesh& mesh, int axis, float position, BuildTriangle& left, BuildTriangle& right);
+		void SortMorton(BuildState& state, const Vector3& centroidMin, const Vector3& centroidMax) const;
+		void BuildMorton(BuildState& state, uint32_t nodeIndex) const;
+		uint32_t Collapse(const BuildState& state, const TriangleMesh& mesh, uint32_t buildNodeIndex, float rootArea);
+		uint32_t CreatePacket(const BuildNode& leaf, const BuildState& state, const TriangleMesh& mesh);
+		static const TrianglePacket& DecodePacket(const TriangleMesh& mesh, const ReferencePacket& references, TrianglePacket& packet);
+		Node& AddNode();
+	};
+}
@@ -1,8 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
 #include "Math.h"
 #include "DataTypes.h"
+#include "BRDFs.h"
 
 
 namespace dae
@@ -13,39 +18,20 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Distance only, for traversal loops that just keep the nearest one
+		inline bool HitDistance_Sphere(const Sphere& sphere, const Ray& ray, float& t)
 		{
-			const float a{ Vector3::Dot(ray.direction, ray.direction) };
-			const float b{ Vector3::Dot((ray.direction * 2), (ray.origin - sphere.origin)) };
-			//float b{ Dot((ray.origin - m_Point), ray.direction * 2.0f) };
+			const float a{ Vector3::Dot(ray.GetDirection(), ray.GetDirection()) };
+			const float b{ Vector3::Dot((ray.GetDirection() * 2), (ray.origin - sphere.origin)) };
+			//float b{ Dot((ray.origin - m_Point), ray.GetDirection() * 2.0f) };
 			const float c{ (Vector3::Dot((ray.origin - sphere.origin), (ray.origin - sphere.origin))) - (sphere.radius * sphere.radius) };
 
 			const float discriminant{ (b * b) - (4 * (a * c)) };
 
-			float t{};
-
 			if (discriminant > 0)
 			{
 				t = ((-b) - sqrt(discriminant)) / (2 * a);
-
-				if (t >= ray.min && t <= ray.max)
-				{
-					if (ignoreHitRecord)
-					{
-						return true;
-					}
-
-					hitRecord.materialIndex = sphere.materialIndex;
-					hitRecord.origin = ray.origin + (t * ray.direction);
-					hitRecord.didHit = true;
-					hitRecord.t = t;
-					hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
-					return true;
-				}
-				else
-				{
-					return false;
-				}
+				return t >= ray.min && t <= ray.max;
 			}
 			else
 			{
@@ -53,6 +39,27 @@ namespace dae
 			}
 		}
 
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (!HitDistance_Sphere(sphere, ray, t))
+			{
+				return false;
+			}
+
+			if (ignoreHitRecord)
+			{
+				return true;
+			}
+
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.origin = ray.origin + (t * ray.GetDirection());
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+			return true;
+		}
+
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
 			HitRecord temp{};
@@ -61,11 +68,17 @@ namespace dae
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Distance only, for traversal loops that just keep the nearest one
+		inline bool HitDistance_Plane(const Plane& plane, const Ray& ray, float& t)
 		{
-			const float t{ Vector3::Dot((plane.origin - ray.origin), plane.normal) / Vector3::Dot(ray.direction, plane.normal) };
+			t = Vector3::Dot((plane.origin - ray.origin), plane.normal) / Vector3::Dot(ray.GetDirection(), plane.normal);
+			return t >= ray.min && t <= ray.max;
+		}
 
-			if (t >= ray.min && t <= ray.max)
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (HitDistance_Plane(plane, ray, t))
 			{
 				if (ignoreHitRecord)
 				{
@@ -73,7 +86,7 @@ namespace dae
 				}
 
 				hitRecord.materialIndex = plane.materialIndex;
-				hitRecord.origin = ray.origin + (t * ray.direction);
+				hitRecord.origin = ray.origin + (t * ray.GetDirection());
 				hitRecord.didHit = true;
 				hitRecord.t = t;
 				hitRecord.normal = plane.normal;
@@ -95,12 +108,13 @@ namespace dae
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Parallel rays and the culled side, shadow rays (ignoreHitRecord) flip the culling
+		inline bool IsCulled_Triangle(const Triangle& triangle, const Ray& ray, bool ignoreHitRecord)
 		{
-			const float dotNV{ Vector3::Dot(triangle.normal, ray.direction) };
+			const float dotNV{ Vector3::Dot(triangle.normal, ray.GetDirection()) };
 			if (dotNV == 0)
 			{
-				return false;
+				return true;
 			}
 
 			if (!ignoreHitRecord)
@@ -110,13 +124,13 @@ namespace dae
 				case TriangleCullMode::BackFaceCulling:
 					if (dotNV > 0)
 					{
-						return false;
+						return true;
 					}
 					break;
 				case TriangleCullMode::FrontFaceCulling:
 					if (dotNV < 0)
 					{
-						return false;
+						return true;
 					}
 					break;
 				case TriangleCullMode::NoCulling:
@@ -130,13 +144,13 @@ namespace dae
 				case TriangleCullMode::BackFaceCulling:
 					if (dotNV < 0)
 					{
-						return false;
+						return true;
 					}
 					break;
 				case TriangleCullMode::FrontFaceCulling:
 					if (dotNV > 0)
 					{
-						return false;
+						return true;
 					}
 					break;
 				case TriangleCullMode::NoCulling:
@@ -144,16 +158,31 @@ namespace dae
 				}
 			}
 
+			return false;
+		}
+
+		/**
+		 * \brief Distance and barycentrics only, for traversal loops that just keep the nearest hit
+		 * \param u, v Barycentrics (weights of v1 and v2)
+		 * \param ignoreHitRecord Shadow ray, flips the culling like the HitTest_Triangle overload
+		 */
+		inline bool HitDistance_Triangle(const Triangle& triangle, const Ray& ray, float& t, float& u, float& v, bool ignoreHitRecord = false)
+		{
+			if (IsCulled_Triangle(triangle, ray, ignoreHitRecord))
+			{
+				return false;
+			}
+
 			const Vector3 edge1{ triangle.v1 - triangle.v0 };
 			const Vector3 edge2{ triangle.v2 - triangle.v0 };
-			const Vector3 pVec{ Vector3::Cross(ray.direction, edge2) };
+			const Vector3 pVec{ Vector3::Cross(ray.GetDirection(), edge2) };
 			const float det = Vector3::Dot(edge1, pVec);
 
 			const float invDet = 1 / det;
 
 			const Vector3 tVec = ray.origin - triangle.v0;
 
-			const float u = invDet * Vector3::Dot(tVec, pVec);
+			u = invDet * Vector3::Dot(tVec, pVec);
 
 			if (u < 0.0f || u > 1.f)
 			{
@@ -162,24 +191,126 @@ namespace dae
 
 			const Vector3 qVec = Vector3::Cross(tVec, edge1);
 
-			const float v = invDet * Vector3::Dot(ray.direction, qVec);
+			v = invDet * Vector3::Dot(ray.GetDirection(), qVec);
 
 			if (v < 0.0f || u + v > 1.f)
 			{
 				return false;
 			}
 
-			const float t = invDet * Vector3::Dot(edge2, qVec);
+			t = invDet * Vector3::Dot(edge2, qVec);
+
+			return t >= ray.min && t <= ray.max;
+		}
+
+		//Ray permuted so its largest direction component is z and sheared so it points along +z, computed once per ray
+		struct WatertightRay
+		{
+			int kx{};
+			int ky{};
+			int kz{};
+			float shearX{};
+			float shearY{};
+			float shearZ{};
+		};
+
+		inline WatertightRay MakeWatertightRay(const Ray& ray)
+		{
+			WatertightRay watertightRay{};
+			const Vector3 absDirection{ std::abs(ray.GetDirection().x), std::abs(ray.GetDirection().y), std::abs(ray.GetDirection().z) };
+			watertightRay.kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+			watertightRay.kx = (watertightRay.kz + 1) % 3;
+			watertightRay.ky = (watertightRay.kx + 1) % 3;
+			//Keeps the winding, so the sign of the edge functions still tells the side
+			if (ray.GetDirection()[watertightRay.kz] < 0.f)
+			{
+				std::swap(watertightRay.kx, watertightRay.ky);
+			}
+
+			watertightRay.shearX = ray.GetDirection()[watertightRay.kx] / ray.GetDirection()[watertightRay.kz];
+			watertightRay.shearY = ray.GetDirection()[watertightRay.ky] / ray.GetDirection()[watertightRay.kz];
+			watertightRay.shearZ = 1.f / ray.GetDirection()[watertightRay.kz];
+			return watertightRay;
+		}
+
+		/**
+		 * \brief Watertight test (Woop, Benthin and Wald 2013), same results as HitDistance_Triangle except on edges:
+		 * the vertices are moved into a space where the ray is the +z axis, and the 2D edge functions there are exactly the same
+		 * for two triangles sharing an edge, so rays through the edge hit one of them and never slip through the gap.
+		 * Edge functions that round to zero are recomputed in double precision.
+		 * \param watertightRay MakeWatertightRay of ray
+		 */
+		inline bool HitDistance_TriangleWatertight(const Triangle& triangle, const Ray& ray, const WatertightRay& watertightRay, float& t, float& u, float& v,
+			bool ignoreHitRecord = false)
+		{
+			if (IsCulled_Triangle(triangle, ray, ignoreHitRecord))
+			{
+				return false;
+			}
+
+			const int kx{ watertightRay.kx };
+			const int ky{ watertightRay.ky };
+			const int kz{ watertightRay.kz };
+
+			const Vector3 a{ triangle.v0 - ray.origin };
+			const Vector3 b{ triangle.v1 - ray.origin };
+			const Vector3 c{ triangle.v2 - ray.origin };
+
+			const float ax{ a[kx] - watertightRay.shearX * a[kz] };
+			const float ay{ a[ky] - watertightRay.shearY * a[kz] };
+			const float bx{ b[kx] - watertightRay.shearX * b[kz] };
+			const float by{ b[ky] - watertightRay.shearY * b[kz] };
+			const float cx{ c[kx] - watertightRay.shearX * c[kz] };
+			const float cy{ c[ky] - watertightRay.shearY * c[kz] };
+
+			float edgeU{ cx * by - cy * bx };
+			float edgeV{ ax * cy - ay * cx };
+			float edgeW{ bx * ay - by * ax };
+			if (edgeU == 0.f || edgeV == 0.f || edgeW == 0.f)
+			{
+				edgeU = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+				edgeV = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+				edgeW = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+			}
 
-			if (t < ray.min || t > ray.max)
+			if ((edgeU < 0.f || edgeV < 0.f || edgeW < 0.f) && (edgeU > 0.f || edgeV > 0.f || edgeW > 0.f))
+			{
 				return false;
+			}
 
-			const Vector3 p{ ray.origin + (t * ray.direction) };
+			const float det{ edgeU + edgeV + edgeW };
+			if (det == 0.f)
+			{
+				return false;
+			}
+
+			const float invDet{ 1.f / det };
+			const float scaledT{ edgeU * a[kz] + edgeV * b[kz] + edgeW * c[kz] };
+			t = watertightRay.shearZ * scaledT * invDet;
+			u = edgeV * invDet;
+			v = edgeW * invDet;
+
+			return t >= ray.min && t <= ray.max;
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			float u{};
+			float v{};
+			if (!HitDistance_Triangle(triangle, ray, t, u, v, ignoreHitRecord))
+			{
+				return false;
+			}
+
+			const Vector3 p{ ray.origin + (t * ray.GetDirection()) };
 
 			hitRecord.materialIndex = triangle.materialIndex;
 			hitRecord.origin = p;
 			hitRecord.didHit = true;
 			hitRecord.t = t;
+			hitRecord.u = u;
+			hitRecord.v = v;
 			hitRecord.normal = triangle.normal;
 			return true;
 		}
@@ -192,31 +323,44 @@ namespace dae
 #pragma endregion
 #pragma region SlabTest
 
-		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		/**
+		 * \brief Ray against box, all three slabs at once, multiplies by the cached reciprocal direction only.
+		 * Axis parallel rays give infinite or NaN plane distances, the NaNs are dropped by the min/max operand order
+		 * (the SSE min/max return the second operand when either is NaN). The far distance is widened by the
+		 * rounding error bound (SLAB_FAR_SCALE) so rounding never misses a box the ray grazes.
+		 */
+		inline bool SlabTest(const Vector3& boundsMin, const Vector3& boundsMax, const Ray& ray, float rayMax)
 		{
-			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
-			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
-
-			float tmin = std::min(tx1, tx2);
-			float tmax = std::max(tx1, tx2);
-
-			float ty1 = (mesh.transformedMinAABB.y - ray.origin.y) / ray.direction.y;
-			float ty2 = (mesh.transformedMaxAABB.y - ray.origin.y) / ray.direction.y;
-
-			tmin = std::max(tmin, std::min(ty1, ty2));
-			tmax = std::min(tmax, std::max(ty1, ty2));
-
-			float tz1 = (mesh.transformedMinAABB.z - ray.origin.z) / ray.direction.z;
-			float tz2 = (mesh.transformedMaxAABB.z - ray.origin.z) / ray.direction.z;
-
-			tmin = std::max(tmin, std::min(tz1, tz2));
-			tmax = std::min(tmax, std::max(tz1, tz2));
+			//Entry and exit planes picked by the direction signs the ray cached
+			const Float4 origin{ ray.origin };
+			const Float4 inverseDirection{ ray.inverseDirection };
+			const Float4 nearPlanes{ ray.isDirectionNegative[0] ? boundsMax.x : boundsMin.x, ray.isDirectionNegative[1] ? boundsMax.y : boundsMin.y,
+				ray.isDirectionNegative[2] ? boundsMax.z : boundsMin.z, 0.f };
+			const Float4 farPlanes{ ray.isDirectionNegative[0] ? boundsMin.x : boundsMax.x, ray.isDirectionNegative[1] ? boundsMin.y : boundsMax.y,
+				ray.isDirectionNegative[2] ? boundsMin.z : boundsMax.z, 0.f };
+			const Float4 tNear{ (nearPlanes - origin) * inverseDirection };
+			const Float4 tFar{ (farPlanes - origin) * inverseDirection * SLAB_FAR_SCALE };
+
+			const float tmin = Float4::MaxComponent3(Float4::Max(tNear, Float4{ ray.min }));
+			const float tmax = Float4::MinComponent3(Float4::Min(tFar, Float4{ rayMax }));
+
+			return tmin <= tmax;
+		}
 
-			return tmax > 0 && tmax >= tmin;
+		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		{
+			return SlabTest(mesh.transformedMinAABB, mesh.transformedMaxAABB, ray, ray.max);
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		/**
+		 * \brief Nearest triangle of the mesh, only records which one (t, barycentrics, primitiveIndex, pMesh),
+		 * position, normal and material are left to the final closest hit (Scene::GetClosestHit)
+		 * \param hitRecord Only overwritten by hits closer than its current t
+		 * \param ignoreHitRecord Any hit (shadow rays), returns on the first one found
+		 */
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false,
+			TriangleKernel kernel = TriangleKernel::MollerTrumbore)
 		{
 			if (!SlabTest_TriangleMesh(mesh, ray))
 			{
@@ -225,17 +369,22 @@ namespace dae
 
 			int normalCount{};
 			Triangle triangle{};
-			HitRecord hit{};
 			triangle.cullMode = mesh.cullMode;
 			triangle.materialIndex = mesh.materialIndex;
 
-			for (size_t i = 0; i < mesh.indices.size(); i += 3)
+			const WatertightRay watertightRay{ kernel == TriangleKernel::Watertight ? MakeWatertightRay(ray) : WatertightRay{} };
+			bool didHit{ false };
+			float t{};
+			float u{};
+			float v{};
+			const uint32_t numTriangles{ mesh.GetNumTriangles() };
+			for (uint32_t i = 0; i < numTriangles; ++i)
 			{
-				const Vector3 p0 = mesh.transformedPositions[mesh.indices[i]];
-				const Vector3 p1 = mesh.transformedPositions[mesh.indices[i + 1]];
-				const Vector3 p2 = mesh.transformedPositions[mesh.indices[i + 2]];
+				const Vector3 p0 = mesh.GetTransformedPosition(i, 0);
+				const Vector3 p1 = mesh.GetTransformedPosition(i, 1);
+				const Vector3 p2 = mesh.GetTransformedPosition(i, 2);
 
-				const Vector3 normal = mesh.transformedNormals[normalCount];
+				const Vector3 normal = mesh.GetTransformedNormal(normalCount);
 				
 				++normalCount;
 				triangle.v0 = p0;
@@ -243,19 +392,27 @@ namespace dae
 				triangle.v2 = p2;
 				triangle.normal = normal;
 
-				if (HitTest_Triangle(triangle, ray, hit, ignoreHitRecord))
+				const bool isHit{ kernel == TriangleKernel::Watertight ? HitDistance_TriangleWatertight(triangle, ray, watertightRay, t, u, v, ignoreHitRecord)
+					: HitDistance_Triangle(triangle, ray, t, u, v, ignoreHitRecord) };
+				if (isHit)
 				{
-					if (hit.t < hitRecord.t)
-					{
-						hitRecord = hit;
-					}
 					if (ignoreHitRecord)
 					{
 						return true;
 					}
+					if (t < hitRecord.t)
+					{
+						hitRecord.t = t;
+						hitRecord.u = u;
+						hitRecord.v = v;
+						hitRecord.primitiveIndex = normalCount - 1;
+						hitRecord.pMesh = &mesh;
+						hitRecord.geometry = HitGeometry::Triangle;
+						didHit = true;
+					}
 				}
 			}
-			return hitRecord.didHit;
+			return didHit;
 		}
 
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
@@ -263,11 +420,136 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_TriangleMesh(mesh, ray, temp, true);
 		}
+
+		//Only call this on the final closest hit, interpolating for every candidate is wasted work
+		inline void InterpolateHitAttributes(HitRecord& hitRecord)
+		{
+			if (hitRecord.pMesh)
+			{
+				hitRecord.normal = hitRecord.pMesh->InterpolateNormal(hitRecord.primitiveIndex, hitRecord.u, hitRecord.v);
+				hitRecord.uv = hitRecord.pMesh->InterpolateUV(hitRecord.primitiveIndex, hitRecord.u, hitRecord.v);
+			}
+		}
+
+		/**
+		 * \brief Start of a ray leaving the hit in direction, pushed off along the geometric normal to the side it leaves on.
+		 * The interpolated normal can point into the surface near silhouettes, starting along it gives shadow acne.
+		 * Smooth shaded triangles leaving on the front first lift the point onto the curved surface the vertex normals describe
+		 * (Hanika 2021), otherwise the flat facets cast hard shadows on the lit side of the terminator. Instanced meshes are lifted in object space.
+		 */
+		inline Vector3 OffsetRayOrigin(const HitRecord& hitRecord, const Vector3& direction)
+		{
+			constexpr float offset{ 0.01f };
+			const bool isFront{ Vector3::Dot(hitRecord.geometricNormal, direction) >= 0.f };
+
+			Vector3 origin{ hitRecord.origin };
+			if (isFront && hitRecord.pMesh && hitRecord.pMesh->HasVertexNormals())
+			{
+				const TriangleMesh& mesh = *hitRecord.pMesh;
+				const MeshInstance* pInstance{ hitRecord.pInstance };
+				const Vector3 meshOrigin{ pInstance ? pInstance->worldToObject.TransformPoint(hitRecord.origin) : hitRecord.origin };
+				Vector3 liftedOrigin{ meshOrigin };
+				const float weights[3]{ 1.f - hitRecord.u - hitRecord.v, hitRecord.u, hitRecord.v };
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					//Below the tangent plane of this vertex, move up onto it
+					const uint32_t vertexIndex{ mesh.GetVertexIndex(hitRecord.primitiveIndex * size_t(3) + corner) };
+					const Vector3 vertexNormal{ mesh.GetTransformedVertexNormal(vertexIndex) };
+					const float height{ Vector3::Dot(meshOrigin - mesh.GetTransformedPosition(vertexIndex), vertexNormal) };
+					liftedOrigin -= (weights[corner] * std::min(height, 0.f)) * vertexNormal;
+				}
+				origin = pInstance ? pInstance->objectToWorld.TransformPoint(liftedOrigin) : liftedOrigin;
+			}
+
+			return origin + (isFront ? offset : -offset) * hitRecord.geometricNormal;
+		}
+
+		/**
+		 * \brief Intersects the differential rays with the tangent plane of the hit to get the uv footprint of the pixel
+		 * \param hitRecord Closest hit (attributes interpolated), receives dUVdx and dUVdy
+		 * \param rayDifferential Offset rays, zero derivatives when it has none
+		 */
+		inline void ComputeUVDerivatives(HitRecord& hitRecord, const RayDifferential& rayDifferential)
+		{
+			hitRecord.dUVdx = {};
+			hitRecord.dUVdy = {};
+
+			if (!rayDifferential.hasDifferentials || !hitRecord.pMesh || hitRecord.pMesh->uvs.empty())
+			{
+				return;
+			}
+
+			//Instanced meshes are in object space, so is the intersection with their triangle's plane
+			const TriangleMesh& mesh = *hitRecord.pMesh;
+			const MeshInstance* pInstance{ hitRecord.pInstance };
+			const Vector3 planeNormal{ mesh.GetTransformedNormal(hitRecord.primitiveIndex) };
+			const Vector3 hitOrigin{ pInstance ? pInstance->worldToObject.TransformPoint(hitRecord.origin) : hitRecord.origin };
+
+			const auto uvOnPlane = [&](const Vector3& worldOrigin, const Vector3& worldDirection, Vector2& uv)
+			{
+				const Vector3 origin{ pInstance ? pInstance->worldToObject.TransformPoint(worldOrigin) : worldOrigin };
+				const Vector3 direction{ pInstance ? pInstance->worldToObject.TransformVector(worldDirection) : worldDirection };
+				const float dotND{ Vector3::Dot(planeNormal, direction) };
+				if (AreEqual(dotND, 0.f))
+				{
+					return false;
+				}
+
+				const float t{ Vector3::Dot(planeNormal, hitOrigin - origin) / dotND };
+				float u{}, v{};
+				mesh.GetBarycentrics(hitRecord.primitiveIndex, origin + t * direction, u, v);
+				uv = mesh.InterpolateUV(hitRecord.primitiveIndex, u, v);
+				return true;
+			};
+
+			Vector2 uvX{}, uvY{};
+			if (uvOnPlane(rayDifferential.rxOrigin, rayDifferential.rxDirection, uvX) &&
+				uvOnPlane(rayDifferential.ryOrigin, rayDifferential.ryDirection, uvY))
+			{
+				hitRecord.dUVdx = uvX - hitRecord.uv;
+				hitRecord.dUVdy = uvY - hitRecord.uv;
+			}
+		}
+
+		//Mirror reflection of the differential rays, assuming the surface is locally flat
+		inline void ReflectRayDifferential(RayDifferential& rayDifferential, const HitRecord& hitRecord)
+		{
+			if (!rayDifferential.hasDifferentials)
+			{
+				return;
+			}
+
+			const auto reflect = [&](Vector3& origin, Vector3& direction)
+			{
+				const float dotND{ Vector3::Dot(hitRecord.normal, direction) };
+				if (AreEqual(dotND, 0.f))
+				{
+					return false;
+				}
+
+				origin += (Vector3::Dot(hitRecord.normal, hitRecord.origin - origin) / dotND) * direction;
+				direction = Vector3::Reflect(direction, hitRecord.normal);
+				return true;
+			};
+
+			rayDifferential.hasDifferentials = reflect(rayDifferential.rxOrigin, rayDifferential.rxDirection)
+				&& reflect(rayDifferential.ryOrigin, rayDifferential.ryDirection);
+		}
 #pragma endregion
 	}
 
 	namespace LightUtils
 	{
+		//Radiance below this can't change an 8-bit pixel
+		constexpr float RadianceCutoff{ 1.f / 255.f };
+
+		//Influence radius of a point light, intensity / d^2 drops below the cutoff past it
+		inline float GetLightRange(const Light& light)
+		{
+			const float maxColor{ std::max(light.color.r, std::max(light.color.g, light.color.b)) };
+			return sqrtf(light.intensity * maxColor / RadianceCutoff);
+		}
+
 		//Direction from target to light
 		inline Vector3 GetDirectionToLight(const Light& light, const Vector3 origin)
 		{
@@ -280,52 +562,208 @@ namespace dae
 			return  light.color * light.intensity / static_cast<float>( pow((light.origin - target).Magnitude(), 2));
 
 		}
+
+		//Emitted radiance of a sphere light, matches the point light intensity when seen from far away
+		inline ColorRGB GetSphereLightRadiance(const Light& light)
+		{
+			return light.color * (light.intensity / (PI * light.radius * light.radius));
+		}
+
+		//Density of SampleSphereLight, zero inside the sphere
+		inline float GetSphereLightPdf(const Light& light, const Vector3& target)
+		{
+			const float distanceSqr{ (light.origin - target).SqrMagnitude() };
+			const float radiusSqr{ light.radius * light.radius };
+			if (distanceSqr <= radiusSqr)
+				return 0.f;
+
+			const float sinThetaMaxSqr{ radiusSqr / distanceSqr };
+			const float oneMinusCosThetaMax{ sinThetaMaxSqr / (1.f + sqrtf(1.f - sinThetaMaxSqr)) };
+			return 1.f / (PI_2 * oneMinusCosThetaMax);
+		}
+
+		/**
+		 * \brief Uniformly samples the cone of directions from target to a sphere light
+		 * \param light Point light with a radius
+		 * \param target Shading point
+		 * \param u Two uniform numbers in [0, 1)
+		 * \param lightDirection Normalized direction towards the sampled point on the light
+		 * \param distance Distance to the sampled point
+		 * \param pdf Solid angle density (GetSphereLightPdf)
+		 * \return False if target is inside the sphere
+		 */
+		inline bool SampleSphereLight(const Light& light, const Vector3& target, const Vector2& u, Vector3& lightDirection, float& distance, float& pdf)
+		{
+			const Vector3 toCenter{ light.origin - target };
+			const float distanceSqr{ toCenter.SqrMagnitude() };
+			const float radiusSqr{ light.radius * light.radius };
+			if (distanceSqr <= radiusSqr)
+				return false;
+
+			const float centerDistance{ sqrtf(distanceSqr) };
+			const Vector3 axis{ toCenter / centerDistance };
+
+			//1 - cos computed from sin^2, the cone of a far away light is tiny
+			const float sinThetaMaxSqr{ radiusSqr / distanceSqr };
+			const float oneMinusCosThetaMax{ sinThetaMaxSqr / (1.f + sqrtf(1.f - sinThetaMaxSqr)) };
+
+			const float cosTheta{ 1.f - u.x * oneMinusCosThetaMax };
+			const float sinTheta{ sqrtf(std::max(0.f, 1.f - cosTheta * cosTheta)) };
+			const float phi{ PI_2 * u.y };
+
+			Vector3 tangent{}, bitangent{};
+			BRDF::OrthonormalBasis(axis, tangent, bitangent);
+			lightDirection = tangent * (sinTheta * cosf(phi)) + bitangent * (sinTheta * sinf(phi)) + axis * cosTheta;
+
+			//Near side of the sphere along the sampled direction
+			const float projection{ centerDistance * cosTheta };
+			distance = projection - sqrtf(std::max(0.f, radiusSqr - (distanceSqr - projection * projection)));
+
+			pdf = 1.f / (PI_2 * oneMinusCosThetaMax);
+			return true;
+		}
 	}
 
 	namespace Utils
 	{
-		//Just parses vertices and indices
+		//Parses vertices, texture coordinates (vt), vertex normals (vn) and (polygon) faces
+		//Vertices are unwelded per (v, vt, vn) combination so every output vertex has exactly one uv and normal
 #pragma warning(push)
 #pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices,
+			std::vector<Vector3>& vertexNormals, std::vector<Vector2>& uvs)
 		{
 			std::ifstream file(filename);
 			if (!file)
 				return false;
 
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
+			std::vector<Vector3> filePositions{};
+			std::vector<Vector3> fileNormals{};
+			std::vector<Vector2> fileUVs{};
+
+			struct VertexKey
+			{
+				int position{};
+				int uv{ -1 };
+				int normal{ -1 };
 
-			while (!file.eof())
+				bool operator==(const VertexKey& other) const
+				{
+					return position == other.position && uv == other.uv && normal == other.normal;
+				}
+			};
+			struct VertexKeyHash
 			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
+				size_t operator()(const VertexKey& key) const
 				{
-					// Ignore Comment
+					return (static_cast<size_t>(key.position) * 73856093) ^ (static_cast<size_t>(key.uv) * 19349663) ^ (static_cast<size_t>(key.normal) * 83492791);
 				}
-				else if (sCommand == "v")
+			};
+
+			//(position, uv, normal) >> output vertex index
+			std::unordered_map<VertexKey, int, VertexKeyHash> vertexLookup{};
+			std::vector<int> faceIndices{};
+			bool hasVertexNormals{ false };
+			bool hasUVs{ false };
+
+			const auto resolveIndex = [](int index, size_t count)
+			{
+				//OBJ indices are 1-based, negative indices are relative to the end
+				return index < 0 ? static_cast<int>(count) + index : index - 1;
+			};
+
+			std::string line;
+			std::string sCommand;
+			while (std::getline(file, line))
+			{
+				std::istringstream lineStream(line);
+				sCommand.clear();
+				lineStream >> sCommand;
+
+				if (sCommand == "v")
 				{
 					//Vertex
 					float x, y, z;
-					file >> x >> y >> z;
-					positions.push_back({ x, y, z });
+					lineStream >> x >> y >> z;
+					filePositions.push_back({ x, y, z });
+				}
+				else if (sCommand == "vt")
+				{
+					//Texture Coordinate, OBJ has the origin in the bottom left
+					float u, v;
+					lineStream >> u >> v;
+					fileUVs.push_back({ u, 1.f - v });
+				}
+				else if (sCommand == "vn")
+				{
+					//Vertex Normal
+					float x, y, z;
+					lineStream >> x >> y >> z;
+					fileNormals.push_back(Vector3{ x, y, z }.Normalized());
 				}
 				else if (sCommand == "f")
 				{
-					float i0, i1, i2;
-					file >> i0 >> i1 >> i2;
+					faceIndices.clear();
+
+					std::string token;
+					while (lineStream >> token)
+					{
+						//v, v/vt, v//vn or v/vt/vn
+						VertexKey key{};
+
+						const size_t firstSlash{ token.find('/') };
+						key.position = resolveIndex(std::stoi(token.substr(0, firstSlash)), filePositions.size());
+
+						if (firstSlash != std::string::npos)
+						{
+							const size_t secondSlash{ token.find('/', firstSlash + 1) };
+							const size_t uvLength{ (secondSlash == std::string::npos ? token.size() : secondSlash) - firstSlash - 1 };
+							if (uvLength > 0)
+							{
+								key.uv = resolveIndex(std::stoi(token.substr(firstSlash + 1, uvLength)), fileUVs.size());
+							}
+							if (secondSlash != std::string::npos && secondSlash + 1 < token.size())
+							{
+								key.normal = resolveIndex(std::stoi(token.substr(secondSlash + 1)), fileNormals.size());
+							}
+						}
+
+						hasUVs |= key.uv >= 0;
+						hasVertexNormals |= key.normal >= 0;
+
+						const auto it = vertexLookup.find(key);
+						if (it != vertexLookup.end())
+						{
+							faceIndices.push_back(it->second);
+							continue;
+						}
+
+						const int vertexIndex{ static_cast<int>(positions.size()) };
+						positions.push_back(filePositions[key.position]);
+						uvs.push_back(key.uv >= 0 ? fileUVs[key.uv] : Vector2::Zero);
+						vertexNormals.push_back(key.normal >= 0 ? fileNormals[key.normal] : Vector3::Zero);
+						vertexLookup.emplace(key, vertexIndex);
+						faceIndices.push_back(vertexIndex);
+					}
 
-					indices.push_back((int)i0 - 1);
-					indices.push_back((int)i1 - 1);
-					indices.push_back((int)i2 - 1);
+					//Triangulate polygons as a fan
+					for (size_t i = 2; i < faceIndices.size(); ++i)
+					{
+						indices.push_back(faceIndices[0]);
+						indices.push_back(faceIndices[i - 1]);
+						indices.push_back(faceIndices[i]);
+					}
 				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
+				//Comments (#) and unsupported commands are ignored
+			}
 
-				if (file.eof()) 
-					break;
+			if (!hasUVs)
+			{
+				uvs.clear();
+			}
+			if (!hasVertexNormals)
+			{
+				vertexNormals.clear();
 			}
 
 			//Precompute normals
@@ -339,23 +777,34 @@ namespace dae
 				Vector3 edgeV0V2 = positions[i2] - positions[i0];
 				Vector3 normal = Vector3::Cross(edgeV0V1, edgeV0V2);
 
-				if(isnan(normal.x))
-				{
-					int k = 0;
-				}
-
 				normal.Normalize();
-				if (isnan(normal.x))
-				{
-					int k = 0;
-				}
 
 				normals.push_back(normal);
 			}
 
+			//Faces without vn get the smooth normal over all faces around their vertices, not just the first one that used them
+			if (hasVertexNormals && std::any_of(vertexNormals.begin(), vertexNormals.end(), [](const Vector3& n) { return n.SqrMagnitude() <= 0.f; }))
+			{
+				std::vector<Vector3> smoothNormals{};
+				TriangleMesh::CalculateVertexNormals(positions, indices, smoothNormals);
+				for (size_t i = 0; i < vertexNormals.size(); ++i)
+				{
+					if (vertexNormals[i].SqrMagnitude() <= 0.f)
+						vertexNormals[i] = smoothNormals[i];
+				}
+			}
+
 			return true;
 		}
 
+		//Just parses vertices and indices, vertex normals and texture coordinates are discarded
+		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+		{
+			std::vector<Vector3> vertexNormals{};
+			std::vector<Vector2> uvs{};
+			return ParseOBJ(filename, positions, normals, indices, vertexNormals, uvs);
+		}
+
 		
 #pragma warning(pop)
 	}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+
+namespace dae
+{
+	struct Vector2
+	{
+		float x{};
+		float y{};
+
+		Vector2() = default;
+		constexpr Vector2(float _x, float _y);
+
+		float Magnitude() const;
+		constexpr float SqrMagnitude() const;
+
+		static constexpr float Dot(const Vector2& v1, const Vector2& v2);
+
+		//Member Operators
+		constexpr Vector2 operator*(float scale) const;
+		constexpr Vector2 operator+(const Vector2& v) const;
+		constexpr Vector2 operator-(const Vector2& v) const;
+		constexpr Vector2& operator+=(const Vector2& v);
+		float& operator[](int index);
+		float operator[](int index) const;
+
+		static const Vector2 Zero;
+	};
+
+	//Header only so every call inlines, hit tests and shading call these per ray
+	inline const Vector2 Vector2::Zero = Vector2{ 0, 0 };
+
+	constexpr Vector2::Vector2(float _x, float _y) : x(_x), y(_y) {}
+
+	inline float Vector2::Magnitude() const
+	{
+		return sqrtf(x * x + y * y);
+	}
+
+	constexpr float Vector2::SqrMagnitude() const
+	{
+		return x * x + y * y;
+	}
+
+	constexpr float Vector2::Dot(const Vector2& v1, const Vector2& v2)
+	{
+		return { (v1.x * v2.x) + (v1.y * v2.y) };
+	}
+
+#pragma region Operator Overloads
+	constexpr Vector2 Vector2::operator*(float scale) const
+	{
+		return { x * scale, y * scale };
+	}
+
+	constexpr Vector2 Vector2::operator+(const Vector2& v) const
+	{
+		return { x + v.x, y + v.y };
+	}
+
+	constexpr Vector2 Vector2::operator-(const Vector2& v) const
+	{
+		return { x - v.x, y - v.y };
+	}
+
+	constexpr Vector2& Vector2::operator+=(const Vector2& v)
+	{
+		x += v.x;
+		y += v.y;
+		return *this;
+	}
+
+	inline float& Vector2::operator[](int index)
+	{
+		assert(index <= 1 && index >= 0);
+
+		if (index == 0) return x;
+		return y;
+	}
+
+	inline float Vector2::operator[](int index) const
+	{
+		assert(index <= 1 && index >= 0);
+
+		if (index == 0) return x;
+		return y;
+	}
+#pragma endregion
+
+	//Global Operators
+	constexpr Vector2 operator*(float scale, const Vector2& v)
+	{
+		return { v.x * scale, v.y * scale };
+	}
+}
@@ -0,0 +1,72 @@
+#include "WorkerPool.h"
+
+namespace dae
+{
+	WorkerPool::WorkerPool(uint32_t numWorkers)
+	{
+		m_Threads.reserve(numWorkers);
+		for (uint32_t workerIndex = 0; workerIndex < numWorkers; ++workerIndex)
+		{
+			m_Threads.emplace_back(&WorkerPool::WorkerLoop, this, workerIndex);
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			m_IsStopping = true;
+		}
+		m_JobStarted.notify_all();
+
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	void WorkerPool::RunErased(JobFunction pJobFunction, const void* pJob)
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		m_pJobFunction = pJobFunction;
+		m_pJob = pJob;
+		m_NumRunning = GetNumWorkers();
+		++m_JobIndex;
+		m_JobStarted.notify_all();
+
+		m_JobFinished.wait(lock, [this] { return m_NumRunning == 0; });
+	}
+
+	void WorkerPool::WorkerLoop(uint32_t workerIndex)
+	{
+		uint64_t lastJobIndex{};
+		while (true)
+		{
+			JobFunction pJobFunction{};
+			const void* pJob{};
+			{
+				std::unique_lock<std::mutex> lock{ m_Mutex };
+				m_JobStarted.wait(lock, [this, lastJobIndex] { return m_IsStopping || m_JobIndex != lastJobIndex; });
+				if (m_IsStopping)
+				{
+					return;
+				}
+				lastJobIndex = m_JobIndex;
+				pJobFunction = m_pJobFunction;
+				pJob = m_pJob;
+			}
+
+			pJobFunction(pJob, workerIndex);
+
+			bool isLast{};
+			{
+				std::lock_guard<std::mutex> lock{ m_Mutex };
+				isLast = --m_NumRunning == 0;
+			}
+			if (isLast)
+			{
+				m_JobFinished.notify_one();
+			}
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	/**
+	 * \brief Threads started once that all run the same job when asked, for the ASYNC render path.
+	 * std::async allocates a shared state for every task it launches, running a frame on these doesn't allocate.
+	 */
+	class WorkerPool final
+	{
+	public:
+		explicit WorkerPool(uint32_t numWorkers);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool(WorkerPool&&) noexcept = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+		WorkerPool& operator=(WorkerPool&&) noexcept = delete;
+
+		//Calls job(workerIndex) once on every worker and waits until all of them returned
+		template<typename Job>
+		void Run(const Job& job)
+		{
+			RunErased([](const void* pJob, uint32_t workerIndex) { (*static_cast<const Job*>(pJob))(workerIndex); }, &job);
+		}
+
+		uint32_t GetNumWorkers() const { return static_cast<uint32_t>(m_Threads.size()); }
+
+	private:
+		using JobFunction = void(*)(const void* pJob, uint32_t workerIndex);
+
+		std::vector<std::thread> m_Threads{};
+		std::mutex m_Mutex{};
+		std::condition_variable m_JobStarted{};
+		std::condition_variable m_JobFinished{};
+		JobFunction m_pJobFunction{ nullptr };
+		const void* m_pJob{ nullptr };
+		uint64_t m_JobIndex{}; //Bumped for every job, workers run each one once
+		uint32_t m_NumRunning{};
+		bool m_IsStopping{ false };
+
+		void RunErased(JobFunction pJobFunction, const void* pJob);
+		void WorkerLoop(uint32_t workerIndex);
+	};
+}
@@ -5,9 +5,11 @@
 #undef main
 
 //Standard includes
+#include <cstdlib>
 #include <iostream>
 
 //Project includes
+#include "AllocationCounter.h"
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
@@ -20,12 +22,43 @@ void ShutDown(SDL_Window* pWindow)
 	SDL_Quit();
 }
 
-int main(int argc, char* args[])
+//Scenes by number, picked with the first command line argument or the number keys
+Scene* CreateScene(int sceneNumber)
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	Scene* pScene{ nullptr };
+	switch (sceneNumber)
+	{
+	case 1:
+		pScene = new Scene_W1();
+		break;
+	case 2:
+		pScene = new Scene_W2();
+		break;
+	case 3:
+		pScene = new Scene_W3();
+		break;
+	case 4:
+		pScene = new Scene_W4();
+		break;
+	case 6:
+		pScene = new Scene_W4_Bunny();
+		break;
+	case 7:
+		pScene = new Scene_Textures();
+		break;
+	case 8:
+		pScene = new Scene_Stress({ 10000, 64, 32, 2, StressDistribution::Clustered });
+		break;
+	default:
+		pScene = new Scene_W4_ReferenceScene();
+		break;
+	}
+	pScene->Initialize();
+	return pScene;
+}
 
+int main(int argc, char* args[])
+{
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -45,13 +78,8 @@ int main(int argc, char* args[])
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
 
-	//const auto pScene = new Scene_W1();
-	//const auto pScene = new Scene_W2();
-	//const auto pScene = new Scene_W3();
-	//const auto pScene = new Scene_W4();
-	const auto pScene = new Scene_W4_ReferenceScene();
-	//const auto pScene = new Scene_W4_Bunny();
-	pScene->Initialize();
+	//1 W1, 2 W2, 3 W3, 4 W4, 5 Reference (default), 6 Bunny, 7 Textures, 8 Stress
+	Scene* pScene = CreateScene(argc > 1 ? std::atoi(args[1]) : 5);
 
 	//Start loop
 	pTimer->Start();
@@ -84,19 +112,54 @@ int main(int argc, char* args[])
 				case SDLK_F1:
 					pRenderer->ToggleReflections();
 					break;
+				case SDLK_F4:
+					pRenderer->TogglePathTracing();
+					break;
+				case SDLK_F5:
+					pRenderer->ToggleDenoiser();
+					break;
 				case SDLK_F6:
 					pTimer->StartBenchmark();
 					break;
+				case SDLK_F7:
+					pRenderer->ToggleTemporalReuse();
+					break;
+				case SDLK_F8:
+					pRenderer->ToggleDynamicResolution();
+					break;
+				case SDLK_F9:
+					pRenderer->CycleInterleaving();
+					break;
+				case SDLK_F10:
+					pRenderer->ToggleFrameBudget();
+					break;
+				case SDLK_F11:
+					pRenderer->ToggleIncrementalRendering();
+					break;
+				case SDLK_F12:
+					pRenderer->ToggleRasterization();
+					break;
+				case SDLK_1: case SDLK_2: case SDLK_3: case SDLK_4:
+				case SDLK_5: case SDLK_6: case SDLK_7: case SDLK_8:
+					delete pScene;
+					pScene = CreateScene(e.key.keysym.sym - SDLK_0);
+					pRenderer->ResetHistory();
+					break;
 				}
 				break;
 			}
 		}
+		const uint64_t frameAllocationsStart{ AllocationCounter::GetNumAllocations() };
+
 		//--------- Update ---------
 		pScene->Update(pTimer);
 
 		//--------- Render ---------
 		pRenderer->Render(pScene);
 
+		//Once warmed up, a frame that only moves things shouldn't allocate
+		const uint64_t frameAllocations{ AllocationCounter::GetNumAllocations() - frameAllocationsStart };
+
 		//--------- Timer ---------
 		pTimer->Update();
 		printTimer += pTimer->GetElapsed();
@@ -104,6 +167,8 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			if (frameAllocations > 0)
+				std::cout << "Heap allocations in the last frame: " << frameAllocations << std::endl;
 		}
 
 		//Save screenshot after full render